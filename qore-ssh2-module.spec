@@ -1,4 +1,4 @@
-%define mod_ver 1.4.2
+%define mod_ver 1.5
 
 %{?_datarootdir: %global mydatarootdir %_datarootdir}
 %{!?_datarootdir: %global mydatarootdir /usr/share}
@@ -114,6 +114,9 @@ This RPM provides API documentation, test and example programs
 %doc docs/ssh2/ docs/SftpPoller/ docs/SftpPollerUtil/ docs/Ssh2Connections/ test/
 
 %changelog
+* Sat Oct 17 2026 David Nichols <david@qore.org> - 1.5
+- updated to version 1.5
+
 * Sat Aug 12 2023 David Nichols <david@qore.org> - 1.4.2
 - updated to version 1.4.2
 
@@ -31,5 +31,6 @@
 
 DLLLOCAL QoreClass* initSSH2BaseClass(QoreNamespace& ns);
 DLLLOCAL extern QoreClass* QC_SSH2BASE;
+DLLLOCAL extern qore_classid_t CID_SSH2BASE;
 
 #endif
@@ -0,0 +1,585 @@
+/* -*- indent-tabs-mode: nil -*- */
+/*
+    SFTPBatch.cpp
+
+    batched SFTP metadata operations
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SFTPClient.h"
+#include "SSH2WorkerPool.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// maximum number of parallel sessions for batch operations
+#define SFTP_BATCH_MAX_WORKERS 64
+// default number of parallel sessions for batch operations
+#define SFTP_BATCH_DEFAULT_WORKERS 4
+// the interval for checking for cancellation while waiting for background workers
+#define SFTP_BATCH_CANCEL_POLL_MS 100
+
+static const char* SFTPCLIENT_STATMANY_ERROR = "SFTPCLIENT-STATMANY-ERROR";
+static const char* SFTPCLIENT_REMOVEFILES_ERROR = "SFTPCLIENT-REMOVEFILES-ERROR";
+static const char* SFTPCLIENT_RENAMEMANY_ERROR = "SFTPCLIENT-RENAMEMANY-ERROR";
+static const char* SFTPCLIENT_CHMODMANY_ERROR = "SFTPCLIENT-CHMODMANY-ERROR";
+
+// the result of a single operation in a batch
+enum sftp_batch_rc_t {
+    SBR_PENDING = 0,
+    SBR_OK = 1,
+    // the path does not exist
+    SBR_NOT_FOUND = 2,
+    SBR_ERROR = 3,
+};
+
+// a single operation in a batch
+struct SftpBatchItem {
+    // the path as given by the caller
+    std::string path;
+    // the absolute path
+    std::string abs_path;
+    // the target path as given by the caller and the absolute target path for rename operations
+    std::string target;
+    std::string abs_target;
+
+    sftp_batch_rc_t rc = SBR_PENDING;
+    // true if the result was taken from the metadata cache
+    bool cached = false;
+    // the attributes for stat operations
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+    // exception info if the operation failed
+    std::string err;
+    std::string desc;
+
+    DLLLOCAL SftpBatchItem(const char* p, std::string&& a) : path(p), abs_path(std::move(a)) {
+    }
+
+    DLLLOCAL SftpBatchItem(const char* p, std::string&& a, const char* t, std::string&& at) : path(p),
+            abs_path(std::move(a)), target(t), abs_target(std::move(at)) {
+    }
+};
+
+class SftpBatch;
+
+// argument for a background worker thread
+struct SftpBatchWorker {
+    SftpBatch* b;
+    SFTPClient* client;
+};
+
+// executes a list of metadata operations; each session sends the requests for its share of the list back to back
+// with the object lock held for the entire batch
+class SftpBatch {
+public:
+    enum op_t {
+        STAT,
+        REMOVE,
+        RENAME,
+        CHMOD,
+    };
+
+    std::vector<SftpBatchItem> items;
+
+    DLLLOCAL SftpBatch(op_t op, const char* err, const char* meth, int to, bool stop, int mode = 0) : op(op),
+            errstr(err), meth(meth), timeout_ms(to), stop_on_error(stop), mode(mode) {
+    }
+
+    // runs a batch of operations that modify the remote filesystem, invalidates the metadata cache for all paths
+    // in the batch and returns a list of hash<SftpBatchResult>
+    DLLLOCAL QoreListNode* runMutation(SFTPClient* client, unsigned workers, ExceptionSink* xsink);
+
+    // returns a list of hash<SftpBatchResult> for all items in the batch
+    DLLLOCAL QoreListNode* getResults(ExceptionSink* xsink) const;
+
+    // processes all items that are not yet complete with the given number of sessions, the first of which is the
+    // given client; returns -1 if an exception was raised
+    DLLLOCAL int run(SFTPClient* client, unsigned workers, ExceptionSink* xsink);
+
+private:
+    op_t op;
+    const char* errstr;
+    const char* meth;
+    int timeout_ms;
+    // if true, the first error stops the batch and is raised as an exception
+    bool stop_on_error;
+    // the permissions for chmod operations
+    int mode;
+
+    SSH2WorkerPool* pool = nullptr;
+    // the indexes of the items to be processed
+    std::vector<size_t> pending;
+    // background workers; set once all background workers have been started
+    std::atomic<std::vector<SftpBatchWorker>*> worker_list{nullptr};
+    // the source client
+    SFTPClient* source = nullptr;
+
+    // the first error that stopped the batch
+    QoreThreadLock l;
+    std::string stop_err, stop_desc;
+
+    // processes items with the given client until there are no more unclaimed items
+    DLLLOCAL void process(SFTPClient* client);
+
+    // executes a single operation
+    DLLLOCAL void doItem(SFTPClient* client, SftpBatchItem& item);
+
+    // sets the permissions of a single file
+    DLLLOCAL void doChmod(SFTPClient* client, QSftpHelper& qh, SftpBatchItem& item);
+
+    // stops the batch with the given error and cancels operations in progress in all other sessions
+    DLLLOCAL void stop(SFTPClient* client, const std::string& err, const std::string& desc);
+
+    DLLLOCAL static void workerThread(ExceptionSink* xsink, void* arg);
+};
+
+int SftpBatch::run(SFTPClient* client, unsigned workers, ExceptionSink* xsink) {
+    for (size_t i = 0, e = items.size(); i < e; ++i) {
+        if (items[i].rc == SBR_PENDING)
+            pending.push_back(i);
+    }
+    if (pending.empty())
+        return 0;
+
+    SSH2WorkerPool wp(pending.size());
+    pool = &wp;
+
+    if (workers > pending.size())
+        workers = pending.size();
+
+    // each additional worker gets its own connection with the same parameters as the source client
+    std::vector<SftpBatchWorker> wl;
+    wl.reserve(workers);
+    source = client;
+
+    client->enterCancelRegion();
+    for (unsigned i = 1; i < workers; ++i) {
+        wl.push_back({this, new SFTPClient(*client)});
+        if (wp.startThread(workerThread, &wl.back(), xsink)) {
+            // continue with the workers already started
+            xsink->clear();
+            static_cast<AbstractPrivateData*>(wl.back().client)->deref(xsink);
+            wl.pop_back();
+            break;
+        }
+    }
+
+    worker_list = &wl;
+
+    // the calling thread processes items with the source client
+    process(client);
+
+    while (!wp.wait(SFTP_BATCH_CANCEL_POLL_MS)) {
+        if (client->takeCancel())
+            stop(client, SSH2_CANCELLED, std::string(meth) + "() was cancelled");
+    }
+    client->exitCancelRegion();
+    pool = nullptr;
+    worker_list = nullptr;
+
+    for (auto& i : wl)
+        static_cast<AbstractPrivateData*>(i.client)->deref(xsink);
+
+    if (!stop_err.empty()) {
+        xsink->raiseException(stop_err.c_str(), "%s", stop_desc.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+void SftpBatch::process(SFTPClient* client) {
+    AutoLocker al(client->m);
+
+    BlockingHelper bh(client);
+
+    size_t i;
+    while (pool->next(i)) {
+        SftpBatchItem& item = items[pending[i]];
+        doItem(client, item);
+        if (item.rc == SBR_ERROR && (stop_on_error || item.err == SSH2_CANCELLED))
+            stop(client, item.err, item.desc);
+    }
+}
+
+void SftpBatch::doItem(SFTPClient* client, SftpBatchItem& item) {
+    ExceptionSink xsink;
+
+    // the connection is only checked once per batch, but the session is closed if an operation times out, in which
+    // case a new connection is made; if this fails, the batch is stopped, as every other item would wait for the
+    // connection to fail as well
+    if (!client->sftp_session) {
+        if (client->sftpConnectUnlocked(timeout_ms, &xsink)) {
+            std::string err, desc;
+            getExceptionInfo(xsink, err, desc);
+            xsink.clear();
+            stop(client, err, desc);
+            return;
+        }
+        // connecting restores blocking mode, but the batch runs with the session in non-blocking mode
+        client->setBlockingUnlocked(false);
+    }
+
+    QSftpHelper qh(client, errstr, meth, timeout_ms, &xsink);
+
+    int rc;
+    switch (op) {
+        case STAT:
+            while ((rc = libssh2_sftp_stat(client->sftp_session, item.abs_path.c_str(), &item.attrs))
+                == LIBSSH2_ERROR_EAGAIN) {
+                if (qh.waitSocket())
+                    break;
+            }
+            if (rc < 0 && !xsink) {
+                if (libssh2_session_last_errno(client->ssh_session) == LIBSSH2_ERROR_SFTP_PROTOCOL
+                    && libssh2_sftp_last_error(client->sftp_session) == LIBSSH2_FX_NO_SUCH_FILE) {
+                    item.rc = SBR_NOT_FOUND;
+                    return;
+                }
+                qh.err("libssh2_sftp_stat(%s) returned an error", item.abs_path.c_str());
+            }
+            break;
+
+        case REMOVE:
+            while ((rc = libssh2_sftp_unlink(client->sftp_session, item.abs_path.c_str())) == LIBSSH2_ERROR_EAGAIN) {
+                if (qh.waitSocket())
+                    break;
+            }
+            if (rc < 0 && !xsink)
+                qh.err("libssh2_sftp_unlink(%s) returned an error", item.abs_path.c_str());
+            break;
+
+        case RENAME:
+            while ((rc = libssh2_sftp_rename(client->sftp_session, item.abs_path.c_str(), item.abs_target.c_str()))
+                == LIBSSH2_ERROR_EAGAIN) {
+                if (qh.waitSocket())
+                    break;
+            }
+            if (rc < 0 && !xsink)
+                qh.err("libssh2_sftp_rename(%s, %s) returned an error", item.abs_path.c_str(),
+                    item.abs_target.c_str());
+            break;
+
+        case CHMOD:
+            doChmod(client, qh, item);
+            break;
+    }
+
+    if (xsink) {
+        item.rc = SBR_ERROR;
+        getExceptionInfo(xsink, item.err, item.desc);
+        xsink.clear();
+        return;
+    }
+
+    item.rc = SBR_OK;
+}
+
+void SftpBatch::doChmod(SFTPClient* client, QSftpHelper& qh, SftpBatchItem& item) {
+    // only the ugo permission bits are changed, as with SFTPClient::chmod()
+    int rc;
+    while ((rc = libssh2_sftp_stat(client->sftp_session, item.abs_path.c_str(), &item.attrs))
+        == LIBSSH2_ERROR_EAGAIN) {
+        if (qh.waitSocket())
+            return;
+    }
+    if (rc < 0) {
+        qh.err("libssh2_sftp_stat(%s) returned an error", item.abs_path.c_str());
+        return;
+    }
+    if (!(item.attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)) {
+        qh.err("permissions not supported by sftp server");
+        return;
+    }
+
+    unsigned long newmode = (item.attrs.permissions & (-1^SFTP_UGOMASK)) | (mode & SFTP_UGOMASK);
+    item.attrs.permissions = newmode;
+
+    while ((rc = libssh2_sftp_setstat(client->sftp_session, item.abs_path.c_str(), &item.attrs))
+        == LIBSSH2_ERROR_EAGAIN) {
+        if (qh.waitSocket())
+            return;
+    }
+    if (rc >= 0)
+        return;
+
+    // some servers return an error even though the permissions were set, so the attributes are checked again
+    while ((rc = libssh2_sftp_stat(client->sftp_session, item.abs_path.c_str(), &item.attrs))
+        == LIBSSH2_ERROR_EAGAIN) {
+        if (qh.waitSocket())
+            return;
+    }
+    if (rc < 0 || item.attrs.permissions != newmode)
+        qh.err("libssh2_sftp_setstat(%s) returned an error", item.abs_path.c_str());
+}
+
+void SftpBatch::stop(SFTPClient* client, const std::string& err, const std::string& desc) {
+    {
+        AutoLocker al(l);
+        if (!stop_err.empty())
+            return;
+        stop_err = err;
+        stop_desc = desc;
+    }
+
+    pool->stop();
+    std::vector<SftpBatchWorker>* wl = worker_list;
+    if (wl) {
+        if (client != source)
+            source->cancel();
+        for (auto& i : *wl) {
+            if (i.client != client)
+                i.client->cancel();
+        }
+    }
+}
+
+void SftpBatch::workerThread(ExceptionSink* xsink, void* arg) {
+    SftpBatchWorker* w = reinterpret_cast<SftpBatchWorker*>(arg);
+    SftpBatch* b = w->b;
+
+    {
+        // a worker that cannot connect leaves its share of the items to the other workers
+        ExceptionSink cxsink;
+        if (!w->client->sftpConnect(b->timeout_ms, &cxsink)) {
+            b->process(w->client);
+            w->client->disconnect(true, b->timeout_ms);
+        } else {
+            printd(5, "SftpBatch::workerThread() client %p: failed to connect; exiting\n", w->client);
+            cxsink.clear();
+        }
+    }
+
+    // "b" must not be accessed after this call
+    b->pool->workerDone();
+}
+
+// returns the number of workers from the options or -1 if an exception was raised
+static int64 get_batch_workers(const QoreHashNode* opts, const char* err, ExceptionSink* xsink) {
+    int64 workers = getIntOption(opts, "workers", SFTP_BATCH_DEFAULT_WORKERS);
+    if (workers < 1 || workers > SFTP_BATCH_MAX_WORKERS) {
+        xsink->raiseException(err, "invalid \"workers\" option " QLLD "; expecting a value from 1 to %d", workers,
+            SFTP_BATCH_MAX_WORKERS);
+        return -1;
+    }
+    return workers;
+}
+
+QoreHashNode* SFTPClient::sftpStatMany(const QoreListNode* paths, int timeout_ms, const QoreHashNode* opts,
+        ExceptionSink* xsink) {
+    int64 workers = get_batch_workers(opts, SFTPCLIENT_STATMANY_ERROR, xsink);
+    if (workers < 0)
+        return nullptr;
+
+    SftpBatch b(SftpBatch::STAT, SFTPCLIENT_STATMANY_ERROR, "SFTPClient::statMany", timeout_ms, true);
+    b.items.reserve(paths->size());
+
+    {
+        AutoLocker al(m);
+
+        // try to make an implicit connection
+        if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+            return nullptr;
+
+        int64 n = 0;
+        ConstListIterator li(paths);
+        while (li.next()) {
+            const char* path = li.getValue().get<const QoreStringNode>()->c_str();
+            if (!*path) {
+                xsink->raiseException(SFTPCLIENT_STATMANY_ERROR, "empty path given in element " QLLD, n);
+                return nullptr;
+            }
+            ++n;
+            b.items.emplace_back(path, absolute_filename(this, path));
+            SftpBatchItem& item = b.items.back();
+            if (cache.getAttrs(item.abs_path, item.attrs)) {
+                item.rc = SBR_OK;
+                item.cached = true;
+            }
+        }
+    }
+
+    if (b.run(this, (unsigned)workers, xsink))
+        return nullptr;
+
+    {
+        AutoLocker al(m);
+        if (cache.enabled()) {
+            for (auto& i : b.items) {
+                if (i.rc == SBR_OK && !i.cached)
+                    cache.putAttrs(i.abs_path, i.attrs);
+            }
+        }
+    }
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(autoTypeInfo), xsink);
+    for (auto& i : b.items)
+        rv->setKeyValue(i.path.c_str(), i.rc == SBR_OK ? statInfo(i.attrs, xsink) : QoreValue(), xsink);
+    return rv.release();
+}
+
+QoreListNode* SftpBatch::getResults(ExceptionSink* xsink) const {
+    ReferenceHolder<QoreListNode> rv(new QoreListNode(hashdeclSftpBatchResult->getTypeInfo()), xsink);
+    for (auto& i : items) {
+        ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpBatchResult, xsink), xsink);
+        h->setKeyValue("path", new QoreStringNode(i.path), xsink);
+        if (op == RENAME)
+            h->setKeyValue("target", new QoreStringNode(i.target), xsink);
+        h->setKeyValue("success", i.rc == SBR_OK, xsink);
+        if (i.rc != SBR_OK) {
+            h->setKeyValue("err", new QoreStringNode(i.err), xsink);
+            h->setKeyValue("desc", new QoreStringNode(i.desc), xsink);
+        }
+        rv->push(h.release(), xsink);
+    }
+    return rv.release();
+}
+
+QoreListNode* SftpBatch::runMutation(SFTPClient* client, unsigned workers, ExceptionSink* xsink) {
+    int rc = run(client, workers, xsink);
+
+    {
+        AutoLocker al(client->m);
+        for (auto& i : items) {
+            client->cache.invalidate(i.abs_path);
+            if (!i.abs_target.empty())
+                client->cache.invalidate(i.abs_target);
+        }
+    }
+
+    return rc ? nullptr : getResults(xsink);
+}
+
+// returns -1 if an exception was raised
+static int get_batch_options(const QoreHashNode* opts, const char* err, int64& workers, bool& stop_on_error,
+        ExceptionSink* xsink) {
+    workers = get_batch_workers(opts, err, xsink);
+    if (workers < 0)
+        return -1;
+    stop_on_error = opts ? opts->getKeyValue("stop_on_error").getAsBool() : false;
+    return 0;
+}
+
+QoreListNode* SFTPClient::sftpRemoveFiles(const QoreListNode* paths, int timeout_ms, const QoreHashNode* opts,
+        ExceptionSink* xsink) {
+    int64 workers;
+    bool stop_on_error;
+    if (get_batch_options(opts, SFTPCLIENT_REMOVEFILES_ERROR, workers, stop_on_error, xsink))
+        return nullptr;
+
+    SftpBatch b(SftpBatch::REMOVE, SFTPCLIENT_REMOVEFILES_ERROR, "SFTPClient::removeFiles", timeout_ms,
+        stop_on_error);
+    b.items.reserve(paths->size());
+
+    {
+        AutoLocker al(m);
+
+        // try to make an implicit connection
+        if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+            return nullptr;
+
+        int64 n = 0;
+        ConstListIterator li(paths);
+        while (li.next()) {
+            const char* path = li.getValue().get<const QoreStringNode>()->c_str();
+            if (!*path) {
+                xsink->raiseException(SFTPCLIENT_REMOVEFILES_ERROR, "empty path given in element " QLLD, n);
+                return nullptr;
+            }
+            ++n;
+            b.items.emplace_back(path, absolute_filename(this, path));
+        }
+    }
+
+    return b.runMutation(this, (unsigned)workers, xsink);
+}
+
+QoreListNode* SFTPClient::sftpRenameMany(const QoreHashNode* renames, int timeout_ms, const QoreHashNode* opts,
+        ExceptionSink* xsink) {
+    int64 workers;
+    bool stop_on_error;
+    if (get_batch_options(opts, SFTPCLIENT_RENAMEMANY_ERROR, workers, stop_on_error, xsink))
+        return nullptr;
+
+    SftpBatch b(SftpBatch::RENAME, SFTPCLIENT_RENAMEMANY_ERROR, "SFTPClient::renameMany", timeout_ms,
+        stop_on_error);
+    b.items.reserve(renames->size());
+
+    {
+        AutoLocker al(m);
+
+        // try to make an implicit connection
+        if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+            return nullptr;
+
+        ConstHashIterator hi(renames);
+        while (hi.next()) {
+            const char* from = hi.getKey();
+            QoreValue v = hi.get();
+            if (v.getType() != NT_STRING) {
+                xsink->raiseException(SFTPCLIENT_RENAMEMANY_ERROR, "the target for '%s' has type '%s'; expecting "
+                    "'string'", from, v.getTypeName());
+                return nullptr;
+            }
+            const char* to = v.get<const QoreStringNode>()->c_str();
+            if (!*from || !*to) {
+                xsink->raiseException(SFTPCLIENT_RENAMEMANY_ERROR, "empty path given in rename of '%s' to '%s'",
+                    from, to);
+                return nullptr;
+            }
+            b.items.emplace_back(from, absolute_filename(this, from), to, absolute_filename(this, to));
+        }
+    }
+
+    return b.runMutation(this, (unsigned)workers, xsink);
+}
+
+QoreListNode* SFTPClient::sftpChmodMany(const QoreListNode* paths, int mode, int timeout_ms,
+        const QoreHashNode* opts, ExceptionSink* xsink) {
+    int64 workers;
+    bool stop_on_error;
+    if (get_batch_options(opts, SFTPCLIENT_CHMODMANY_ERROR, workers, stop_on_error, xsink))
+        return nullptr;
+
+    SftpBatch b(SftpBatch::CHMOD, SFTPCLIENT_CHMODMANY_ERROR, "SFTPClient::chmodMany", timeout_ms, stop_on_error,
+        mode);
+    b.items.reserve(paths->size());
+
+    {
+        AutoLocker al(m);
+
+        // try to make an implicit connection
+        if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+            return nullptr;
+
+        int64 n = 0;
+        ConstListIterator li(paths);
+        while (li.next()) {
+            const char* path = li.getValue().get<const QoreStringNode>()->c_str();
+            if (!*path) {
+                xsink->raiseException(SFTPCLIENT_CHMODMANY_ERROR, "empty path given in element " QLLD, n);
+                return nullptr;
+            }
+            ++n;
+            b.items.emplace_back(path, absolute_filename(this, path));
+        }
+    }
+
+    return b.runMutation(this, (unsigned)workers, xsink);
+}
@@ -0,0 +1,743 @@
+/* -*- indent-tabs-mode: nil -*- */
+/*
+    SFTPBulkTransfer.cpp
+
+    parallel bulk SFTP transfers
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SFTPClient.h"
+#include "SSH2WorkerPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// default number of parallel sessions for bulk transfers
+#define SFTP_BULK_DEFAULT_WORKERS 4
+// maximum number of parallel sessions for bulk transfers
+#define SFTP_BULK_MAX_WORKERS 64
+// the interval for checking for cancellation while waiting for background workers
+#define SFTP_BULK_CANCEL_POLL_MS 100
+
+static const char* SFTPCLIENT_GETFILES_ERROR = "SFTPCLIENT-GETFILES-ERROR";
+static const char* SFTPCLIENT_PUTFILES_ERROR = "SFTPCLIENT-PUTFILES-ERROR";
+static const char* SFTP_BULK_TIMEOUT = "SFTPCLIENT-TIMEOUT";
+
+// the state of a single file in a bulk transfer
+struct SftpBulkJob {
+    std::string remote_path;
+    std::string local_path;
+
+    bool success = false;
+    // bytes transferred
+    int64 size = 0;
+    // transfer time in microseconds
+    int64 us = 0;
+
+    // exception info if the transfer failed
+    std::string err;
+    std::string desc;
+
+    DLLLOCAL SftpBulkJob(std::string&& r, std::string&& l) : remote_path(std::move(r)), local_path(std::move(l)) {
+    }
+};
+
+// a remote file whose handle is being closed (and which is then optionally renamed to its final name) while the next
+// file is being opened on the same session
+struct SftpPendingFinish {
+    enum state_t {
+        IDLE,
+        CLOSING,
+        RENAMING,
+        CHECKING,
+        REMOVING,
+        RENAMING_AGAIN,
+    };
+
+    state_t state = IDLE;
+    LIBSSH2_SFTP_HANDLE* h = nullptr;
+    SftpBulkJob* job = nullptr;
+    // absolute remote paths
+    std::string path;
+    std::string temp_path;
+    std::chrono::steady_clock::time_point start;
+    int64 size = 0;
+};
+
+class SftpBulkTransfer;
+
+// argument for a background worker thread
+struct SftpBulkWorker {
+    SftpBulkTransfer* bt;
+    SFTPClient* client;
+};
+
+class SftpBulkTransfer {
+public:
+    std::vector<SftpBulkJob> jobs;
+
+    DLLLOCAL SftpBulkTransfer(bool p, int to, int md, std::string&& ts = std::string()) : put(p), timeout_ms(to), mode(md),
+            temp_suffix(std::move(ts)) {
+    }
+
+    // processes all jobs with the given number of sessions, the first of which is the given client
+    DLLLOCAL QoreHashNode* run(SFTPClient* client, unsigned workers, ExceptionSink* xsink);
+
+private:
+    SSH2WorkerPool* pool = nullptr;
+    // true for uploads, false for downloads
+    bool put;
+    int timeout_ms;
+    int mode;
+    // if set, uploads are written to the remote path with this suffix and renamed when complete
+    std::string temp_suffix;
+    // the number of sessions that actually processed jobs
+    std::atomic<unsigned> sessions{0};
+    // background workers; set once all background workers have been started
+    std::atomic<std::vector<SftpBulkWorker>*> worker_list{nullptr};
+    // the source client
+    SFTPClient* source = nullptr;
+
+    // stops the transfer if the given job was cancelled and cancels operations in progress in all other sessions
+    DLLLOCAL void checkCancel(SFTPClient* client, const SftpBulkJob& job);
+
+    // stops the transfer and cancels operations in progress in all sessions except the given one
+    DLLLOCAL void cancelAll(SFTPClient* client);
+
+    // processes jobs with the given client until there are no more unclaimed jobs
+    DLLLOCAL void process(SFTPClient* client);
+
+    // uploads files with the given client until there are no more unclaimed jobs
+    DLLLOCAL void processPut(SFTPClient* client);
+
+    // uploads a single file; the remote handle is left in "pf" to be closed while the next file is opened
+    DLLLOCAL void putFile(SFTPClient* client, SftpBulkJob& job, SftpPendingFinish& pf, bool& pf_owner);
+
+    // advances the pending close / rename operation; returns LIBSSH2_ERROR_EAGAIN if it is still in progress
+    DLLLOCAL int stepFinish(SFTPClient* client, SftpPendingFinish& pf);
+
+    // closes a remote handle after an error; errors are ignored
+    DLLLOCAL void closeHandle(SFTPClient* client, LIBSSH2_SFTP_HANDLE* h);
+
+    // completes the pending close / rename operation
+    DLLLOCAL void finishPending(SFTPClient* client, SftpPendingFinish& pf);
+
+    // marks the pending job as failed with the error in the given sink
+    DLLLOCAL void failFinish(SftpPendingFinish& pf, ExceptionSink& xsink);
+
+    // marks the pending job as failed with the current session error
+    DLLLOCAL void failFinish(SFTPClient* client, SftpPendingFinish& pf, const char* op);
+
+    DLLLOCAL static void workerThread(ExceptionSink* xsink, void* arg);
+};
+
+QoreHashNode* SftpBulkTransfer::run(SFTPClient* client, unsigned workers, ExceptionSink* xsink) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SSH2WorkerPool wp(jobs.size());
+    pool = &wp;
+
+    if (workers > jobs.size())
+        workers = jobs.size();
+
+    // each additional worker gets its own connection with the same parameters as the source client
+    std::vector<SftpBulkWorker> wl;
+    wl.reserve(workers);
+    source = client;
+
+    // the whole request is cancellable, so a cancellation after the calling thread has finished its own jobs still
+    // stops the other workers
+    client->enterCancelRegion();
+    for (unsigned i = 1; i < workers; ++i) {
+        wl.push_back({this, new SFTPClient(*client)});
+        if (wp.startThread(workerThread, &wl.back(), xsink)) {
+            // continue with the workers already started
+            xsink->clear();
+            static_cast<AbstractPrivateData*>(wl.back().client)->deref(xsink);
+            wl.pop_back();
+            break;
+        }
+    }
+
+    worker_list = &wl;
+
+    // the calling thread processes jobs with the source client
+    if (!jobs.empty()) {
+        ++sessions;
+        process(client);
+    }
+
+    while (!wp.wait(SFTP_BULK_CANCEL_POLL_MS)) {
+        if (client->takeCancel())
+            cancelAll(client);
+    }
+    client->exitCancelRegion();
+    pool = nullptr;
+    worker_list = nullptr;
+
+    for (auto& i : wl)
+        static_cast<AbstractPrivateData*>(i.client)->deref(xsink);
+
+    int64 us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    ReferenceHolder<QoreListNode> files(new QoreListNode(hashdeclSftpTransferResult->getTypeInfo()), xsink);
+    int64 bytes = 0;
+    int64 count = 0;
+    for (auto& i : jobs) {
+        ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpTransferResult, xsink), xsink);
+        h->setKeyValue("remote_path", new QoreStringNode(i.remote_path), xsink);
+        h->setKeyValue("local_path", new QoreStringNode(i.local_path), xsink);
+        h->setKeyValue("success", i.success, xsink);
+        h->setKeyValue("size", i.size, xsink);
+        h->setKeyValue("us", i.us, xsink);
+        if (!i.success && i.err.empty()) {
+            // the file was never claimed by a worker
+            i.err = SSH2_CANCELLED;
+            i.desc = "the file was not transferred because the request was cancelled";
+        }
+        if (!i.success) {
+            h->setKeyValue("err", new QoreStringNode(i.err), xsink);
+            h->setKeyValue("desc", new QoreStringNode(i.desc), xsink);
+        } else {
+            bytes += i.size;
+            ++count;
+        }
+        files->push(h.release(), xsink);
+    }
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(hashdeclSftpBulkTransferInfo, xsink), xsink);
+    rv->setKeyValue("files", files.release(), xsink);
+    rv->setKeyValue("count", count, xsink);
+    rv->setKeyValue("errors", (int64)jobs.size() - count, xsink);
+    rv->setKeyValue("bytes", bytes, xsink);
+    rv->setKeyValue("us", us, xsink);
+    rv->setKeyValue("bytes_sec", us ? (double)bytes * 1000000.0 / (double)us : 0.0, xsink);
+    rv->setKeyValue("sessions", (int64)sessions, xsink);
+    return rv.release();
+}
+
+void SftpBulkTransfer::process(SFTPClient* client) {
+    if (put) {
+        processPut(client);
+        return;
+    }
+
+    size_t i;
+    while (pool->next(i)) {
+        SftpBulkJob& job = jobs[i];
+
+        ExceptionSink xsink;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int64 rc = client->sftpRetrieveFile(job.remote_path.c_str(), job.local_path.c_str(), timeout_ms, mode, &xsink);
+        job.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        if (xsink) {
+            getExceptionInfo(xsink, job.err, job.desc);
+            xsink.clear();
+        } else if (rc < 0) {
+            job.err = SFTPCLIENT_GETFILES_ERROR;
+            job.desc = "transfer failed";
+        } else {
+            job.success = true;
+            job.size = rc;
+        }
+        checkCancel(client, job);
+    }
+}
+
+void SftpBulkTransfer::checkCancel(SFTPClient* client, const SftpBulkJob& job) {
+    if (!job.success && job.err == SSH2_CANCELLED)
+        cancelAll(client);
+}
+
+void SftpBulkTransfer::cancelAll(SFTPClient* client) {
+    pool->stop();
+    std::vector<SftpBulkWorker>* wl = worker_list;
+    if (wl) {
+        if (client != source)
+            source->cancel();
+        for (auto& i : *wl) {
+            if (i.client != client)
+                i.client->cancel();
+        }
+    }
+}
+
+void SftpBulkTransfer::processPut(SFTPClient* client) {
+    AutoLocker al(client->m);
+
+    // try to make an implicit connection
+    {
+        ExceptionSink xsink;
+        if (!client->sftpConnectedUnlocked() && client->sftpConnectUnlocked(timeout_ms, &xsink))
+            xsink.clear();
+    }
+
+    BlockingHelper bh(client);
+
+    // the remote handle of the last file written; it is closed while the next file is opened
+    SftpPendingFinish pf;
+    // true if the pending operation has a partially-sent packet; no other request may be sent until it's been flushed
+    bool pf_owner = false;
+
+    size_t i;
+    while (pool->next(i)) {
+        putFile(client, jobs[i], pf, pf_owner);
+        checkCancel(client, jobs[i]);
+    }
+
+    finishPending(client, pf);
+}
+
+void SftpBulkTransfer::putFile(SFTPClient* client, SftpBulkJob& job, SftpPendingFinish& pf, bool& pf_owner) {
+    ExceptionSink xsink;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    auto fail = [&] () {
+        job.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        getExceptionInfo(xsink, job.err, job.desc);
+        xsink.clear();
+    };
+
+    // open local file
+    QoreFile f;
+    if (f.open2(&xsink, job.local_path.c_str())) {
+        fail();
+        return;
+    }
+
+    struct stat sbuf;
+    if (fstat(f.getFD(), &sbuf)) {
+        xsink.raiseErrnoException("FILE-STAT-ERROR", errno, "%s: fstat() call failed", job.local_path.c_str());
+        fail();
+        return;
+    }
+
+    // reconnect if the connection was lost with a previous file
+    if (!client->sftp_session) {
+        finishPending(client, pf);
+        if (client->sftpConnectUnlocked(timeout_ms, &xsink)) {
+            fail();
+            return;
+        }
+        client->setBlockingUnlocked(false);
+    }
+
+    std::string path = absolute_filename(client, job.remote_path.c_str());
+    std::string target = temp_suffix.empty() ? path : path + temp_suffix;
+    int md = mode ? mode : (sbuf.st_mode & 07777);
+
+    // open the remote file while the previous file's close (and rename) request is in flight
+    LIBSSH2_SFTP_HANDLE* h = nullptr;
+    // true if the open request has a partially-sent packet
+    bool open_owner = false;
+    while (true) {
+        if (pf.state != SftpPendingFinish::IDLE && !open_owner) {
+            pf_owner = stepFinish(client, pf) == LIBSSH2_ERROR_EAGAIN
+                && (libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+        }
+        if (!pf_owner) {
+            h = libssh2_sftp_open_ex(client->sftp_session, target.c_str(), target.size(),
+                LIBSSH2_FXF_WRITE|LIBSSH2_FXF_CREAT|LIBSSH2_FXF_TRUNC, md, LIBSSH2_SFTP_OPENFILE);
+            if (h)
+                break;
+            if (libssh2_session_last_errno(client->ssh_session) != LIBSSH2_ERROR_EAGAIN) {
+                QoreStringNode* desc = new QoreStringNode;
+                desc->sprintf("libssh2_sftp_open_ex(%s) returned an error", target.c_str());
+                client->doSessionErrUnlocked(&xsink, desc);
+                fail();
+                return;
+            }
+            open_owner = libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND;
+        }
+        if (client->waitSocketUnlocked(&xsink, SFTP_BULK_TIMEOUT, SFTPCLIENT_PUTFILES_ERROR, "SFTPClient::putFiles", timeout_ms)) {
+            // the connection has been closed; the pending file has failed as well
+            if (pf.state != SftpPendingFinish::IDLE)
+                failFinish(pf, xsink);
+            pf_owner = false;
+            fail();
+            return;
+        }
+    }
+
+    // the pending request must be sent completely before file data can be written
+    while (pf_owner) {
+        pf_owner = stepFinish(client, pf) == LIBSSH2_ERROR_EAGAIN
+            && (libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+        if (pf_owner && client->waitSocketUnlocked(&xsink, SFTP_BULK_TIMEOUT, SFTPCLIENT_PUTFILES_ERROR, "SFTPClient::putFiles", timeout_ms)) {
+            // note: memory leak here! we cannot close the handle due to the timeout
+            failFinish(pf, xsink);
+            pf_owner = false;
+            fail();
+            return;
+        }
+    }
+
+    SimpleRefHolder<BinaryNode> buf(new BinaryNode);
+
+    size_t towrite = sbuf.st_size;
+    size_t size = 0;
+    while (size < towrite) {
+        size_t bs = towrite - size;
+        if (bs > QSSH2_BUFSIZE)
+            bs = QSSH2_BUFSIZE;
+
+        if (f.readBinary(**buf, bs, &xsink)) {
+            closeHandle(client, h);
+            fail();
+            return;
+        }
+
+        // if libssh2_sftp_write() returns less than the buffer size, then we have to keep sending that data and cannot
+        // change the transfer buffer
+        ssize_t total = 0;
+        while (true) {
+            ssize_t rc;
+            while ((rc = libssh2_sftp_write(h, (const char*)buf->getPtr() + total, buf->size() - total))
+                == LIBSSH2_ERROR_EAGAIN) {
+                if (client->waitSocketUnlocked(&xsink, SFTP_BULK_TIMEOUT, SFTPCLIENT_PUTFILES_ERROR, "SFTPClient::putFiles",
+                    timeout_ms)) {
+                    // note: memory leak here! we cannot close the handle due to the timeout
+                    if (pf.state != SftpPendingFinish::IDLE)
+                        failFinish(pf, xsink);
+                    fail();
+                    return;
+                }
+            }
+            if (rc < 0) {
+                QoreStringNode* desc = new QoreStringNode;
+                desc->sprintf("libssh2_sftp_write(" QLLD ") failed while writing '%s', total written: " QLLD
+                    ", total to write: " QLLD, towrite - size, target.c_str(), size, towrite);
+                client->doSessionErrUnlocked(&xsink, desc);
+                if (client->sftp_session)
+                    closeHandle(client, h);
+                fail();
+                return;
+            }
+            total += rc;
+            // the lock is kept while the previous file is being finished, as libssh2 keeps the state of the request
+            // in the SFTP session
+            if (client->throttleUnlocked(false, rc, "SFTPClient::putFiles", &xsink,
+                pf.state == SftpPendingFinish::IDLE)) {
+                if (pf.state != SftpPendingFinish::IDLE)
+                    failFinish(pf, xsink);
+                if (client->sftp_session)
+                    closeHandle(client, h);
+                fail();
+                return;
+            }
+            if ((size_t)total == buf->size())
+                break;
+        }
+        size += total;
+        buf->setSize(0);
+    }
+
+    // only one file can be pending at a time
+    finishPending(client, pf);
+    if (!client->sftp_session) {
+        xsink.raiseException(SFTPCLIENT_PUTFILES_ERROR, "the connection was lost while uploading '%s'", target.c_str());
+        fail();
+        return;
+    }
+
+    // send the close request; the response is collected while the next file is being opened
+    pf.state = SftpPendingFinish::CLOSING;
+    pf.h = h;
+    pf.job = &job;
+    pf.path = std::move(path);
+    if (!temp_suffix.empty())
+        pf.temp_path = std::move(target);
+    else
+        pf.temp_path.clear();
+    pf.start = start;
+    pf.size = size;
+
+    pf_owner = stepFinish(client, pf) == LIBSSH2_ERROR_EAGAIN
+        && (libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+}
+
+int SftpBulkTransfer::stepFinish(SFTPClient* client, SftpPendingFinish& pf) {
+    if (!client->sftp_session) {
+        // the handle was freed with the session
+        ExceptionSink xsink;
+        xsink.raiseException(SFTPCLIENT_PUTFILES_ERROR, "the connection was lost while closing '%s'",
+            (pf.temp_path.empty() ? pf.path : pf.temp_path).c_str());
+        failFinish(pf, xsink);
+        return 0;
+    }
+
+    while (true) {
+        switch (pf.state) {
+            case SftpPendingFinish::IDLE:
+                return 0;
+
+            case SftpPendingFinish::CLOSING: {
+                int rc = libssh2_sftp_close_handle(pf.h);
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return rc;
+                pf.h = nullptr;
+                if (rc) {
+                    failFinish(client, pf, "libssh2_sftp_close_handle() returned an error while closing");
+                    return 0;
+                }
+                if (pf.temp_path.empty())
+                    break;
+                pf.state = SftpPendingFinish::RENAMING;
+                continue;
+            }
+
+            case SftpPendingFinish::RENAMING:
+            case SftpPendingFinish::RENAMING_AGAIN: {
+                int rc = libssh2_sftp_rename(client->sftp_session, pf.temp_path.c_str(), pf.path.c_str());
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return rc;
+                if (!rc)
+                    break;
+                // SFTP v3 servers do not overwrite existing files on rename; remove the target and try again
+                if (pf.state == SftpPendingFinish::RENAMING && rc == LIBSSH2_ERROR_SFTP_PROTOCOL) {
+                    unsigned long serr = libssh2_sftp_last_error(client->sftp_session);
+                    if (serr == LIBSSH2_FX_FILE_ALREADY_EXISTS) {
+                        pf.state = SftpPendingFinish::REMOVING;
+                        continue;
+                    }
+                    // v3 servers report an existing target with the generic failure status, which is also returned
+                    // for any other error, so the target is only removed if it exists
+                    if (serr == LIBSSH2_FX_FAILURE) {
+                        pf.state = SftpPendingFinish::CHECKING;
+                        continue;
+                    }
+                }
+                failFinish(client, pf, "libssh2_sftp_rename() returned an error while renaming the temporary file for");
+                return 0;
+            }
+
+            case SftpPendingFinish::CHECKING: {
+                LIBSSH2_SFTP_ATTRIBUTES attrs;
+                int rc = libssh2_sftp_stat_ex(client->sftp_session, pf.path.c_str(), pf.path.size(),
+                    LIBSSH2_SFTP_LSTAT, &attrs);
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return rc;
+                // if the target does not exist, the rename is repeated to report its error
+                pf.state = rc ? SftpPendingFinish::RENAMING_AGAIN : SftpPendingFinish::REMOVING;
+                continue;
+            }
+
+            case SftpPendingFinish::REMOVING: {
+                // errors are ignored here; they will be reported by the following rename
+                int rc = libssh2_sftp_unlink(client->sftp_session, pf.path.c_str());
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return rc;
+                pf.state = SftpPendingFinish::RENAMING_AGAIN;
+                continue;
+            }
+        }
+        break;
+    }
+
+    SftpBulkJob& job = *pf.job;
+    job.success = true;
+    job.size = pf.size;
+    job.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pf.start).count();
+    pf.state = SftpPendingFinish::IDLE;
+    return 0;
+}
+
+void SftpBulkTransfer::closeHandle(SFTPClient* client, LIBSSH2_SFTP_HANDLE* h) {
+    while (libssh2_sftp_close_handle(h) == LIBSSH2_ERROR_EAGAIN) {
+        // note: memory leak here if the wait times out; the connection is closed in this case
+        if (client->waitSocketUnlocked(nullptr, SFTP_BULK_TIMEOUT, SFTPCLIENT_PUTFILES_ERROR, "SFTPClient::putFiles", timeout_ms))
+            break;
+    }
+}
+
+void SftpBulkTransfer::finishPending(SFTPClient* client, SftpPendingFinish& pf) {
+    while (pf.state != SftpPendingFinish::IDLE) {
+        if (stepFinish(client, pf) != LIBSSH2_ERROR_EAGAIN)
+            break;
+        ExceptionSink xsink;
+        if (client->waitSocketUnlocked(&xsink, SFTP_BULK_TIMEOUT, SFTPCLIENT_PUTFILES_ERROR, "SFTPClient::putFiles", timeout_ms)) {
+            // note: memory leak here! we cannot close the handle due to the timeout
+            failFinish(pf, xsink);
+            break;
+        }
+    }
+}
+
+void SftpBulkTransfer::failFinish(SftpPendingFinish& pf, ExceptionSink& xsink) {
+    SftpBulkJob& job = *pf.job;
+    job.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pf.start).count();
+    getExceptionInfo(xsink, job.err, job.desc);
+    xsink.clear();
+    pf.h = nullptr;
+    pf.state = SftpPendingFinish::IDLE;
+}
+
+void SftpBulkTransfer::failFinish(SFTPClient* client, SftpPendingFinish& pf, const char* op) {
+    ExceptionSink xsink;
+    QoreStringNode* desc = new QoreStringNode;
+    desc->sprintf("%s '%s'", op, pf.path.c_str());
+    client->doSessionErrUnlocked(&xsink, desc);
+    failFinish(pf, xsink);
+}
+
+void SftpBulkTransfer::workerThread(ExceptionSink* xsink, void* arg) {
+    SftpBulkWorker* w = reinterpret_cast<SftpBulkWorker*>(arg);
+    SftpBulkTransfer* bt = w->bt;
+
+    {
+        // a worker that cannot connect leaves its share of the jobs to the other workers
+        ExceptionSink cxsink;
+        if (!w->client->sftpConnect(bt->timeout_ms, &cxsink)) {
+            ++bt->sessions;
+            bt->process(w->client);
+            w->client->disconnect(true, bt->timeout_ms);
+        } else {
+            printd(5, "SftpBulkTransfer::workerThread() client %p: failed to connect; exiting\n", w->client);
+            cxsink.clear();
+        }
+    }
+
+    // "bt" must not be accessed after this call
+    bt->pool->workerDone();
+}
+
+QoreHashNode* SFTPClient::sftpGetFiles(const QoreListNode* remote_paths, const char* local_dir, const QoreHashNode* opts, ExceptionSink* xsink) {
+    int64 workers = getIntOption(opts, "workers", SFTP_BULK_DEFAULT_WORKERS);
+    if (workers < 1 || workers > SFTP_BULK_MAX_WORKERS) {
+        xsink->raiseException(SFTPCLIENT_GETFILES_ERROR, "invalid \"workers\" option " QLLD "; expecting a value from 1 to %d", workers, SFTP_BULK_MAX_WORKERS);
+        return nullptr;
+    }
+
+    SftpBulkTransfer bt(false, getMsTimeoutOption(opts, "timeout", 60000), (int)getIntOption(opts, "mode", 0644));
+
+    std::string dir = local_dir;
+    if (dir.empty())
+        dir = ".";
+    else if (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+
+    // the element of the remote path downloaded to each file name; files with the same name in different
+    // directories would be written to the same local file by different workers at the same time
+    std::map<std::string, int64> names;
+    int64 n = 0;
+    ConstListIterator li(remote_paths);
+    while (li.next()) {
+        const QoreStringNode* path = li.getValue().get<const QoreStringNode>();
+        const char* base = strrchr(path->c_str(), '/');
+        base = base ? base + 1 : path->c_str();
+        if (!*base) {
+            xsink->raiseException(SFTPCLIENT_GETFILES_ERROR, "remote path '%s' (element " QLLD ") does not name a file",
+                path->c_str(), n);
+            return nullptr;
+        }
+        std::pair<std::map<std::string, int64>::iterator, bool> r = names.insert(std::make_pair(base, n));
+        if (!r.second) {
+            xsink->raiseException(SFTPCLIENT_GETFILES_ERROR, "remote paths '%s' (element " QLLD ") and '%s' (element "
+                QLLD ") would both be downloaded to '%s/%s'", bt.jobs[r.first->second].remote_path.c_str(),
+                r.first->second, path->c_str(), n, dir.c_str(), base);
+            return nullptr;
+        }
+        ++n;
+        bt.jobs.emplace_back(std::string(path->c_str()), dir + "/" + base);
+    }
+
+    return bt.run(this, (unsigned)workers, xsink);
+}
+
+QoreHashNode* SFTPClient::sftpPutFiles(const QoreListNode* local_paths, const QoreHashNode* file_map, const char* remote_dir,
+        const QoreHashNode* opts, ExceptionSink* xsink) {
+    assert(local_paths || file_map);
+    int64 workers = getIntOption(opts, "workers", SFTP_BULK_DEFAULT_WORKERS);
+    if (workers < 1 || workers > SFTP_BULK_MAX_WORKERS) {
+        xsink->raiseException(SFTPCLIENT_PUTFILES_ERROR, "invalid \"workers\" option " QLLD "; expecting a value from 1 to %d", workers, SFTP_BULK_MAX_WORKERS);
+        return nullptr;
+    }
+
+    std::string temp_suffix;
+    if (getBoolOption(opts, "temp", false)) {
+        QoreValue v = opts->getKeyValue("temp_suffix");
+        if (v.isNothing())
+            temp_suffix = ".part";
+        else if (v.getType() == NT_STRING)
+            temp_suffix = v.get<const QoreStringNode>()->c_str();
+        if (temp_suffix.empty()) {
+            xsink->raiseException(SFTPCLIENT_PUTFILES_ERROR, "the \"temp_suffix\" option must be a non-empty string");
+            return nullptr;
+        }
+    }
+
+    SftpBulkTransfer bt(true, getMsTimeoutOption(opts, "timeout", 60000), (int)getIntOption(opts, "mode", 0),
+        std::move(temp_suffix));
+
+    std::string dir = remote_dir;
+    if (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+
+    // returns the remote path for the given remote name
+    auto remote_path = [&dir] (const char* name) -> std::string {
+        if (name[0] == '/' || dir.empty())
+            return name;
+        return dir == "/" ? dir + name : dir + "/" + name;
+    };
+
+    if (local_paths) {
+        int64 n = 0;
+        ConstListIterator li(local_paths);
+        while (li.next()) {
+            const QoreStringNode* path = li.getValue().get<const QoreStringNode>();
+            const char* base = strrchr(path->c_str(), '/');
+            base = base ? base + 1 : path->c_str();
+            if (!*base) {
+                xsink->raiseException(SFTPCLIENT_PUTFILES_ERROR, "local path '%s' (element " QLLD ") does not name a file",
+                    path->c_str(), n);
+                return nullptr;
+            }
+            ++n;
+            bt.jobs.emplace_back(remote_path(base), std::string(path->c_str()));
+        }
+    } else {
+        ConstHashIterator hi(file_map);
+        while (hi.next()) {
+            QoreValue v = hi.get();
+            if (v.getType() != NT_STRING || v.get<const QoreStringNode>()->empty()) {
+                xsink->raiseException(SFTPCLIENT_PUTFILES_ERROR, "local path '%s' is mapped to type '%s'; expecting a "
+                    "non-empty remote file name", hi.getKey(), v.getTypeName());
+                return nullptr;
+            }
+            bt.jobs.emplace_back(remote_path(v.get<const QoreStringNode>()->c_str()), std::string(hi.getKey()));
+        }
+    }
+
+    QoreHashNode* rv = bt.run(this, (unsigned)workers, xsink);
+
+    // most files are written by other sessions, so cached attributes are invalidated for all files afterwards
+    {
+        AutoLocker al(m);
+        if (cache.enabled()) {
+            for (auto& i : bt.jobs)
+                cache.invalidate(absolute_filename(this, i.remote_path.c_str()));
+        }
+    }
+
+    return rv;
+}
@@ -23,11 +23,18 @@
 */
 
 #include "SFTPClient.h"
+#include "SFTPDirIterator.h"
+#include "SFTPDirSnapshot.h"
+#include "SftpListFilter.h"
+#include "SSH2BlockRing.h"
+#include "SSH2WorkerPool.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <map>
 #include <utility>
+#include <vector>
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifdef HAVE_PWD_H
@@ -139,6 +146,13 @@ SFTPClient::SFTPClient(QoreURL &url, const uint32_t port) : SSH2Client(url, port
    printd(5, "SFTPClient::SFTPClient() this: %p\n", this);
 }
 
+SFTPClient::SFTPClient(const SFTPClient& old) : SSH2Client(old), sftp_session(0) {
+   printd(5, "SFTPClient::SFTPClient() this: %p (copy of %p)\n", this, &old);
+   AutoLocker al(old.m);
+   sftppath = old.sftppath;
+   path_mode = old.path_mode;
+}
+
 /*
  * close session/connection
  * free ressources
@@ -193,6 +207,8 @@ int SFTPClient::disconnectUnlocked(bool force, int timeout_ms, AbstractDisconnec
     // disconnect dependent opbjects first
     if (adh)
         adh->preDisconnect();
+    closeDirIteratorsUnlocked(timeout_ms);
+    cache.clear();
 
     // close sftp session if not null
     doShutdown(timeout_ms, xsink);
@@ -203,7 +219,11 @@ int SFTPClient::disconnectUnlocked(bool force, int timeout_ms, AbstractDisconnec
     return rc;
 }
 
-QoreHashNode* SFTPClient::sftpList(const char* path, int timeout_ms, ExceptionSink* xsink) {
+QoreHashNode* SFTPClient::sftpList(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter) {
+    SftpListFilter lf;
+    if (lf.init(filter, "SFTPCLIENT-LIST-ERROR", xsink))
+        return nullptr;
+
     AutoLocker al(m);
 
     // try to make an implicit connection
@@ -259,6 +279,8 @@ QoreHashNode* SFTPClient::sftpList(const char* path, int timeout_ms, ExceptionSi
             qh.err("error reading directory '%s'", pstr.c_str());
             return nullptr;
         }
+        if (!lf.match(buff, attrs))
+            continue;
         if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
             // contains st_mode() from sys/stat.h
             if (S_ISDIR(attrs.permissions))
@@ -285,7 +307,11 @@ QoreHashNode* SFTPClient::sftpList(const char* path, int timeout_ms, ExceptionSi
     return ret.release();
 }
 
-QoreListNode* SFTPClient::sftpListFull(const char* path, int timeout_ms, ExceptionSink* xsink) {
+QoreListNode* SFTPClient::sftpListFull(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter) {
+    SftpListFilter lf;
+    if (lf.init(filter, "SFTPCLIENT-LISTFULL-ERROR", xsink))
+        return nullptr;
+
     AutoLocker al(m);
 
     // try to make an implicit connection
@@ -340,27 +366,301 @@ QoreListNode* SFTPClient::sftpListFull(const char* path, int timeout_ms, Excepti
             return nullptr;
         }
 
-        ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpFileInfo, xsink), xsink);
-        h->setKeyValue("name", new QoreStringNode(buff), xsink);
+        if (lf.match(buff, attrs))
+            rv->push(fileInfo(buff, attrs, xsink), xsink);
+    }
+
+    return rv.release();
+}
+
+// file type names indexed by the bit position of the SFTP_FT_* values
+static const char* sftp_type_names[] = {
+    "REGULAR", "DIRECTORY", "SYMBOLIC-LINK", "BLOCK-DEVICE", "CHARACTER-DEVICE", "FIFO", "SOCKET", "UNKNOWN",
+};
+#define SFTP_NUM_TYPES (sizeof(sftp_type_names) / sizeof(sftp_type_names[0]))
+
+QoreHashNode* SFTPClient::sftpListColumns(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter) {
+    SftpListFilter lf;
+    if (lf.init(filter, "SFTPCLIENT-LISTCOLUMNS-ERROR", xsink))
+        return nullptr;
+
+    AutoLocker al(m);
+
+    // try to make an implicit connection
+    if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+        return nullptr;
+
+    std::string pstr;
+    if (!path) // there is no path given so we use the sftpPath
+        pstr = sftppath;
+    else if (path[0] == '/') // absolute path, take it
+        pstr = path;
+    else // relative path
+        pstr = sftppath + "/" + path;
+
+    BlockingHelper bh(this);
+
+    QSftpHelper qh(this, "SFTPCLIENT-LISTCOLUMNS-ERROR", "SFTPClient::listColumns", timeout_ms, xsink);
+
+    {
+        QoreSocketTimeoutHelper th(socket, "list");
+
+        do {
+            qh.assign(libssh2_sftp_opendir(sftp_session, pstr.c_str()));
+            if (!qh) {
+                if (libssh2_session_last_errno(ssh_session) == LIBSSH2_ERROR_EAGAIN) {
+                    if (qh.waitSocket())
+                        return nullptr;
+                } else {
+                    qh.err("error reading directory '%s'", pstr.c_str());
+                    return nullptr;
+                }
+            }
+        } while (!qh);
+    }
 
+    // create objects after only possible error; integer values are stored in the lists directly, so the name is the
+    // only value allocated for each entry
+    ReferenceHolder<QoreListNode> names(new QoreListNode(stringTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> sizes(new QoreListNode(bigIntTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> mtimes(new QoreListNode(bigIntTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> modes(new QoreListNode(bigIntTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> types(new QoreListNode(stringTypeInfo), xsink);
+
+    // one string for each file type is shared by all entries of that type
+    SimpleRefHolder<QoreStringNode> type_strs[SFTP_NUM_TYPES];
+
+    char buff[PATH_MAX];
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+    while (true) {
+        int rc;
+        while ((rc = libssh2_sftp_readdir(*qh, buff, sizeof(buff), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+            if (qh.waitSocket())
+                return nullptr;
+        }
+        if (!rc)
+            break;
+        if (rc < 0) {
+            qh.err("error reading directory '%s'", pstr.c_str());
+            return nullptr;
+        }
+
+        if (!lf.match(buff, attrs))
+            continue;
+
+        names->push(new QoreStringNode(buff), xsink);
+        sizes->push((int64)(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE ? attrs.filesize : 0), xsink);
+        mtimes->push((int64)(attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME ? attrs.mtime : 0), xsink);
+
+        unsigned t;
         if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
-            SimpleRefHolder<QoreStringNode> perm(new QoreStringNode);
-            const char* type = ssh2_mode_to_perm(attrs.permissions, **perm);
-
-            h->setKeyValue("size", attrs.filesize, xsink);
-            h->setKeyValue("atime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attrs.atime), xsink);
-            h->setKeyValue("mtime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attrs.mtime), xsink);
-            h->setKeyValue("uid", attrs.uid, xsink);
-            h->setKeyValue("gid", attrs.gid, xsink);
-            h->setKeyValue("mode", attrs.permissions, xsink);
-            h->setKeyValue("type", new QoreStringNode(type), xsink);
-            h->setKeyValue("perm", perm.release(), xsink);
+            modes->push((int64)attrs.permissions, xsink);
+            t = SftpListFilter::getType(attrs.permissions);
+        } else {
+            modes->push((int64)0, xsink);
+            t = SFTP_FT_UNKNOWN;
         }
 
-        rv->push(h.release(), xsink);
+        unsigned i = 0;
+        while (!(t & (1 << i)))
+            ++i;
+        if (!type_strs[i])
+            type_strs[i] = new QoreStringNode(sftp_type_names[i]);
+        type_strs[i]->ref();
+        types->push(*type_strs[i], xsink);
     }
 
-    return rv.release();
+    ReferenceHolder<QoreHashNode> ret(new QoreHashNode(hashdeclSftpDirColumns, xsink), xsink);
+
+    ret->setKeyValue("path", new QoreStringNode(pstr.c_str()), xsink);
+    ret->setKeyValue("count", (int64)names->size(), xsink);
+    ret->setKeyValue("names", names.release(), xsink);
+    ret->setKeyValue("sizes", sizes.release(), xsink);
+    ret->setKeyValue("mtimes", mtimes.release(), xsink);
+    ret->setKeyValue("modes", modes.release(), xsink);
+    ret->setKeyValue("types", types.release(), xsink);
+
+    return ret.release();
+}
+
+QoreObject* SFTPClient::sftpSnapshot(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter) {
+    SftpListFilter lf;
+    if (lf.init(filter, "SFTPCLIENT-SNAPSHOT-ERROR", xsink))
+        return nullptr;
+
+    std::vector<SftpSnapEntry> entries;
+    std::string pstr;
+
+    {
+        AutoLocker al(m);
+
+        // try to make an implicit connection
+        if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+            return nullptr;
+
+        if (!path) // there is no path given so we use the sftpPath
+            pstr = sftppath;
+        else if (path[0] == '/') // absolute path, take it
+            pstr = path;
+        else // relative path
+            pstr = sftppath + "/" + path;
+
+        BlockingHelper bh(this);
+
+        QSftpHelper qh(this, "SFTPCLIENT-SNAPSHOT-ERROR", "SFTPClient::snapshot", timeout_ms, xsink);
+
+        {
+            QoreSocketTimeoutHelper th(socket, "snapshot");
+
+            do {
+                qh.assign(libssh2_sftp_opendir(sftp_session, pstr.c_str()));
+                if (!qh) {
+                    if (libssh2_session_last_errno(ssh_session) == LIBSSH2_ERROR_EAGAIN) {
+                        if (qh.waitSocket())
+                            return nullptr;
+                    } else {
+                        qh.err("error reading directory '%s'", pstr.c_str());
+                        return nullptr;
+                    }
+                }
+            } while (!qh);
+        }
+
+        char buff[PATH_MAX];
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+        while (true) {
+            int rc;
+            while ((rc = libssh2_sftp_readdir(*qh, buff, sizeof(buff), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+                if (qh.waitSocket())
+                    return nullptr;
+            }
+            if (!rc)
+                break;
+            if (rc < 0) {
+                qh.err("error reading directory '%s'", pstr.c_str());
+                return nullptr;
+            }
+
+            // "." and ".." change whenever the directory changes, so they are not included
+            if (buff[0] == '.' && (!buff[1] || (buff[1] == '.' && !buff[2])))
+                continue;
+            if (lf.match(buff, attrs))
+                entries.emplace_back(buff, (size_t)rc, attrs);
+        }
+    }
+
+    // the entries are sorted after the lock has been released
+    return new QoreObject(QC_SFTPDIRSNAPSHOT, getProgram(), new SFTPDirSnapshot(std::move(pstr), std::move(entries)));
+}
+
+QoreHashNode* SFTPClient::fileInfo(const char* name, const LIBSSH2_SFTP_ATTRIBUTES& attrs, ExceptionSink* xsink) {
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpFileInfo, xsink), xsink);
+    h->setKeyValue("name", new QoreStringNode(name), xsink);
+
+    if (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+        SimpleRefHolder<QoreStringNode> perm(new QoreStringNode);
+        const char* type = ssh2_mode_to_perm(attrs.permissions, **perm);
+
+        h->setKeyValue("size", attrs.filesize, xsink);
+        h->setKeyValue("atime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attrs.atime), xsink);
+        h->setKeyValue("mtime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attrs.mtime), xsink);
+        h->setKeyValue("uid", attrs.uid, xsink);
+        h->setKeyValue("gid", attrs.gid, xsink);
+        h->setKeyValue("mode", attrs.permissions, xsink);
+        h->setKeyValue("type", new QoreStringNode(type), xsink);
+        h->setKeyValue("perm", perm.release(), xsink);
+    }
+
+    return h.release();
+}
+
+QoreHashNode* SFTPClient::statInfo(const LIBSSH2_SFTP_ATTRIBUTES& attr, ExceptionSink* xsink) {
+    ReferenceHolder<QoreHashNode> ret(new QoreHashNode(hashdeclSsh2StatInfo, xsink), xsink);
+
+    if (attr.flags & LIBSSH2_SFTP_ATTR_SIZE)
+        ret->setKeyValue("size", attr.filesize, xsink);
+    if (attr.flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+        ret->setKeyValue("atime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attr.atime), xsink);
+        ret->setKeyValue("mtime", DateTimeNode::makeAbsolute(currentTZ(), (int64)attr.mtime), xsink);
+    }
+    if (attr.flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+        ret->setKeyValue("uid", attr.uid, xsink);
+        ret->setKeyValue("gid", attr.gid, xsink);
+    }
+    if (attr.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+        ret->setKeyValue("mode", attr.permissions, xsink);
+        ret->setKeyValue("permissions", new QoreStringNode(mode2str(attr.permissions)), xsink);
+    }
+
+    return ret.release();
+}
+
+QoreObject* SFTPClient::sftpListIterator(const char* path, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink) {
+    static const char* SFTPCLIENT_LISTITERATOR_ERROR = "SFTPCLIENT-LISTITERATOR-ERROR";
+
+    int64 batch_size = getIntOption(opts, "batch_size", SFTP_DIR_BATCH);
+    if (batch_size < 1) {
+        xsink->raiseException(SFTPCLIENT_LISTITERATOR_ERROR, "invalid \"batch_size\" option " QLLD "; must be > 0",
+            batch_size);
+        return nullptr;
+    }
+
+    SftpListFilter lf;
+    if (lf.initOption(opts, "filter", SFTPCLIENT_LISTITERATOR_ERROR, xsink))
+        return nullptr;
+
+    AutoLocker al(m);
+
+    // try to make an implicit connection
+    if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+        return nullptr;
+
+    std::string pstr;
+    if (!path) // there is no path given so we use the sftpPath
+        pstr = sftppath;
+    else if (path[0] == '/') // absolute path, take it
+        pstr = path;
+    else // relative path
+        pstr = sftppath + "/" + path;
+
+    BlockingHelper bh(this);
+
+    QSftpHelper qh(this, SFTPCLIENT_LISTITERATOR_ERROR, "SFTPClient::listIterator", timeout_ms, xsink);
+
+    {
+        QoreSocketTimeoutHelper th(socket, "list");
+
+        do {
+            qh.assign(libssh2_sftp_opendir(sftp_session, pstr.c_str()));
+            if (!qh) {
+                if (libssh2_session_last_errno(ssh_session) == LIBSSH2_ERROR_EAGAIN) {
+                    if (qh.waitSocket())
+                        return nullptr;
+                } else {
+                    qh.err("error reading directory '%s'", pstr.c_str());
+                    return nullptr;
+                }
+            }
+        } while (!qh);
+    }
+
+    // the directory is read when the iterator is advanced
+    SFTPDirIterator* i = new SFTPDirIterator(this, qh.release(), std::move(pstr), timeout_ms, (size_t)batch_size,
+        std::move(lf));
+    dir_iterators.insert(i);
+    return new QoreObject(QC_SFTPDIRITERATOR, getProgram(), i);
+}
+
+void SFTPClient::closeDirIteratorsUnlocked(int timeout_ms) {
+    if (dir_iterators.empty())
+        return;
+
+    BlockingHelper bh(this);
+    for (auto& i : dir_iterators)
+        i->disconnectUnlocked(timeout_ms);
+    dir_iterators.clear();
 }
 
 // return 0 if ok, -1 otherwise
@@ -387,6 +687,7 @@ int SFTPClient::sftpChmod(const char* file, const int mode, int timeout_ms, Exce
         pstr = std::string(file);
     else
         pstr = sftppath + "/" + std::string(file);
+    cache.invalidate(pstr);
 
     BlockingHelper bh(this);
 
@@ -472,6 +773,7 @@ int SFTPClient::sftpMkdir(const char* dir, const int mode, int timeout_ms, Excep
         pstr = std::string(dir);
     else
         pstr = sftppath + "/" + std::string(dir);
+    cache.invalidate(pstr);
 
     BlockingHelper bh(this);
 
@@ -493,6 +795,136 @@ int SFTPClient::sftpMkdir(const char* dir, const int mode, int timeout_ms, Excep
     return rc;
 }
 
+static const char* SFTPCLIENT_MAKEPATH_ERROR = "SFTPCLIENT-MAKEPATH-ERROR";
+
+int SFTPClient::makePathProbe(QSftpHelper& qh, const std::string& dir, ExceptionSink* xsink) {
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+    if (!cache.getAttrs(dir, attrs)) {
+        int rc;
+        while ((rc = libssh2_sftp_stat(sftp_session, dir.c_str(), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+            if (qh.waitSocket())
+                return -1;
+        }
+        if (rc < 0) {
+            if (libssh2_session_last_errno(ssh_session) == LIBSSH2_ERROR_SFTP_PROTOCOL) {
+                unsigned long err = libssh2_sftp_last_error(sftp_session);
+                if (err == LIBSSH2_FX_NO_SUCH_FILE || err == LIBSSH2_FX_NO_SUCH_PATH)
+                    return 0;
+            }
+            qh.err("libssh2_sftp_stat(%s) returned an error", dir.c_str());
+            return -1;
+        }
+        cache.putAttrs(dir, attrs);
+    }
+
+    if ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && !LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
+        xsink->raiseException(SFTPCLIENT_MAKEPATH_ERROR, "'%s' exists but is not a directory", dir.c_str());
+        return -1;
+    }
+
+    cache.addKnownDir(dir);
+    return 1;
+}
+
+int SFTPClient::sftpMakePath(const char* dir, const int mode, int timeout_ms, ExceptionSink* xsink) {
+    assert(dir);
+
+    if (!dir[0]) {
+        xsink->raiseException(SFTPCLIENT_MAKEPATH_ERROR, "directory name is empty");
+        return -1;
+    }
+
+    AutoLocker al(m);
+
+    // try to make an implicit connection
+    if (!sftpConnectedUnlocked() && sftpConnectUnlocked(timeout_ms, xsink))
+        return -1;
+
+    std::string pstr = absolute_filename(this, dir);
+
+    // the directory and all of its ancestors from the top down
+    std::vector<std::string> dirs;
+    for (size_t i = 1; i <= pstr.size(); ++i) {
+        if ((i == pstr.size() || pstr[i] == '/') && pstr[i - 1] != '/')
+            dirs.push_back(pstr.substr(0, i));
+    }
+    int n = (int)dirs.size();
+
+    // the index of the deepest directory known to exist (-1 = none) and the index of the shallowest directory known
+    // not to exist
+    int lo = -1, hi = n;
+    for (int i = n - 1; i >= 0; --i) {
+        if (cache.isKnownDir(dirs[i])) {
+            lo = i;
+            break;
+        }
+    }
+    if (lo == n - 1)
+        return 0;
+
+    BlockingHelper bh(this);
+
+    QSftpHelper qh(this, SFTPCLIENT_MAKEPATH_ERROR, "SFTPClient::makePath", timeout_ms, xsink);
+
+    QoreSocketTimeoutHelper th(socket, "makePath");
+
+    // the leaf and its parent are probed first, since usually at most the last level is missing; the deepest
+    // existing ancestor of a longer chain of missing directories is found with a binary search
+    int rc = makePathProbe(qh, dirs[n - 1], xsink);
+    if (rc)
+        return rc < 0 ? -1 : 0;
+    hi = n - 1;
+    if (hi - 1 > lo) {
+        rc = makePathProbe(qh, dirs[hi - 1], xsink);
+        if (rc < 0)
+            return -1;
+        if (rc)
+            lo = hi - 1;
+        else
+            hi = hi - 1;
+    }
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        rc = makePathProbe(qh, dirs[mid], xsink);
+        if (rc < 0)
+            return -1;
+        if (rc)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    // create the missing directories
+    int created = 0;
+    for (int i = lo + 1; i < n; ++i) {
+        while ((rc = libssh2_sftp_mkdir(sftp_session, dirs[i].c_str(), mode)) == LIBSSH2_ERROR_EAGAIN) {
+            if (qh.waitSocket())
+                return -1;
+        }
+        if (rc < 0) {
+            // the directory may have been created by another client in the meantime
+            if (libssh2_session_last_errno(ssh_session) != LIBSSH2_ERROR_SFTP_PROTOCOL) {
+                qh.err("libssh2_sftp_mkdir(%s) returned an error", dirs[i].c_str());
+                return -1;
+            }
+            unsigned long err = libssh2_sftp_last_error(sftp_session);
+            rc = makePathProbe(qh, dirs[i], xsink);
+            if (rc < 0)
+                return -1;
+            if (!rc) {
+                xsink->raiseException(SFTPCLIENT_MAKEPATH_ERROR, "failed to create directory '%s': SFTP error "
+                    "code %lu", dirs[i].c_str(), err);
+                return -1;
+            }
+            continue;
+        }
+        cache.addKnownDir(dirs[i]);
+        ++created;
+    }
+
+    return created;
+}
+
 int SFTPClient::sftpRmdir(const char* dir, int timeout_ms, ExceptionSink* xsink) {
     assert(dir);
 
@@ -514,6 +946,7 @@ int SFTPClient::sftpRmdir(const char* dir, int timeout_ms, ExceptionSink* xsink)
         pstr = std::string(dir);
     else
         pstr = sftppath + "/" + std::string(dir);
+    cache.invalidate(pstr);
 
     BlockingHelper bh(this);
 
@@ -547,6 +980,8 @@ int SFTPClient::sftpRename(const char* from, const char* to, int timeout_ms, Exc
     std::string fstr, tstr;
     fstr = absolute_filename(this, from);
     tstr = absolute_filename(this, to);
+    cache.invalidate(fstr);
+    cache.invalidate(tstr);
 
     BlockingHelper bh(this);
 
@@ -582,6 +1017,7 @@ int SFTPClient::sftpUnlink(const char* file, int timeout_ms, ExceptionSink* xsin
         fstr = std::string(file);
     else
         fstr = sftppath + "/" + std::string(file);
+    cache.invalidate(fstr);
 
     BlockingHelper bh(this);
 
@@ -601,6 +1037,34 @@ int SFTPClient::sftpUnlink(const char* file, int timeout_ms, ExceptionSink* xsin
     return rc;
 }
 
+// returns the absolute path with "." and ".." components and duplicate slashes removed; ".." components are applied
+// to the path as given, without resolving symbolic links
+static std::string sftp_normalize_path(const std::string& path) {
+    assert(!path.empty() && path[0] == '/');
+
+    std::string rv;
+    size_t i = 0, len = path.size();
+    while (i < len) {
+        while (i < len && path[i] == '/')
+            ++i;
+        size_t start = i;
+        while (i < len && path[i] != '/')
+            ++i;
+        size_t clen = i - start;
+        if (!clen || (clen == 1 && path[start] == '.'))
+            continue;
+        if (clen == 2 && path[start] == '.' && path[start + 1] == '.') {
+            size_t pos = rv.rfind('/');
+            rv.erase(pos == std::string::npos ? 0 : pos);
+            continue;
+        }
+        rv.push_back('/');
+        rv.append(path, start, clen);
+    }
+
+    return rv.empty() ? std::string("/") : rv;
+}
+
 QoreStringNode* SFTPClient::sftpChdir(const char* nwd, int timeout_ms, ExceptionSink* xsink) {
     char buff[PATH_MAX] = { '\0' };
 
@@ -621,8 +1085,46 @@ QoreStringNode* SFTPClient::sftpChdir(const char* nwd, int timeout_ms, Exception
     else
         npath = sftppath + "/" + std::string(nwd);
 
+    // a cached resolution has already been verified to be a directory
+    {
+        std::string resolved;
+        if (cache.getRealpath(npath, resolved)) {
+            sftppath = resolved;
+            return new QoreStringNode(sftppath);
+        }
+    }
+
     BlockingHelper bh(this);
 
+    // the path can only be normalized locally if it is absolute
+    if (path_mode != SPM_VERIFY && npath[0] == '/') {
+        std::string norm = sftp_normalize_path(npath);
+        if (path_mode == SPM_STAT) {
+            LIBSSH2_SFTP_ATTRIBUTES attrs;
+            if (!cache.getAttrs(norm, attrs)) {
+                QoreSocketTimeoutHelper th(socket, "chdir");
+
+                int rc;
+                while ((rc = libssh2_sftp_stat(sftp_session, norm.c_str(), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+                    if (qh.waitSocket())
+                        return nullptr;
+                }
+                if (rc < 0) {
+                    qh.err("failed to retrieve the remote path for: '%s'", norm.c_str());
+                    return nullptr;
+                }
+                cache.putAttrs(norm, attrs);
+            }
+            if ((attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) && !LIBSSH2_SFTP_S_ISDIR(attrs.permissions)) {
+                xsink->raiseException("SFTPCLIENT-CHDIR-ERROR", "'%s' is not a directory", norm.c_str());
+                return nullptr;
+            }
+        }
+
+        sftppath = norm;
+        return new QoreStringNode(sftppath);
+    }
+
     // returns the amount of chars
     int rc;
     {
@@ -656,6 +1158,8 @@ QoreStringNode* SFTPClient::sftpChdir(const char* nwd, int timeout_ms, Exception
         } while (!qh);
     }
 
+    cache.putRealpath(npath, buff);
+
     // save new path
     sftppath = buff;
 
@@ -855,8 +1359,11 @@ BinaryNode* SFTPClient::sftpGetFile(const char* file, int timeout_ms, ExceptionS
             qh.err("libssh2_sftp_read(" QLLD ") failed: total read: " QLLD " while reading '%s' size " QLLD, fsize - tot, tot, fname.c_str(), fsize);
             return nullptr;
         }
-        if (rc)
+        if (rc) {
             tot += rc;
+            if (throttleUnlocked(true, rc, "SFTPClient::getFile", xsink))
+                return nullptr;
+        }
         if (tot >= fsize)
             break;
     }
@@ -933,8 +1440,11 @@ QoreStringNode* SFTPClient::sftpGetTextFile(const char* file, int timeout_ms, co
             qh.err("libssh2_sftp_read(" QLLD ") failed: total read: " QLLD " while reading '%s' size " QLLD, fsize - tot, tot, fname.c_str(), fsize);
             return nullptr;
         }
-        if (rc)
+        if (rc) {
             tot += rc;
+            if (throttleUnlocked(true, rc, "SFTPClient::getTextFile", xsink))
+                return nullptr;
+        }
         if (tot >= fsize)
             break;
     }
@@ -1030,6 +1540,8 @@ int64 SFTPClient::sftpRetrieveFile(const char* remote_file, const char* local_fi
                 assert(*xsink);
                 return -1;
             }
+            if (throttleUnlocked(true, rc, "SFTPClient::retrieveFile", xsink))
+                return -1;
         }
         if (tot >= fsize)
             break;
@@ -1040,7 +1552,109 @@ int64 SFTPClient::sftpRetrieveFile(const char* remote_file, const char* local_fi
     return tot;
 }
 
-int64 SFTPClient::sftpGet(const char* remote_file, OutputStream *os, int timeout_ms, ExceptionSink* xsink) {
+// reads a remote file into a block ring in a background thread while the calling thread writes the data to an
+// output stream; the reader holds the object lock for each read, and the stream is written without the lock
+struct SftpGetReader {
+    SFTPClient* client;
+    // the SFTP session the handle belongs to
+    LIBSSH2_SFTP* sftp;
+    LIBSSH2_SFTP_HANDLE* h;
+    SSH2BlockRing& ring;
+    SSH2WorkerPool* pool;
+    size_t fsize;
+    int timeout_ms;
+
+    // bytes read
+    size_t tot = 0;
+    // the result of the last socket wait and errno if the wait failed
+    int wait_rc = 1;
+    int wait_errno = 0;
+    // the libssh2 error code if a read failed
+    ssize_t read_rc = 0;
+    // set if the session was closed by another thread while the object lock was released
+    bool lost = false;
+
+    DLLLOCAL SftpGetReader(SFTPClient* c, LIBSSH2_SFTP_HANDLE* h, SSH2BlockRing& r, SSH2WorkerPool* p, size_t fs, int to) :
+            client(c), sftp(c->sftp_session), h(h), ring(r), pool(p), fsize(fs), timeout_ms(to) {
+    }
+
+    // reads the next block with the object lock held; returns the libssh2 result or 0 if the reader must stop
+    DLLLOCAL ssize_t readBlock(char* buf, size_t bs) {
+        AutoLocker al(client->m);
+        // the session could have been closed by another thread while the lock was released
+        if (client->sftp_session != sftp) {
+            lost = true;
+            return 0;
+        }
+        // other threads restore blocking mode when they release the lock
+        client->setBlockingUnlocked(false);
+        // another thread can have left a packet partially sent; if it cannot be completed, the read fails
+        client->sendPendingUnlocked(timeout_ms, nullptr, nullptr);
+
+        ssize_t rc;
+        while ((rc = libssh2_sftp_read(h, buf, bs)) == LIBSSH2_ERROR_EAGAIN) {
+            int wrc = client->waitSocketUnlocked(timeout_ms);
+            if (wrc <= 0) {
+                wait_rc = wrc;
+                wait_errno = errno;
+                rc = 0;
+                break;
+            }
+        }
+        client->setBlockingUnlocked(true);
+        return rc;
+    }
+
+    DLLLOCAL void read() {
+        while (tot < fsize) {
+            char* buf = ring.getFree();
+            // the consumer has stopped
+            if (!buf)
+                break;
+
+            size_t bs = fsize - tot;
+            if (bs > ring.blockSize())
+                bs = ring.blockSize();
+
+            ssize_t rc = readBlock(buf, bs);
+            if (wait_rc <= 0 || lost)
+                break;
+            if (rc < 0) {
+                read_rc = rc;
+                break;
+            }
+            // the file was truncated while being read
+            if (!rc)
+                break;
+            tot += rc;
+            ring.push(rc);
+
+            int64 us = client->throttleDelay(true, rc);
+            if (us && client->sleepUnlocked(us)) {
+                wait_rc = QSSH2_WAIT_CANCELLED;
+                ring.finish();
+                return;
+            }
+        }
+        ring.finish();
+    }
+
+    DLLLOCAL static void run(ExceptionSink* xsink, void* arg) {
+        SftpGetReader* r = reinterpret_cast<SftpGetReader*>(arg);
+        SSH2WorkerPool* pool = r->pool;
+        r->read();
+        // "r" must not be accessed after this call
+        pool->workerDone();
+    }
+};
+
+int64 SFTPClient::sftpGet(const char* remote_file, OutputStream *os, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* opts, QoreHashNode* info) {
+    int64 buffer_size = getIntOption(opts, "buffer_size", SFTP_GET_DEFAULT_BUFFER);
+    if (buffer_size < 0) {
+        xsink->raiseException("SFTPCLIENT-GET-ERROR", "invalid \"buffer_size\" option " QLLD "; expecting a non-negative value", buffer_size);
+        return -1;
+    }
+
     AutoLocker al(m);
 
     // try to make an implicit connection
@@ -1089,47 +1703,140 @@ int64 SFTPClient::sftpGet(const char* remote_file, OutputStream *os, int timeout
         } while (!qh);
     }
 
-    // allocate a buffer for reading
-    std::unique_ptr<char[]> buf(new char[QSSH2_BUFSIZE]);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
     QoreSocketThroughputHelper th(socket, false);
 
     size_t tot = 0;
+    // time the network reads were stalled by the stream and the stream was stalled by the network
+    int64 net_wait_us = 0, stream_wait_us = 0;
+    size_t max_buffered = 0;
+    // the size of the buffer actually used
+    size_t used_buffer_size = QSSH2_BUFSIZE;
+
+    // with a buffer, data is read from the network in a background thread while this thread writes to the stream
+    bool overlapped = false;
+    if (buffer_size && fsize > QSSH2_BUFSIZE) {
+        size_t blocks = buffer_size / QSSH2_BUFSIZE;
+        if (blocks < 2)
+            blocks = 2;
+        SSH2BlockRing ring(blocks, QSSH2_BUFSIZE);
+        SSH2WorkerPool wp(0);
+        SftpGetReader reader(this, *qh, ring, &wp, fsize, timeout_ms);
+
+        ExceptionSink txsink;
+        if (!wp.startThread(SftpGetReader::run, &reader, &txsink)) {
+            overlapped = true;
+            used_buffer_size = blocks * QSSH2_BUFSIZE;
 
-    while (true) {
-        size_t bs = fsize - tot;
-        if (!bs)
-            break;
-        if (bs > QSSH2_BUFSIZE)
-            bs = QSSH2_BUFSIZE;
+            {
+                // the stream is written without the object lock held; the reader takes the lock for each read
+                AutoUnlocker unlock(m);
+                size_t n;
+                const char* data;
+                while ((data = ring.getFilled(n))) {
+                    os->write(data, n, xsink);
+                    ring.release();
+                    if (*xsink) {
+                        ring.abort();
+                        break;
+                    }
+                }
+                wp.wait();
+            }
+            // the reader restores blocking mode each time it releases the lock
+            setBlockingUnlocked(false);
+
+            if (reader.lost) {
+                // the handle was freed with the session
+                qh.release();
+                if (!*xsink)
+                    xsink->raiseException("SFTPCLIENT-GET-ERROR", "the connection was closed while reading '%s'",
+                        fname.c_str());
+                return -1;
+            }
 
-        while ((rc = libssh2_sftp_read(*qh, buf.get(), bs)) == LIBSSH2_ERROR_EAGAIN) {
-            if (qh.waitSocket()) {
-                assert(*xsink);
+            tot = reader.tot;
+            net_wait_us = ring.producerWaitUs();
+            stream_wait_us = ring.consumerWaitUs();
+            max_buffered = ring.maxBuffered();
+
+            if (reader.wait_rc <= 0) {
+                errno = reader.wait_errno;
+                waitResultUnlocked(reader.wait_rc, xsink, SFTPCLIENT_TIMEOUT, "SFTPCLIENT-GET-ERROR", "SFTPClient::get", timeout_ms, false, &qh);
                 return -1;
             }
+            if (reader.read_rc < 0) {
+                qh.err("libssh2_sftp_read(" QLLD ") failed: total read: " QLLD " while reading '%s' size " QLLD, fsize - tot, tot, fname.c_str(), fsize);
+                return -1;
+            }
+            if (*xsink)
+                return -1;
+        } else {
+            // fall back to reading and writing in this thread
+            txsink.clear();
         }
-        if (rc < 0) {
-            qh.err("libssh2_sftp_read(" QLLD ") failed: total read: " QLLD " while reading '%s' size " QLLD, fsize - tot, tot, fname.c_str(), fsize);
-            assert(*xsink);
-            return -1;
-        }
-        if (rc) {
+    }
+
+    if (!overlapped) {
+        // allocate a buffer for reading
+        std::unique_ptr<char[]> buf(new char[QSSH2_BUFSIZE]);
+
+        while (tot < fsize) {
+            size_t bs = fsize - tot;
+            if (bs > QSSH2_BUFSIZE)
+                bs = QSSH2_BUFSIZE;
+
+            std::chrono::steady_clock::time_point rstart = std::chrono::steady_clock::now();
+            while ((rc = libssh2_sftp_read(*qh, buf.get(), bs)) == LIBSSH2_ERROR_EAGAIN) {
+                if (qh.waitSocket()) {
+                    assert(*xsink);
+                    return -1;
+                }
+            }
+            stream_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - rstart).count();
+            if (rc < 0) {
+                qh.err("libssh2_sftp_read(" QLLD ") failed: total read: " QLLD " while reading '%s' size " QLLD, fsize - tot, tot, fname.c_str(), fsize);
+                assert(*xsink);
+                return -1;
+            }
+            // the file was truncated while being read
+            if (!rc)
+                break;
+
             tot += rc;
+            if ((size_t)rc > max_buffered)
+                max_buffered = rc;
+
+            if (throttleUnlocked(true, rc, "SFTPClient::get", xsink))
+                return -1;
+
+            std::chrono::steady_clock::time_point wstart = std::chrono::steady_clock::now();
             {
                 AutoUnlocker unlock(m);
                 os->write(buf.get(), rc, xsink);
                 if (*xsink) {
-                return 0;
+                    return -1;
                 }
             }
+            net_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wstart).count();
         }
-        if (tot >= fsize)
-            break;
     }
 
     th.finalize(tot);
 
+    if (info) {
+        int64 us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        info->setKeyValue("bytes", (int64)tot, xsink);
+        info->setKeyValue("us", us, xsink);
+        info->setKeyValue("bytes_sec", us ? (double)tot * 1000000.0 / (double)us : 0.0, xsink);
+        info->setKeyValue("overlapped", overlapped, xsink);
+        info->setKeyValue("buffer_size", (int64)used_buffer_size, xsink);
+        info->setKeyValue("max_buffered", (int64)max_buffered, xsink);
+        info->setKeyValue("net_wait_us", net_wait_us, xsink);
+        info->setKeyValue("stream_wait_us", stream_wait_us, xsink);
+    }
+
     return tot;
 }
 
@@ -1142,6 +1849,7 @@ size_t SFTPClient::sftpPutFile(const char* outb, size_t towrite, const char* fna
         return -1;
 
     std::string file = absolute_filename(this, fname);
+    cache.invalidate(file);
 
     BlockingHelper bh(this);
 
@@ -1182,6 +1890,8 @@ size_t SFTPClient::sftpPutFile(const char* outb, size_t towrite, const char* fna
             return -1;
         }
         size += rc;
+        if (throttleUnlocked(false, rc, "SFTPClient::putFile", xsink))
+            return -1;
     }
     assert(size == towrite);
 
@@ -1221,6 +1931,7 @@ int64 SFTPClient::sftpTransferFile(const char* local_path, const char* remote_pa
         return -1;
 
     std::string file = absolute_filename(this, remote_path);
+    cache.invalidate(file);
 
     BlockingHelper bh(this);
 
@@ -1278,6 +1989,8 @@ int64 SFTPClient::sftpTransferFile(const char* local_path, const char* remote_pa
             }
             assert((size_t)rc <= (buf->size() - total));
             total += rc;
+            if (throttleUnlocked(false, rc, "SFTPClient::transferFile", xsink))
+                return -1;
             assert((size_t)total <= buf->size());
             if ((size_t)total == buf->size())
                 break;
@@ -1305,6 +2018,7 @@ int64 SFTPClient::sftpPut(InputStream *is, const char* remote_path, int mode, in
         return -1;
 
     std::string file = absolute_filename(this, remote_path);
+    cache.invalidate(file);
 
     BlockingHelper bh(this);
 
@@ -1366,6 +2080,8 @@ int64 SFTPClient::sftpPut(InputStream *is, const char* remote_path, int mode, in
             }
             total += rc;
             size += rc;
+            if (throttleUnlocked(false, rc, "SFTPClient::put", xsink))
+                return -1;
             if (total == r)
                 break;
         }
@@ -1407,6 +2123,9 @@ int SFTPClient::sftpGetAttributes(const char* fname, LIBSSH2_SFTP_ATTRIBUTES *at
 
     std::string file = absolute_filename(this, fname);
 
+    if (cache.getAttrs(file, *attrs))
+        return 0;
+
     BlockingHelper bh(this);
 
     // stat the file
@@ -1430,6 +2149,7 @@ int SFTPClient::sftpGetAttributes(const char* fname, LIBSSH2_SFTP_ATTRIBUTES *at
         return -1;
     }
 
+    cache.putAttrs(file, *attrs);
     return 0;
 }
 
@@ -1469,6 +2189,58 @@ QoreHashNode* SFTPClient::sftpInfo(ExceptionSink* xsink) {
     return h.release();
 }
 
+int SFTPClient::setCache(int64 ttl_ms, int64 max_entries, ExceptionSink* xsink) {
+    if (ttl_ms < 0) {
+        xsink->raiseException("SFTPCLIENT-CACHE-ERROR", "invalid TTL " QLLD "; must be >= 0", ttl_ms);
+        return -1;
+    }
+    if (max_entries < 1) {
+        xsink->raiseException("SFTPCLIENT-CACHE-ERROR", "invalid maximum entry count " QLLD "; must be > 0",
+            max_entries);
+        return -1;
+    }
+
+    AutoLocker al(m);
+    cache.set(ttl_ms, (size_t)max_entries);
+    return 0;
+}
+
+void SFTPClient::clearCache() {
+    AutoLocker al(m);
+    cache.clear();
+}
+
+QoreHashNode* SFTPClient::getCacheInfo(ExceptionSink* xsink) {
+    AutoLocker al(m);
+    return cache.getInfo(xsink);
+}
+
+static const char* sftp_path_modes[] = {"VERIFY", "STAT", "TRUSTED"};
+
+int SFTPClient::setPathMode(const char* mode, ExceptionSink* xsink) {
+    sftp_path_mode_t new_mode;
+    if (!strcmp(mode, "VERIFY"))
+        new_mode = SPM_VERIFY;
+    else if (!strcmp(mode, "STAT"))
+        new_mode = SPM_STAT;
+    else if (!strcmp(mode, "TRUSTED"))
+        new_mode = SPM_TRUSTED;
+    else {
+        xsink->raiseException("SFTPCLIENT-PATHMODE-ERROR", "unknown path mode \"%s\"; expecting one of: VERIFY, "
+            "STAT, TRUSTED", mode);
+        return -1;
+    }
+
+    AutoLocker al(m);
+    path_mode = new_mode;
+    return 0;
+}
+
+const char* SFTPClient::getPathMode() {
+    AutoLocker al(m);
+    return sftp_path_modes[path_mode];
+}
+
 void QSftpHelper::err(const char* fmt, ...) {
     tryClose();
 
@@ -1486,9 +2258,22 @@ void QSftpHelper::err(const char* fmt, ...) {
     client->doSessionErrUnlocked(xsink, desc);
 }
 
+void QSftpHelper::assign(LIBSSH2_SFTP_HANDLE* h) {
+    assert(!sftp_handle);
+    sftp_handle = h;
+    sftp = client->sftp_session;
+}
+
 int QSftpHelper::closeIntern() {
     assert(sftp_handle);
 
+    // the session can be closed by another thread while the object lock is released during a transfer, in which case
+    // the handle has already been freed with it
+    if (client->sftp_session != sftp) {
+        sftp_handle = 0;
+        return 0;
+    }
+
     QoreSocketTimeoutHelper th(client->socket, meth);
 
     // close the handle
@@ -30,6 +30,7 @@
 
 #include "ssh2-module.h"
 #include "SSH2Client.h"
+#include "SftpAttrCache.h"
 
 #include <qore/Qore.h>
 #include <qore/BinaryNode.h>
@@ -37,6 +38,7 @@
 #include <time.h>
 #include <stdarg.h>
 
+#include <set>
 #include <string>
 
 DLLLOCAL QoreClass* initSFTPClientClass(QoreNamespace& ns);
@@ -45,14 +47,30 @@ DLLLOCAL extern qore_classid_t CID_SFTP_CLIENT;
 // the mask for user/group/other permissions
 #define SFTP_UGOMASK ((unsigned long)(LIBSSH2_SFTP_S_IRWXU | LIBSSH2_SFTP_S_IRWXG | LIBSSH2_SFTP_S_IRWXO))
 
+// how chdir() resolves and checks the new directory
+enum sftp_path_mode_t {
+    // resolved with a REALPATH request and checked by opening the directory
+    SPM_VERIFY = 0,
+    // normalized on the client and checked with a single stat request
+    SPM_STAT = 1,
+    // normalized on the client without any request
+    SPM_TRUSTED = 2,
+};
+
 // SFTP blocksize
 #define SFTP_BLOCK 16384
 
+// default size of the buffer between network reads and output stream writes in SFTPClient::get()
+#define SFTP_GET_DEFAULT_BUFFER (1024 * 1024)
+
 class SFTPClient;
+class SFTPDirIterator;
 
 class QSftpHelper : public AbstractDisconnectionHelper {
 private:
     LIBSSH2_SFTP_HANDLE* sftp_handle = nullptr;
+    // the SFTP session the handle belongs to; the handle is freed with the session if it is closed
+    LIBSSH2_SFTP* sftp = nullptr;
     SFTPClient* client;
     const char* errstr;
     const char* meth;
@@ -82,9 +100,13 @@ public:
         return sftp_handle;
     }
 
-    DLLLOCAL void assign(LIBSSH2_SFTP_HANDLE* h) {
-        assert(!sftp_handle);
-        sftp_handle = h;
+    DLLLOCAL void assign(LIBSSH2_SFTP_HANDLE* h);
+
+    // returns the handle and releases ownership; the handle is not closed by the helper
+    DLLLOCAL LIBSSH2_SFTP_HANDLE* release() {
+        LIBSSH2_SFTP_HANDLE* rv = sftp_handle;
+        sftp_handle = nullptr;
+        return rv;
     }
 
     DLLLOCAL void tryClose() {
@@ -106,6 +128,30 @@ public:
 
 class SFTPClient : public SSH2Client {
     friend class QSftpHelper;
+    friend class SftpBatch;
+    friend class SftpBulkTransfer;
+    friend class SftpWalk;
+    friend struct SftpGetReader;
+    friend class SFTPDirIterator;
+
+private:
+    typedef std::set<SFTPDirIterator*> dir_iterator_set_t;
+
+    // directory iterators with an open directory handle
+    dir_iterator_set_t dir_iterators;
+
+    // closes the directory handles of all open iterators before the session is closed
+    DLLLOCAL void closeDirIteratorsUnlocked(int timeout_ms);
+
+    // stat and realpath results; disabled by default, invalidated by this object's own modifications and cleared on
+    // disconnect
+    SftpAttrCache cache;
+
+    // how chdir() resolves paths
+    sftp_path_mode_t path_mode = SPM_VERIFY;
+
+    // checks if a directory exists for makePath(); returns 1 if it exists, 0 if not, or -1 if an exception was raised
+    DLLLOCAL int makePathProbe(QSftpHelper& qh, const std::string& dir, ExceptionSink* xsink);
 
 protected:
     DLLLOCAL virtual ~SFTPClient();
@@ -137,6 +183,8 @@ public:
 
     DLLLOCAL SFTPClient(const char*, const uint32_t);
     DLLLOCAL SFTPClient(QoreURL& url, const uint32_t = 0);
+    // creates an unconnected client with the same connection parameters and path as the given client
+    DLLLOCAL SFTPClient(const SFTPClient& old);
 
     DLLLOCAL virtual int connect(int timeout_ms, ExceptionSink* xsink) {
         return sftpConnect(timeout_ms, xsink);
@@ -158,8 +206,18 @@ public:
     //DLLLOCAL QoreStringNode* sftpPath(ExceptionSink* xsink);
     DLLLOCAL QoreStringNode* sftpPath();
     DLLLOCAL QoreStringNode* sftpChdir(const char* nwd, int timeout_ms, ExceptionSink* xsink);
-    DLLLOCAL QoreHashNode* sftpList(const char* path, int timeout_ms, ExceptionSink* xsink);
-    DLLLOCAL QoreListNode* sftpListFull(const char* path, int timeout_ms, ExceptionSink* xsink);
+    // "filter" is an optional filter hash as accepted by SftpListFilter::init()
+    DLLLOCAL QoreHashNode* sftpList(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter = nullptr);
+    DLLLOCAL QoreListNode* sftpListFull(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter = nullptr);
+    // creates the given directory and any missing ancestors; returns the number of directories created or -1 if an
+    // exception was raised
+    DLLLOCAL int sftpMakePath(const char* dir, const int mode, int timeout_ms, ExceptionSink* xsink);
+    // returns an SFTPDirSnapshot object
+    DLLLOCAL QoreObject* sftpSnapshot(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter = nullptr);
+    // returns a hash<SftpDirColumns>
+    DLLLOCAL QoreHashNode* sftpListColumns(const char* path, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* filter = nullptr);
+    // returns an SFTPDirIterator object for the given directory
+    DLLLOCAL QoreObject* sftpListIterator(const char* path, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink);
     DLLLOCAL int sftpMkdir(const char* dir, const int mode, int timeout_ms, ExceptionSink* xsink);
     DLLLOCAL int sftpRmdir(const char* dir, int timeout_ms, ExceptionSink* xsink);
     DLLLOCAL int sftpRename(const char* from, const char* to, int timeout_ms, ExceptionSink* xsink);
@@ -172,16 +230,49 @@ public:
 
     // returns the number of bytes transferred or -1 if an error occurred
     DLLLOCAL int64 sftpRetrieveFile(const char* remote_file, const char* local_file, int timeout_ms, int mode, ExceptionSink* xsink);
-    // returns the number of bytes transferred or -1 if an error occurred
-    DLLLOCAL int64 sftpGet(const char* remote_file, OutputStream* os, int timeout_ms, ExceptionSink* xsink);
+    // returns the number of bytes transferred or -1 if an error occurred; if "info" is not null, it is filled with
+    // the keys of hash<SftpStreamTransferInfo>
+    DLLLOCAL int64 sftpGet(const char* remote_file, OutputStream* os, int timeout_ms, ExceptionSink* xsink, const QoreHashNode* opts = nullptr, QoreHashNode* info = nullptr);
     // returns the number of bytes transferred or -1 if an error occurred
     DLLLOCAL int64 sftpTransferFile(const char* local_path, const char* remote_path, int mode, int timeout_ms, ExceptionSink* xsink);
     // returns the number of bytes transferred or -1 if an error occurred
     DLLLOCAL int64 sftpPut(InputStream* is, const char* remote_path, int mode, int timeout_ms, ExceptionSink* xsink);
 
     DLLLOCAL int sftpGetAttributes(const char* fname, LIBSSH2_SFTP_ATTRIBUTES* attrs, int timeout_ms, ExceptionSink* xsink);
+    // returns a hash of the paths given to hash<Ssh2StatInfo> values or NOTHING for paths that do not exist
+    DLLLOCAL QoreHashNode* sftpStatMany(const QoreListNode* paths, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink);
+    // batch operations returning a list of hash<SftpBatchResult> in the order given
+    DLLLOCAL QoreListNode* sftpRemoveFiles(const QoreListNode* paths, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink);
+    DLLLOCAL QoreListNode* sftpRenameMany(const QoreHashNode* renames, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink);
+    DLLLOCAL QoreListNode* sftpChmodMany(const QoreListNode* paths, int mode, int timeout_ms, const QoreHashNode* opts, ExceptionSink* xsink);
+
+    // downloads files in parallel over multiple sessions; returns a hash<SftpBulkTransferInfo>
+    DLLLOCAL QoreHashNode* sftpGetFiles(const QoreListNode* remote_paths, const char* local_dir, const QoreHashNode* opts, ExceptionSink* xsink);
+    // uploads files in parallel over multiple sessions; either a list of local paths or a hash of local paths to remote
+    // names must be given; returns a hash<SftpBulkTransferInfo>
+    DLLLOCAL QoreHashNode* sftpPutFiles(const QoreListNode* local_paths, const QoreHashNode* file_map, const char* remote_dir, const QoreHashNode* opts, ExceptionSink* xsink);
+
+    // walks a remote directory tree over multiple sessions and calls the callback for each entry; returns a
+    // hash<SftpWalkInfo>
+    DLLLOCAL QoreHashNode* sftpWalk(const char* path, const ResolvedCallReferenceNode* callback, const QoreHashNode* opts, ExceptionSink* xsink);
 
     DLLLOCAL QoreHashNode* sftpInfo(ExceptionSink* xsink);
+
+    // sets the metadata cache TTL and size; a TTL of 0 disables the cache; returns -1 if an exception was raised
+    DLLLOCAL int setCache(int64 ttl_ms, int64 max_entries, ExceptionSink* xsink);
+    DLLLOCAL void clearCache();
+    // returns a hash<SftpCacheInfo>
+    DLLLOCAL QoreHashNode* getCacheInfo(ExceptionSink* xsink);
+
+    // sets how chdir() resolves paths; returns -1 if an exception was raised
+    DLLLOCAL int setPathMode(const char* mode, ExceptionSink* xsink);
+    DLLLOCAL const char* getPathMode();
+
+    // returns a hash<SftpFileInfo> for a directory entry
+    DLLLOCAL static QoreHashNode* fileInfo(const char* name, const LIBSSH2_SFTP_ATTRIBUTES& attrs, ExceptionSink* xsink);
+
+    // returns a hash<Ssh2StatInfo> for the given attributes
+    DLLLOCAL static QoreHashNode* statInfo(const LIBSSH2_SFTP_ATTRIBUTES& attrs, ExceptionSink* xsink);
 };
 
 // maybe this should go to ssh2-module.h?
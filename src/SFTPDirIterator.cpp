@@ -0,0 +1,152 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SFTPDirIterator.cpp
+
+    streaming remote directory listings
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SFTPDirIterator.h"
+#include "SFTPClient.h"
+
+static const char* SFTPCLIENT_LISTITERATOR_ERROR = "SFTPCLIENT-LISTITERATOR-ERROR";
+
+SFTPDirIterator::SFTPDirIterator(SFTPClient* client, LIBSSH2_SFTP_HANDLE* h, std::string&& path, int timeout_ms,
+        size_t batch_size, SftpListFilter&& filter) : client(client), handle(h), path(std::move(path)),
+        timeout_ms(timeout_ms), batch_size(batch_size), filter(std::move(filter)) {
+    assert(batch_size);
+    client->ref();
+}
+
+bool SFTPDirIterator::next(ExceptionSink* xsink) {
+    if (pos < batch.size() && ++pos < batch.size())
+        return true;
+
+    // free the memory for the previous batch
+    batch.clear();
+    pos = 0;
+
+    if (done || readBatch(xsink))
+        return false;
+
+    return !batch.empty();
+}
+
+QoreHashNode* SFTPDirIterator::getValue(ExceptionSink* xsink) const {
+    if (!valid()) {
+        xsink->raiseException("INVALID-ITERATOR", "the %s is not pointing at a valid element; make sure "
+            "%s::next() returns True before calling this method", getName(), getName());
+        return nullptr;
+    }
+
+    const SftpDirEntry& e = batch[pos];
+    return SFTPClient::fileInfo(e.name.c_str(), e.attrs, xsink);
+}
+
+int SFTPDirIterator::readBatch(ExceptionSink* xsink) {
+    assert(batch.empty());
+
+    AutoLocker al(client->m);
+
+    if (!handle) {
+        done = true;
+        xsink->raiseException(SFTPCLIENT_LISTITERATOR_ERROR, "the connection was closed while listing directory '%s'",
+            path.c_str());
+        return -1;
+    }
+
+    BlockingHelper bh(client);
+
+    // the helper owns the handle while the batch is being read, so it is closed if an error occurs or the client is
+    // disconnected
+    QSftpHelper qh(client, SFTPCLIENT_LISTITERATOR_ERROR, "SFTPDirIterator::next", timeout_ms, xsink);
+    qh.assign(handle);
+    handle = nullptr;
+
+    char buff[PATH_MAX];
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+    batch.reserve(batch_size);
+    while (batch.size() < batch_size) {
+        int rc;
+        while ((rc = libssh2_sftp_readdir(*qh, buff, sizeof(buff), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+            if (qh.waitSocket()) {
+                rc = -1;
+                break;
+            }
+        }
+        if (!rc) {
+            done = true;
+            break;
+        }
+        if (rc < 0) {
+            if (!*xsink)
+                qh.err("error reading directory '%s'", path.c_str());
+            batch.clear();
+            done = true;
+            client->dir_iterators.erase(this);
+            return -1;
+        }
+        if (filter.match(buff, attrs))
+            batch.emplace_back(buff, (size_t)rc, attrs);
+    }
+
+    if (done)
+        // the handle is closed when the helper goes out of scope
+        client->dir_iterators.erase(this);
+    else
+        handle = qh.release();
+
+    return 0;
+}
+
+void SFTPDirIterator::destructor(ExceptionSink* xsink) {
+    AutoLocker al(client->m);
+    if (!handle)
+        return;
+
+    client->dir_iterators.erase(this);
+
+    BlockingHelper bh(client);
+    QSftpHelper qh(client, SFTPCLIENT_LISTITERATOR_ERROR, "SFTPDirIterator::destructor", timeout_ms, xsink);
+    qh.assign(handle);
+    handle = nullptr;
+}
+
+void SFTPDirIterator::deref(ExceptionSink* xsink) {
+    if (ROdereference()) {
+        destructor(xsink);
+        client->deref(xsink);
+        delete this;
+    }
+}
+
+void SFTPDirIterator::disconnectUnlocked(int to_ms) {
+    if (!handle)
+        return;
+
+    int rc;
+    while ((rc = libssh2_sftp_close_handle(handle)) == LIBSSH2_ERROR_EAGAIN) {
+        // note: memory leak here! we cannot close the handle due to the timeout
+        if (client->waitSocketUnlocked(to_ms) <= 0)
+            break;
+    }
+    handle = nullptr;
+}
@@ -0,0 +1,123 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SFTPDirIterator.h
+
+    streaming remote directory listings
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SFTPDIRITERATOR_H
+
+#define _QORE_SFTPDIRITERATOR_H
+
+#include "ssh2-module.h"
+#include "SftpListFilter.h"
+
+#include <qore/Qore.h>
+
+#include <string>
+#include <vector>
+
+DLLLOCAL extern qore_classid_t CID_SFTPDIRITERATOR;
+DLLLOCAL extern QoreClass* QC_SFTPDIRITERATOR;
+
+DLLLOCAL QoreClass* initSFTPDirIteratorClass(QoreNamespace& ns);
+
+// default number of directory entries read from the server with each lock of the client
+#define SFTP_DIR_BATCH 128
+
+class SFTPClient;
+
+// a directory entry as returned by libssh2_sftp_readdir()
+struct SftpDirEntry {
+    std::string name;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+    DLLLOCAL SftpDirEntry(const char* n, size_t len, const LIBSSH2_SFTP_ATTRIBUTES& a) : name(n, len), attrs(a) {
+    }
+};
+
+// iterates a remote directory while it is being read; only one batch of raw entries is held in memory at a time
+// and Qore values are only created for the current entry
+class SFTPDirIterator : public QoreIteratorBase {
+    friend class SFTPClient;
+
+public:
+    // the directory handle must already be open; the iterator is registered with the client when it is created
+    DLLLOCAL SFTPDirIterator(SFTPClient* client, LIBSSH2_SFTP_HANDLE* h, std::string&& path, int timeout_ms,
+            size_t batch_size, SftpListFilter&& filter);
+
+    DLLLOCAL bool next(ExceptionSink* xsink);
+
+    // returns a hash<SftpFileInfo> for the current entry
+    DLLLOCAL QoreHashNode* getValue(ExceptionSink* xsink) const;
+
+    DLLLOCAL bool valid() const {
+        return pos < batch.size();
+    }
+
+    DLLLOCAL const std::string& getPath() const {
+        return path;
+    }
+
+    // closes the directory handle and deregisters the iterator from the client
+    DLLLOCAL void destructor(ExceptionSink* xsink);
+
+    DLLLOCAL virtual void deref(ExceptionSink* xsink);
+
+    DLLLOCAL virtual const char* getName() const {
+        return "SFTPDirIterator";
+    }
+
+    DLLLOCAL virtual const QoreTypeInfo* getElementType() const {
+        return hashdeclSftpFileInfo->getTypeInfo();
+    }
+
+protected:
+    DLLLOCAL virtual ~SFTPDirIterator() {
+        assert(!handle);
+    }
+
+private:
+    SFTPClient* client;
+    // the open directory handle; only accessed with the client lock held; nullptr when the listing is complete or
+    // the handle has been closed by a disconnect
+    LIBSSH2_SFTP_HANDLE* handle;
+    std::string path;
+    int timeout_ms;
+    size_t batch_size;
+    // entries not matching the filter are skipped while the directory is read
+    SftpListFilter filter;
+
+    // the current batch of entries and the position of the current entry
+    std::vector<SftpDirEntry> batch;
+    size_t pos = 0;
+
+    // true once the end of the directory has been reached
+    bool done = false;
+
+    // reads the next batch of entries; returns -1 if an exception was raised
+    DLLLOCAL int readBatch(ExceptionSink* xsink);
+
+    // called by the client with its lock held when the connection is closed
+    DLLLOCAL void disconnectUnlocked(int timeout_ms);
+};
+
+#endif // _QORE_SFTPDIRITERATOR_H
@@ -0,0 +1,86 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SFTPDirSnapshot.cpp
+
+    remote directory snapshots for change detection
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SFTPDirSnapshot.h"
+
+#include <algorithm>
+
+SFTPDirSnapshot::SFTPDirSnapshot(std::string&& path, std::vector<SftpSnapEntry>&& entries) : path(std::move(path)),
+        entries(std::move(entries)) {
+    std::sort(this->entries.begin(), this->entries.end());
+}
+
+const SftpSnapEntry* SFTPDirSnapshot::find(const char* name) const {
+    std::vector<SftpSnapEntry>::const_iterator i = std::lower_bound(entries.begin(), entries.end(), name,
+        [](const SftpSnapEntry& e, const char* n) { return e.name.compare(n) < 0; });
+    return i != entries.end() && i->name == name ? &(*i) : nullptr;
+}
+
+QoreHashNode* SFTPDirSnapshot::entryInfo(const SftpSnapEntry& e, ExceptionSink* xsink) {
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpSnapshotEntry, xsink), xsink);
+    h->setKeyValue("name", new QoreStringNode(e.name), xsink);
+    h->setKeyValue("size", e.size, xsink);
+    h->setKeyValue("mtime", DateTimeNode::makeAbsolute(currentTZ(), e.mtime), xsink);
+    h->setKeyValue("mode", e.mode, xsink);
+    return h.release();
+}
+
+QoreListNode* SFTPDirSnapshot::getNames(ExceptionSink* xsink) const {
+    ReferenceHolder<QoreListNode> rv(new QoreListNode(stringTypeInfo), xsink);
+    for (auto& i : entries)
+        rv->push(new QoreStringNode(i.name), xsink);
+    return rv.release();
+}
+
+QoreHashNode* SFTPDirSnapshot::diff(const SFTPDirSnapshot& old, ExceptionSink* xsink) const {
+    ReferenceHolder<QoreListNode> added(new QoreListNode(stringTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> removed(new QoreListNode(stringTypeInfo), xsink);
+    ReferenceHolder<QoreListNode> modified(new QoreListNode(stringTypeInfo), xsink);
+
+    // both snapshots are sorted by name, so all changes are found with a single merge pass
+    std::vector<SftpSnapEntry>::const_iterator oi = old.entries.begin(), oe = old.entries.end();
+    std::vector<SftpSnapEntry>::const_iterator ni = entries.begin(), ne = entries.end();
+    while (oi != oe || ni != ne) {
+        int c = oi == oe ? 1 : (ni == ne ? -1 : oi->name.compare(ni->name));
+        if (c < 0) {
+            removed->push(new QoreStringNode(oi->name), xsink);
+            ++oi;
+        } else if (c > 0) {
+            added->push(new QoreStringNode(ni->name), xsink);
+            ++ni;
+        } else {
+            if (ni->differs(*oi))
+                modified->push(new QoreStringNode(ni->name), xsink);
+            ++oi;
+            ++ni;
+        }
+    }
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(hashdeclSftpSnapshotDiff, xsink), xsink);
+    rv->setKeyValue("added", added.release(), xsink);
+    rv->setKeyValue("removed", removed.release(), xsink);
+    rv->setKeyValue("modified", modified.release(), xsink);
+    return rv.release();
+}
@@ -0,0 +1,97 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SFTPDirSnapshot.h
+
+    remote directory snapshots for change detection
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SFTPDIRSNAPSHOT_H
+
+#define _QORE_SFTPDIRSNAPSHOT_H
+
+#include "ssh2-module.h"
+
+#include <qore/Qore.h>
+
+#include <string>
+#include <vector>
+
+DLLLOCAL extern qore_classid_t CID_SFTPDIRSNAPSHOT;
+DLLLOCAL extern QoreClass* QC_SFTPDIRSNAPSHOT;
+
+DLLLOCAL QoreClass* initSFTPDirSnapshotClass(QoreNamespace& ns);
+
+// a directory entry in a snapshot; values not returned by the server are 0
+struct SftpSnapEntry {
+    std::string name;
+    int64 size;
+    int64 mtime;
+    int64 mode;
+
+    DLLLOCAL SftpSnapEntry(const char* n, size_t len, const LIBSSH2_SFTP_ATTRIBUTES& a) : name(n, len),
+            size(a.flags & LIBSSH2_SFTP_ATTR_SIZE ? (int64)a.filesize : 0),
+            mtime(a.flags & LIBSSH2_SFTP_ATTR_ACMODTIME ? (int64)a.mtime : 0),
+            mode(a.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS ? (int64)a.permissions : 0) {
+    }
+
+    DLLLOCAL bool operator<(const SftpSnapEntry& e) const {
+        return name < e.name;
+    }
+
+    // returns true if the entry has changed
+    DLLLOCAL bool differs(const SftpSnapEntry& e) const {
+        return size != e.size || mtime != e.mtime || mode != e.mode;
+    }
+};
+
+// an immutable listing of a remote directory sorted by name; no Qore values are held, so a snapshot of a large
+// directory needs little more memory than the names themselves
+class SFTPDirSnapshot : public AbstractPrivateData {
+public:
+    // sorts the entries
+    DLLLOCAL SFTPDirSnapshot(std::string&& path, std::vector<SftpSnapEntry>&& entries);
+
+    DLLLOCAL const std::string& getPath() const {
+        return path;
+    }
+
+    DLLLOCAL size_t size() const {
+        return entries.size();
+    }
+
+    // returns the entry with the given name or nullptr if there is no such entry
+    DLLLOCAL const SftpSnapEntry* find(const char* name) const;
+
+    // returns a hash<SftpSnapshotEntry> for the given entry
+    DLLLOCAL static QoreHashNode* entryInfo(const SftpSnapEntry& e, ExceptionSink* xsink);
+
+    // returns the sorted names of all entries
+    DLLLOCAL QoreListNode* getNames(ExceptionSink* xsink) const;
+
+    // returns a hash<SftpSnapshotDiff> with the changes from "old" to this snapshot
+    DLLLOCAL QoreHashNode* diff(const SFTPDirSnapshot& old, ExceptionSink* xsink) const;
+
+private:
+    std::string path;
+    std::vector<SftpSnapEntry> entries;
+};
+
+#endif // _QORE_SFTPDIRSNAPSHOT_H
@@ -0,0 +1,502 @@
+/* -*- indent-tabs-mode: nil -*- */
+/*
+    SFTPWalk.cpp
+
+    parallel recursive remote directory walks
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SFTPClient.h"
+#include "SFTPDirIterator.h"
+#include "SftpListFilter.h"
+#include "SSH2WorkerPool.h"
+
+#include <climits>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// default number of parallel sessions for directory walks
+#define SFTP_WALK_DEFAULT_WORKERS 4
+// maximum number of parallel sessions for directory walks
+#define SFTP_WALK_MAX_WORKERS 64
+// the maximum number of entries waiting to be passed to the callback before the sessions stop reading
+#define SFTP_WALK_MAX_QUEUE (SFTP_DIR_BATCH * 32)
+// the interval for checking for cancellation while waiting for the sessions
+#define SFTP_WALK_CANCEL_POLL_MS 100
+
+static const char* SFTPCLIENT_WALK_ERROR = "SFTPCLIENT-WALK-ERROR";
+
+// a directory waiting to be read
+struct SftpWalkDir {
+    // the path relative to the root of the walk; empty for the root directory
+    std::string rel;
+    // the depth of the entries in the directory; 0 for the root directory
+    int depth;
+
+    DLLLOCAL SftpWalkDir(std::string&& r, int d) : rel(std::move(r)), depth(d) {
+    }
+};
+
+// an entry waiting to be passed to the callback
+struct SftpWalkEntry {
+    // the path relative to the root of the walk
+    std::string path;
+    // the offset of the entry name in "path"
+    size_t name_offset;
+    LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+    DLLLOCAL SftpWalkEntry(std::string&& p, size_t o, const LIBSSH2_SFTP_ATTRIBUTES& a) : path(std::move(p)),
+            name_offset(o), attrs(a) {
+    }
+};
+
+// a directory that could not be read
+struct SftpWalkError {
+    std::string path;
+    std::string err;
+    std::string desc;
+};
+
+class SftpWalk;
+
+// argument for a background worker thread
+struct SftpWalkWorker {
+    SftpWalk* w;
+    SFTPClient* client;
+};
+
+class SftpWalk {
+public:
+    // entries passed to the callback must match this filter
+    SftpListFilter filter;
+    // subdirectories are only read if they match this filter
+    SftpListFilter dir_filter;
+
+    DLLLOCAL SftpWalk(const char* root, int to, int md) : root(root ? root : ""), timeout_ms(to), max_depth(md) {
+    }
+
+    // walks the tree with the given number of sessions, each of which is a new connection with the same parameters as
+    // the given client; returns a hash<SftpWalkInfo>
+    DLLLOCAL QoreHashNode* run(SFTPClient* client, unsigned workers, const ResolvedCallReferenceNode* callback,
+            ExceptionSink* xsink);
+
+private:
+    // the root path as given by the caller
+    std::string root;
+    int timeout_ms;
+    // the maximum depth of directories to read; -1 = no limit
+    int max_depth;
+
+    SSH2WorkerPool* pool = nullptr;
+
+    // protects all members below
+    QoreThreadLock l;
+    // signalled when directories or entries are queued, when the queue of entries is drained, and when the walk is
+    // complete
+    QoreCondition cond;
+    // directories waiting to be read
+    std::deque<SftpWalkDir> dirs;
+    // the number of directories being read
+    unsigned active = 0;
+    // entries waiting to be passed to the callback
+    std::deque<SftpWalkEntry> out;
+    // directories that could not be read
+    std::vector<SftpWalkError> errors;
+    // the number of directories read completely
+    int64 dirs_read = 0;
+    // the number of background workers still running
+    unsigned live = 0;
+    // the number of sessions that connected successfully
+    unsigned sessions = 0;
+    // the connection error if a worker could not connect
+    std::string conn_err, conn_desc;
+    // set when no more directories are to be read
+    bool stopped = false;
+
+    // claims the next directory; waits until a directory is available or all directories have been read; returns
+    // false when the walk is complete or has been stopped
+    DLLLOCAL bool claim(SftpWalkDir& d);
+
+    // called when a claimed directory has been processed
+    DLLLOCAL void release(bool ok);
+
+    // queues entries for the callback and subdirectories to be read; waits while the queue of entries is full;
+    // returns false if the walk has been stopped
+    DLLLOCAL bool push(std::vector<SftpWalkEntry>& entries, std::vector<SftpWalkDir>& subdirs);
+
+    // stops the walk; no more directories are read
+    DLLLOCAL void stop();
+
+    // reads directories with the given client until the walk is complete
+    DLLLOCAL void process(SFTPClient* client);
+
+    // reads a single directory; returns false if it could not be read
+    DLLLOCAL bool readDir(SFTPClient* client, const std::string& base, const SftpWalkDir& d);
+
+    DLLLOCAL static void workerThread(ExceptionSink* xsink, void* arg);
+};
+
+QoreHashNode* SftpWalk::run(SFTPClient* client, unsigned workers, const ResolvedCallReferenceNode* callback,
+        ExceptionSink* xsink) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SSH2WorkerPool wp(0);
+    pool = &wp;
+
+    dirs.emplace_back(std::string(), 0);
+
+    // the callback is called in this thread, so the client object itself remains available to the callback; all
+    // directories are read by background sessions
+    std::vector<SftpWalkWorker> wl;
+    wl.reserve(workers);
+
+    client->enterCancelRegion();
+    for (unsigned i = 0; i < workers; ++i) {
+        wl.push_back({this, new SFTPClient(*client)});
+        {
+            AutoLocker al(l);
+            ++live;
+        }
+        if (wp.startThread(workerThread, &wl.back(), xsink)) {
+            {
+                AutoLocker al(l);
+                --live;
+            }
+            static_cast<AbstractPrivateData*>(wl.back().client)->deref(xsink);
+            wl.pop_back();
+            // continue with the workers already started
+            if (!wl.empty())
+                xsink->clear();
+            break;
+        }
+    }
+
+    bool cancelled = false;
+    int64 count = 0;
+    while (!*xsink) {
+        std::deque<SftpWalkEntry> batch;
+        bool done;
+        {
+            AutoLocker al(l);
+            if (out.empty() && live)
+                cond.wait(&l, SFTP_WALK_CANCEL_POLL_MS);
+            batch.swap(out);
+            // wake up any sessions waiting for space in the queue
+            if (!batch.empty())
+                cond.broadcast();
+            done = !live;
+        }
+
+        if (!cancelled && client->takeCancel()) {
+            cancelled = true;
+            stop();
+            for (auto& i : wl)
+                i.client->cancel();
+        }
+
+        if (batch.empty() || cancelled) {
+            if (done)
+                break;
+            continue;
+        }
+
+        for (auto& i : batch) {
+            ReferenceHolder<QoreListNode> args(new QoreListNode(autoTypeInfo), xsink);
+            args->push(new QoreStringNode(i.path), xsink);
+            args->push(SFTPClient::fileInfo(i.path.c_str() + i.name_offset, i.attrs, xsink), xsink);
+            ValueHolder rv(callback->execValue(*args, xsink), xsink);
+            if (*xsink)
+                break;
+            ++count;
+            // the walk is stopped if the callback returns False
+            if (rv->getType() == NT_BOOLEAN && !rv->getAsBool()) {
+                stop();
+                break;
+            }
+        }
+
+        if (*xsink)
+            stop();
+    }
+
+    wp.wait();
+    client->exitCancelRegion();
+    pool = nullptr;
+
+    for (auto& i : wl)
+        static_cast<AbstractPrivateData*>(i.client)->deref(xsink);
+
+    if (*xsink)
+        return nullptr;
+
+    if (cancelled) {
+        xsink->raiseException(SSH2_CANCELLED, "SFTPClient::walk() was cancelled");
+        return nullptr;
+    }
+
+    if (!sessions) {
+        xsink->raiseException(conn_err.empty() ? SFTPCLIENT_WALK_ERROR : conn_err.c_str(), "%s",
+            conn_desc.empty() ? "no session could be established" : conn_desc.c_str());
+        return nullptr;
+    }
+
+    // an error reading the root directory fails the request
+    for (auto& i : errors) {
+        if (i.path.empty()) {
+            xsink->raiseException(i.err.c_str(), "%s", i.desc.c_str());
+            return nullptr;
+        }
+    }
+
+    int64 us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    ReferenceHolder<QoreListNode> el(new QoreListNode(hashdeclSftpWalkError->getTypeInfo()), xsink);
+    for (auto& i : errors) {
+        ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSftpWalkError, xsink), xsink);
+        h->setKeyValue("path", new QoreStringNode(i.path), xsink);
+        h->setKeyValue("err", new QoreStringNode(i.err), xsink);
+        h->setKeyValue("desc", new QoreStringNode(i.desc), xsink);
+        el->push(h.release(), xsink);
+    }
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(hashdeclSftpWalkInfo, xsink), xsink);
+    rv->setKeyValue("count", count, xsink);
+    rv->setKeyValue("directories", dirs_read, xsink);
+    rv->setKeyValue("errors", el.release(), xsink);
+    rv->setKeyValue("us", us, xsink);
+    rv->setKeyValue("sessions", (int64)sessions, xsink);
+    return rv.release();
+}
+
+bool SftpWalk::claim(SftpWalkDir& d) {
+    AutoLocker al(l);
+    while (!stopped && dirs.empty() && active)
+        cond.wait(&l);
+    if (stopped || dirs.empty())
+        return false;
+    d = std::move(dirs.front());
+    dirs.pop_front();
+    ++active;
+    return true;
+}
+
+void SftpWalk::release(bool ok) {
+    AutoLocker al(l);
+    if (ok)
+        ++dirs_read;
+    // wake up idle sessions when the walk is complete
+    if (!--active && dirs.empty())
+        cond.broadcast();
+}
+
+bool SftpWalk::push(std::vector<SftpWalkEntry>& entries, std::vector<SftpWalkDir>& subdirs) {
+    if (entries.empty() && subdirs.empty())
+        return !stopped;
+
+    AutoLocker al(l);
+    while (!stopped && !entries.empty() && out.size() >= SFTP_WALK_MAX_QUEUE)
+        cond.wait(&l);
+    if (stopped)
+        return false;
+
+    for (auto& i : entries)
+        out.push_back(std::move(i));
+    for (auto& i : subdirs)
+        dirs.push_back(std::move(i));
+    entries.clear();
+    subdirs.clear();
+    cond.broadcast();
+    return true;
+}
+
+void SftpWalk::stop() {
+    AutoLocker al(l);
+    stopped = true;
+    out.clear();
+    cond.broadcast();
+}
+
+void SftpWalk::process(SFTPClient* client) {
+    // relative root paths are resolved against the session's current directory
+    std::string base;
+    if (root.empty())
+        base = client->sftppath;
+    else
+        base = absolute_filename(client, root.c_str());
+    if (base.size() > 1 && base.back() == '/')
+        base.pop_back();
+
+    SftpWalkDir d(std::string(), 0);
+    while (claim(d))
+        release(readDir(client, base, d));
+}
+
+bool SftpWalk::readDir(SFTPClient* client, const std::string& base, const SftpWalkDir& d) {
+    std::string path;
+    if (d.rel.empty())
+        path = base;
+    else if (base == "/")
+        path = base + d.rel;
+    else
+        path = base + "/" + d.rel;
+
+    ExceptionSink xsink;
+    {
+        AutoLocker al(client->m);
+        BlockingHelper bh(client);
+
+        QSftpHelper qh(client, SFTPCLIENT_WALK_ERROR, "SFTPClient::walk", timeout_ms, &xsink);
+
+        do {
+            qh.assign(libssh2_sftp_opendir(client->sftp_session, path.c_str()));
+            if (!qh) {
+                if (libssh2_session_last_errno(client->ssh_session) == LIBSSH2_ERROR_EAGAIN) {
+                    if (qh.waitSocket())
+                        break;
+                } else {
+                    qh.err("error reading directory '%s'", path.c_str());
+                    break;
+                }
+            }
+        } while (!qh);
+
+        if (qh) {
+            // the prefix for the relative paths of the entries in this directory
+            std::string prefix = d.rel.empty() ? std::string() : d.rel + "/";
+            bool descend = max_depth < 0 || d.depth < max_depth;
+
+            char buff[PATH_MAX];
+            LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+            std::vector<SftpWalkEntry> entries;
+            std::vector<SftpWalkDir> subdirs;
+            entries.reserve(SFTP_DIR_BATCH);
+
+            while (true) {
+                int rc;
+                while ((rc = libssh2_sftp_readdir(*qh, buff, sizeof(buff), &attrs)) == LIBSSH2_ERROR_EAGAIN) {
+                    if (qh.waitSocket()) {
+                        rc = -1;
+                        break;
+                    }
+                }
+                if (!rc)
+                    break;
+                if (rc < 0) {
+                    if (!xsink)
+                        qh.err("error reading directory '%s'", path.c_str());
+                    break;
+                }
+                if (buff[0] == '.' && (!buff[1] || (buff[1] == '.' && !buff[2])))
+                    continue;
+
+                if (descend && (attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS)
+                    && LIBSSH2_SFTP_S_ISDIR(attrs.permissions) && dir_filter.match(buff, attrs)) {
+                    subdirs.emplace_back(prefix + std::string(buff, rc), d.depth + 1);
+                }
+                if (filter.match(buff, attrs))
+                    entries.emplace_back(prefix + std::string(buff, rc), prefix.size(), attrs);
+
+                // pass on entries and subdirectories as they are read, so other sessions can start on the
+                // subdirectories while this one is still being read
+                if (entries.size() == SFTP_DIR_BATCH || subdirs.size() == SFTP_DIR_BATCH) {
+                    if (!push(entries, subdirs))
+                        return false;
+                }
+            }
+
+            if (!xsink && !push(entries, subdirs))
+                return false;
+        }
+    }
+
+    if (!xsink)
+        return true;
+
+    AutoLocker al(l);
+    // errors after the walk has been stopped are a result of the stop and are not reported
+    if (!stopped) {
+        errors.push_back(SftpWalkError());
+        SftpWalkError& e = errors.back();
+        e.path = d.rel;
+        getExceptionInfo(xsink, e.err, e.desc);
+    }
+    xsink.clear();
+    return false;
+}
+
+void SftpWalk::workerThread(ExceptionSink* xsink, void* arg) {
+    SftpWalkWorker* w = reinterpret_cast<SftpWalkWorker*>(arg);
+    SftpWalk* sw = w->w;
+
+    {
+        ExceptionSink cxsink;
+        if (!w->client->sftpConnect(sw->timeout_ms, &cxsink)) {
+            {
+                AutoLocker al(sw->l);
+                ++sw->sessions;
+            }
+            sw->process(w->client);
+            w->client->disconnect(true, sw->timeout_ms);
+        } else {
+            // a worker that cannot connect leaves the walk to the other workers
+            printd(5, "SftpWalk::workerThread() client %p: failed to connect; exiting\n", w->client);
+            AutoLocker al(sw->l);
+            if (sw->conn_err.empty())
+                getExceptionInfo(cxsink, sw->conn_err, sw->conn_desc);
+            cxsink.clear();
+        }
+    }
+
+    {
+        AutoLocker al(sw->l);
+        if (!--sw->live)
+            sw->cond.broadcast();
+    }
+
+    // "sw" must not be accessed after this call
+    sw->pool->workerDone();
+}
+
+QoreHashNode* SFTPClient::sftpWalk(const char* path, const ResolvedCallReferenceNode* callback,
+        const QoreHashNode* opts, ExceptionSink* xsink) {
+    int64 workers = getIntOption(opts, "workers", SFTP_WALK_DEFAULT_WORKERS);
+    if (workers < 1 || workers > SFTP_WALK_MAX_WORKERS) {
+        xsink->raiseException(SFTPCLIENT_WALK_ERROR, "invalid \"workers\" option " QLLD "; expecting a value from 1 "
+            "to %d", workers, SFTP_WALK_MAX_WORKERS);
+        return nullptr;
+    }
+
+    int64 max_depth = getIntOption(opts, "max_depth", -1);
+    if (max_depth < -1 || max_depth > INT_MAX) {
+        xsink->raiseException(SFTPCLIENT_WALK_ERROR, "invalid \"max_depth\" option " QLLD "; expecting -1 for no "
+            "limit or a value >= 0", max_depth);
+        return nullptr;
+    }
+
+    SftpWalk sw(path, getMsTimeoutOption(opts, "timeout", 60000), (int)max_depth);
+    if (sw.filter.initOption(opts, "filter", SFTPCLIENT_WALK_ERROR, xsink)
+        || sw.dir_filter.initOption(opts, "dir_filter", SFTPCLIENT_WALK_ERROR, xsink)) {
+        return nullptr;
+    }
+
+    return sw.run(this, (unsigned)workers, callback, xsink);
+}
@@ -0,0 +1,164 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2BlockRing.h
+
+    bounded block buffer between a network thread and a stream thread
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2BLOCKRING_H
+
+#define _QORE_SSH2BLOCKRING_H
+
+#include "ssh2-module.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// a fixed number of fixed-size blocks passed from a single producer to a single consumer; the producer fills free
+// blocks while the consumer drains filled blocks, so both sides run concurrently with bounded memory
+class SSH2BlockRing {
+public:
+    DLLLOCAL SSH2BlockRing(size_t n_blocks, size_t block_size) : blocks(n_blocks), bsize(block_size),
+            buf(new char[n_blocks * block_size]), len(n_blocks) {
+        assert(n_blocks);
+    }
+
+    DLLLOCAL size_t blockSize() const {
+        return bsize;
+    }
+
+    // returns the next free block for the producer; blocks until a block is free; returns nullptr if the ring has
+    // been aborted
+    DLLLOCAL char* getFree() {
+        AutoLocker al(l);
+        if (filled == blocks && !aborted) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            while (filled == blocks && !aborted)
+                free_cond.wait(&l);
+            producer_wait += elapsedUs(start);
+        }
+        return aborted ? nullptr : buf.get() + (tail * bsize);
+    }
+
+    // publishes the block returned by getFree() with the given number of bytes
+    DLLLOCAL void push(size_t n) {
+        assert(n && n <= bsize);
+        AutoLocker al(l);
+        len[tail] = n;
+        tail = (tail + 1) % blocks;
+        ++filled;
+        buffered += n;
+        if (buffered > max_buffered)
+            max_buffered = buffered;
+        data_cond.signal();
+    }
+
+    // called by the producer when there is no more data
+    DLLLOCAL void finish() {
+        AutoLocker al(l);
+        done = true;
+        data_cond.signal();
+    }
+
+    // returns the next filled block for the consumer; blocks until a block is available; returns nullptr when all
+    // data has been consumed or the ring has been aborted
+    DLLLOCAL const char* getFilled(size_t& n) {
+        AutoLocker al(l);
+        if (!filled && !done && !aborted) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            while (!filled && !done && !aborted)
+                data_cond.wait(&l);
+            consumer_wait += elapsedUs(start);
+        }
+        if (aborted || !filled)
+            return nullptr;
+        n = len[head];
+        return buf.get() + (head * bsize);
+    }
+
+    // releases the block returned by getFilled()
+    DLLLOCAL void release() {
+        AutoLocker al(l);
+        assert(filled);
+        buffered -= len[head];
+        head = (head + 1) % blocks;
+        --filled;
+        free_cond.signal();
+    }
+
+    // wakes up and stops both sides
+    DLLLOCAL void abort() {
+        AutoLocker al(l);
+        aborted = true;
+        free_cond.signal();
+        data_cond.signal();
+    }
+
+    // time in microseconds the producer waited for free blocks
+    DLLLOCAL int64 producerWaitUs() const {
+        AutoLocker al(l);
+        return producer_wait;
+    }
+
+    // time in microseconds the consumer waited for data
+    DLLLOCAL int64 consumerWaitUs() const {
+        AutoLocker al(l);
+        return consumer_wait;
+    }
+
+    // the maximum number of bytes buffered at any time
+    DLLLOCAL size_t maxBuffered() const {
+        AutoLocker al(l);
+        return max_buffered;
+    }
+
+private:
+    size_t blocks;
+    size_t bsize;
+    std::unique_ptr<char[]> buf;
+    // the number of bytes in each block
+    std::vector<size_t> len;
+
+    mutable QoreThreadLock l;
+    QoreCondition free_cond, data_cond;
+
+    // index of the next block to consume
+    size_t head = 0;
+    // index of the next block to fill
+    size_t tail = 0;
+    // number of filled blocks
+    size_t filled = 0;
+
+    size_t buffered = 0;
+    size_t max_buffered = 0;
+    int64 producer_wait = 0;
+    int64 consumer_wait = 0;
+
+    bool done = false;
+    bool aborted = false;
+
+    DLLLOCAL static int64 elapsedUs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif // _QORE_SSH2BLOCKRING_H
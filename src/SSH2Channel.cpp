@@ -26,12 +26,64 @@
 #include "SSH2Channel.h"
 #include "SSH2Client.h"
 
+#include <memory>
+
 const char* SSH2CHANNEL_TIMEOUT = "SSH2CHANNEL-TIMEOUT";
 
+void SSH2Channel::closeUnlocked() {
+    parent->flush_set.erase(this);
+    parent->channelFreedUnlocked(channel);
+    libssh2_channel_free(channel);
+    channel = nullptr;
+    // any buffered data cannot be sent anymore
+    wbuf.clear();
+}
+
+int SSH2Channel::receivedUnlocked(size_t bytes, size_t requested, const char* meth, ExceptionSink* xsink) {
+    if (window && adjustWindow(channel, window, max_window, bytes < requested) == LIBSSH2_ERROR_EAGAIN)
+        parent->pending_channel = channel;
+    return parent->throttleUnlocked(true, bytes, meth, xsink);
+}
+
+int SSH2Channel::adjustWindow(LIBSSH2_CHANNEL* channel, uint32_t& window, uint32_t max_window, bool drained) {
+    // the number of bytes the server can still send before the window must be adjusted
+    unsigned long avail = libssh2_channel_window_read_ex(channel, nullptr, nullptr);
+
+    // if all data received has been read and the server has used most of the window, then the window and not the
+    // reader limits the transfer, so the window is doubled up to the maximum
+    if (drained && avail < window / 4 && window < max_window)
+        window = window > max_window / 2 ? max_window : window * 2;
+
+    if (avail >= window / 2)
+        return 0;
+
+    // errors other than LIBSSH2_ERROR_EAGAIN are not reported here but by the next read
+    return libssh2_channel_receive_window_adjust2(channel, window - avail, 0, nullptr);
+}
+
+int64 SSH2Channel::getWindowSize(ExceptionSink* xsink) {
+    AutoLocker al(parent->m);
+    if (check_open(xsink))
+        return -1;
+
+    if (window)
+        return window;
+
+    unsigned long initial = 0;
+    libssh2_channel_window_read_ex(channel, nullptr, &initial);
+    return initial;
+}
+
 void SSH2Channel::destructor() {
     // close channel and deregister from parent
     AutoLocker al(parent->m);
     if (channel) {
+        // buffered data is sent before the channel is closed; errors cannot be reported here
+        if (!wbuf.empty()) {
+            ExceptionSink xsink;
+            flushUnlocked(DEFAULT_TIMEOUT_MS, &xsink);
+            xsink.clear();
+        }
         parent->channelDeletedUnlocked(this);
         closeUnlocked();
     }
@@ -39,7 +91,7 @@ void SSH2Channel::destructor() {
 
 int SSH2Channel::setenv(const char *name, const char *value, int timeout_ms, ExceptionSink *xsink) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -64,7 +116,7 @@ static QoreString vanilla("vanilla");
 
 int SSH2Channel::requestPty(ExceptionSink *xsink, const QoreString &term, const QoreString &modes, int width, int height, int width_px, int height_px, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -87,7 +139,7 @@ int SSH2Channel::requestPty(ExceptionSink *xsink, const QoreString &term, const
 
 int SSH2Channel::shell(ExceptionSink *xsink, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -118,7 +170,7 @@ bool SSH2Channel::eof(ExceptionSink *xsink) {
 
 int SSH2Channel::waitEof(ExceptionSink *xsink, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -141,7 +193,7 @@ int SSH2Channel::waitEof(ExceptionSink *xsink, int timeout_ms) {
 
 int SSH2Channel::sendEof(ExceptionSink *xsink, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -164,7 +216,7 @@ int SSH2Channel::sendEof(ExceptionSink *xsink, int timeout_ms) {
 
 int SSH2Channel::exec(const char *command, int timeout_ms, ExceptionSink *xsink) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -188,7 +240,7 @@ int SSH2Channel::exec(const char *command, int timeout_ms, ExceptionSink *xsink)
 
 int SSH2Channel::subsystem(const char *command, int timeout_ms, ExceptionSink *xsink) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -212,26 +264,37 @@ int SSH2Channel::subsystem(const char *command, int timeout_ms, ExceptionSink *x
 
 QoreStringNode* SSH2Channel::read(ExceptionSink *xsink, int stream_id, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return 0;
 
     QoreStringNodeHolder str(new QoreStringNode(enc));
 
+    // data read ahead by readUntil() or readLine() is returned first
+    SSH2ReadBuffer* rb = bufferedUnlocked(stream_id);
+    if (rb) {
+        str->concat(rb->data(), rb->size());
+        rb->consume(rb->size());
+    }
+
     BlockingHelper bh(parent);
 
     qore_offset_t rc;
     bool first = true;
     do {
 loop0:
+        if (parent->sendPendingUnlocked(timeout_ms, "SSH2Channel::read", xsink))
+            return 0;
         char buffer[QSSH2_BUFSIZE];
         rc = libssh2_channel_read_ex(channel, stream_id, buffer, QSSH2_BUFSIZE);
         //printd(0, "SSH2Channel::read() rc=%ld (EAGAIN=%d)\n", rc, LIBSSH2_ERROR_EAGAIN);
 
         if (rc > 0) {
             str->concat(buffer, rc);
+            if (receivedUnlocked(rc, QSSH2_BUFSIZE, "SSH2Channel::read", xsink))
+                return 0;
         } else if (rc == LIBSSH2_ERROR_EAGAIN && !str->strlen() && first) {
             first = false;
-            if ((rc = parent->waitSocketUnlocked(xsink, SSH2CHANNEL_TIMEOUT, "SSH2CHANNEL-READ-ERROR", "SSH2Channel::read", timeout_ms)))
+            if ((rc = parent->waitSocketUnlocked(xsink, SSH2CHANNEL_TIMEOUT, "SSH2CHANNEL-READ-ERROR", "SSH2Channel::read", timeout_ms, false, nullptr, false)))
                 return 0;
             goto loop0;
         }
@@ -245,78 +308,100 @@ loop0:
     return str.release();
 }
 
-QoreStringNode *SSH2Channel::read(qore_size_t size, int stream_id, int timeout_ms, ExceptionSink *xsink) {
-    AutoLocker al(parent->m);
-    if (check_open(xsink))
-        return 0;
-
-    QoreStringNodeHolder str(new QoreStringNode(enc));
-
+int SSH2Channel::readBlockUnlocked(char* buf, qore_size_t size, int stream_id, int timeout_ms, const char* meth,
+        ExceptionSink* xsink) {
     BlockingHelper bh(parent);
 
-    qore_offset_t rc;
-    // bytes read
-    qore_size_t b_read = 0;
-    // bytes remaining
-    qore_size_t b_remaining = size;
-    while (true) {
-        char buffer[QSSH2_BUFSIZE];
-        qore_size_t to_read = QSSH2_BUFSIZE < b_remaining ? QSSH2_BUFSIZE : b_remaining;
-        rc = libssh2_channel_read_ex(channel, stream_id, buffer, to_read);
-        //printd(5, "SSH2Channel::read() rc=%ld (EAGAIN=%d) b_read=%lu b_remaining=%lu to_read=%lu, size=%lu\n", rc, LIBSSH2_ERROR_EAGAIN, b_read, b_remaining, to_read, size);
+    // bytes read; data read ahead by readUntil() or readLine() is returned first
+    SSH2ReadBuffer* rb = bufferedUnlocked(stream_id);
+    qore_size_t b_read = rb ? rb->take(buf, size) : 0;
+    while (b_read < size) {
+        if (parent->sendPendingUnlocked(timeout_ms, meth, xsink))
+            return -1;
+        // libssh2 copies the data directly into the caller's buffer
+        qore_offset_t rc = libssh2_channel_read_ex(channel, stream_id, buf + b_read, size - b_read);
+        //printd(5, "SSH2Channel::readBlockUnlocked() rc=%ld (EAGAIN=%d) b_read=%lu size=%lu\n", rc, LIBSSH2_ERROR_EAGAIN, b_read, size);
 
         if (rc > 0) {
-            str->concat(buffer, rc);
+            qore_size_t requested = size - b_read;
             b_read += rc;
-            b_remaining -= rc;
-            if (b_read >= size)
-                break;
+            if (receivedUnlocked(rc, requested, meth, xsink))
+                return -1;
             continue;
         }
 
-        if (!rc || rc == LIBSSH2_ERROR_EAGAIN) {
-            rc = parent->waitSocketUnlocked(timeout_ms);
-            if (!rc) {
-                xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms, read %lu byte%s of %lu requested", timeout_ms, b_read, b_read == 1 ? "" : "s", size);
-                return 0;
-            }
-            if (rc < 0) {
-                xsink->raiseException(SSH2CHANNEL_TIMEOUT, strerror(errno));
-                return 0;
-            }
+        if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
+            parent->doSessionErrUnlocked(xsink);
+            return -1;
+        }
+
+        rc = parent->waitSocketUnlocked(timeout_ms);
+        if (rc == QSSH2_WAIT_CANCELLED) {
+            parent->doCancelUnlocked(xsink, meth, false);
+            return -1;
+        }
+        if (!rc) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms, read %lu byte%s of %lu requested", timeout_ms, b_read, b_read == 1 ? "" : "s", size);
+            return -1;
+        }
+        if (rc < 0) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, strerror(errno));
+            return -1;
         }
     }
 
-    if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
-        parent->doSessionErrUnlocked(xsink);
+    return 0;
+}
+
+QoreStringNode *SSH2Channel::read(qore_size_t size, int stream_id, int timeout_ms, ExceptionSink *xsink) {
+    AutoLocker al(parent->m);
+    if (checkOpenFlush(timeout_ms, xsink))
         return 0;
-    }
+
+    // the final size is known, so the string is allocated once and the data is read directly into it
+    QoreStringNodeHolder str(new QoreStringNode(enc));
+    str->allocate(size + 1);
+
+    if (readBlockUnlocked((char*)str->getBuffer(), size, stream_id, timeout_ms, "SSH2Channel::read", xsink))
+        return 0;
+    str->terminate(size);
 
     return str.release();
 }
 
 BinaryNode *SSH2Channel::readBinary(ExceptionSink *xsink, int stream_id, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return 0;
 
     SimpleRefHolder<BinaryNode> bin(new BinaryNode);
 
+    // data read ahead by readUntil() or readLine() is returned first
+    SSH2ReadBuffer* rb = bufferedUnlocked(stream_id);
+    if (rb) {
+        bin->append(rb->data(), rb->size());
+        rb->consume(rb->size());
+    }
+
     BlockingHelper bh(parent);
 
     qore_offset_t rc;
     bool first = true;
     do {
 loop0:
+        if (parent->sendPendingUnlocked(timeout_ms, "SSH2Channel::readBinary", xsink))
+            return 0;
         char buffer[QSSH2_BUFSIZE];
         rc = libssh2_channel_read_ex(channel, stream_id, buffer, QSSH2_BUFSIZE);
         //printd(5, "SSH2Channel::readBinary() rc=%ld (EAGAIN=%d)\n", rc, LIBSSH2_ERROR_EAGAIN);
 
         if (rc > 0) {
             bin->append(buffer, rc);
+            if (receivedUnlocked(rc, QSSH2_BUFSIZE, "SSH2Channel::readBinary", xsink))
+                return 0;
         } else if (rc == LIBSSH2_ERROR_EAGAIN && !bin->size() && first) {
             first = false;
-            if ((rc = parent->waitSocketUnlocked(xsink, SSH2CHANNEL_TIMEOUT, "SSH2CHANNEL-READBINARY-ERROR", "SSH2Channel::readBinary", timeout_ms)))
+            if ((rc = parent->waitSocketUnlocked(xsink, SSH2CHANNEL_TIMEOUT, "SSH2CHANNEL-READBINARY-ERROR", "SSH2Channel::readBinary", timeout_ms, false, nullptr, false)))
                 return 0;
             goto loop0;
         }
@@ -331,38 +416,66 @@ loop0:
 }
 
 BinaryNode *SSH2Channel::readBinary(qore_size_t size, int stream_id, int timeout_ms, ExceptionSink *xsink) {
+    SimpleRefHolder<BinaryNode> bin(new BinaryNode);
+    if (readBinaryInto(*bin, size, stream_id, timeout_ms, xsink))
+        return 0;
+
+    return bin.release();
+}
+
+int SSH2Channel::readBinaryInto(BinaryNode* bin, qore_size_t size, int stream_id, int timeout_ms, ExceptionSink* xsink) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
+        return -1;
+
+    // sets the size of the object; memory is only reallocated if the size changes
+    if (bin->size() != size && bin->preallocate(size)) {
+        xsink->outOfMemory();
+        return -1;
+    }
+
+    if (readBlockUnlocked((char*)bin->getPtr(), size, stream_id, timeout_ms, "SSH2Channel::readBinary", xsink)) {
+        bin->setSize(0);
+        return -1;
+    }
+
+    return 0;
+}
+
+qore_size_t SSH2Channel::read(ExceptionSink *xsink, void *buffer, qore_size_t size, int stream_id, int timeout_ms) {
+    AutoLocker al(parent->m);
+    if (checkOpenFlush(timeout_ms, xsink))
         return 0;
 
-    SimpleRefHolder<BinaryNode> bin(new BinaryNode);
+    // data read ahead by readUntil() or readLine() is returned first
+    SSH2ReadBuffer* rb = bufferedUnlocked(stream_id);
+    if (rb)
+        return rb->take(buffer, size);
 
     BlockingHelper bh(parent);
 
-    qore_offset_t rc;
-    // bytes read
-    qore_size_t b_read = 0;
-    // bytes remaining
-    qore_size_t b_remaining = size;
     while (true) {
-        char buffer[QSSH2_BUFSIZE];
-        qore_size_t to_read = QSSH2_BUFSIZE < b_remaining ? QSSH2_BUFSIZE : b_remaining;
-        rc = libssh2_channel_read_ex(channel, stream_id, buffer, to_read);
+        qore_offset_t rc = libssh2_channel_read_ex(channel, stream_id, static_cast<char *>(buffer), size);
+
+        if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
+            parent->doSessionErrUnlocked(xsink);
+            return 0;
+        }
 
-        //printd(5, "SSH2Channel::read() rc=%lld (EAGAIN=%d)\n", rc, LIBSSH2_ERROR_EAGAIN);
         if (rc > 0) {
-            bin->append(buffer, rc);
-            b_read += rc;
-            b_remaining -= rc;
-            if (b_read >= size)
-                break;
-            continue;
+            if (receivedUnlocked(rc, size, "SSH2Channel::read", xsink))
+                return 0;
+            return rc;
         }
 
         if (!rc || rc == LIBSSH2_ERROR_EAGAIN) {
             rc = parent->waitSocketUnlocked(timeout_ms);
+            if (rc == QSSH2_WAIT_CANCELLED) {
+                parent->doCancelUnlocked(xsink, "SSH2Channel::read", false);
+                return 0;
+            }
             if (!rc) {
-                xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms reading %lld byte%s of %lld requested", timeout_ms, b_read, b_read == 1 ? "" : "s", size);
+                xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms", timeout_ms);
                 return 0;
             }
             if (rc < 0) {
@@ -371,24 +484,23 @@ BinaryNode *SSH2Channel::readBinary(qore_size_t size, int stream_id, int timeout
             }
         }
     }
-
-    if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
-        parent->doSessionErrUnlocked(xsink);
-        return 0;
-    }
-
-    return bin.release();
 }
 
-qore_size_t SSH2Channel::read(ExceptionSink *xsink, void *buffer, qore_size_t size, int stream_id, int timeout_ms) {
+qore_size_t SSH2Channel::readOrEof(void* buffer, qore_size_t size, int stream_id, int timeout_ms, const char* meth,
+        ExceptionSink* xsink) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return 0;
 
+    // data read ahead by readUntil() or readLine() is returned first
+    SSH2ReadBuffer* rb = bufferedUnlocked(stream_id);
+    if (rb)
+        return rb->take(buffer, size);
+
     BlockingHelper bh(parent);
 
     while (true) {
-        qore_offset_t rc = libssh2_channel_read_ex(channel, stream_id, static_cast<char *>(buffer), size);
+        qore_offset_t rc = libssh2_channel_read_ex(channel, stream_id, static_cast<char*>(buffer), size);
 
         if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
             parent->doSessionErrUnlocked(xsink);
@@ -396,43 +508,188 @@ qore_size_t SSH2Channel::read(ExceptionSink *xsink, void *buffer, qore_size_t si
         }
 
         if (rc > 0) {
+            if (receivedUnlocked(rc, size, meth, xsink))
+                return 0;
             return rc;
         }
 
-        if (!rc || rc == LIBSSH2_ERROR_EAGAIN) {
-            rc = parent->waitSocketUnlocked(timeout_ms);
-            if (!rc) {
-                xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms", timeout_ms);
-                return 0;
-            }
-            if (rc < 0) {
-                xsink->raiseException(SSH2CHANNEL_TIMEOUT, strerror(errno));
-                return 0;
-            }
+        // the channel only reports EOF once all data received has been read
+        if (libssh2_channel_eof(channel))
+            return 0;
+
+        rc = parent->waitSocketUnlocked(timeout_ms);
+        if (rc == QSSH2_WAIT_CANCELLED) {
+            parent->doCancelUnlocked(xsink, meth, false);
+            return 0;
+        }
+        if (!rc) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms", timeout_ms);
+            return 0;
+        }
+        if (rc < 0) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, strerror(errno));
+            return 0;
+        }
+    }
+}
+
+QoreStringNode* SSH2Channel::readDelimited(const char* delim, size_t dlen, bool include_delim, bool line,
+        int stream_id, int timeout_ms, const char* meth, const char* err, ExceptionSink* xsink) {
+    assert(dlen);
+    AutoLocker al(parent->m);
+    if (checkOpenFlush(timeout_ms, xsink))
+        return nullptr;
+
+    SSH2ReadBuffer& rb = rbufs[stream_id];
+
+    BlockingHelper bh(parent);
+
+    // the number of bytes at the front of the buffer already searched for the delimiter
+    size_t scanned = 0;
+    int64 pos;
+    while ((pos = rb.find(delim, dlen, scanned)) < 0) {
+        if (rb.size() >= QSSH2_MAX_DELIMITED) {
+            xsink->raiseException(err, "no delimiter found in %lu bytes of data read", rb.size());
+            return nullptr;
+        }
+        // the end of the buffer could hold the start of the delimiter, so it is searched again
+        scanned = rb.size() >= dlen ? rb.size() - dlen + 1 : 0;
+
+        if (parent->sendPendingUnlocked(timeout_ms, meth, xsink))
+            return nullptr;
+        qore_offset_t rc = libssh2_channel_read_ex(channel, stream_id, rb.space(QSSH2_BUFSIZE), QSSH2_BUFSIZE);
+        if (rc > 0) {
+            rb.commit(rc);
+            if (receivedUnlocked(rc, QSSH2_BUFSIZE, meth, xsink))
+                return nullptr;
+            continue;
+        }
+
+        if (rc < 0 && rc != LIBSSH2_ERROR_EAGAIN) {
+            parent->doSessionErrUnlocked(xsink);
+            return nullptr;
+        }
+
+        // the channel only reports EOF once all data received has been read
+        if (libssh2_channel_eof(channel)) {
+            if (rb.empty())
+                return nullptr;
+            break;
+        }
+
+        rc = parent->waitSocketUnlocked(timeout_ms);
+        if (rc == QSSH2_WAIT_CANCELLED) {
+            parent->doCancelUnlocked(xsink, meth, false);
+            return nullptr;
+        }
+        if (!rc) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, "read timeout after %dms", timeout_ms);
+            return nullptr;
+        }
+        if (rc < 0) {
+            xsink->raiseException(SSH2CHANNEL_TIMEOUT, strerror(errno));
+            return nullptr;
         }
     }
+
+    // at EOF, the remaining data is returned without a delimiter
+    size_t consumed = pos < 0 ? rb.size() : (size_t)pos + dlen;
+    size_t len = pos < 0 || include_delim ? consumed : (size_t)pos;
+    if (line && len && !include_delim && rb.data()[len - 1] == '\r')
+        --len;
+
+    QoreStringNode* str = new QoreStringNode(rb.data(), len, enc);
+    rb.consume(consumed);
+    return str;
+}
+
+int64 SSH2Channel::readToStream(OutputStream* os, int stream_id, int timeout_ms, ExceptionSink* xsink) {
+    // only one buffer of data is held in memory at a time
+    std::unique_ptr<char[]> buffer(new char[QSSH2_BUFSIZE]);
+
+    int64 total = 0;
+    while (true) {
+        qore_size_t rc = readOrEof(buffer.get(), QSSH2_BUFSIZE, stream_id, timeout_ms, "SSH2Channel::readToStream",
+            xsink);
+        if (*xsink)
+            return -1;
+        if (!rc)
+            break;
+
+        // the stream is written without the client lock held, so writing to a slow stream does not block other
+        // operations on the client
+        os->write(buffer.get(), rc, xsink);
+        if (*xsink)
+            return -1;
+        total += rc;
+    }
+
+    return total;
 }
 
 qore_size_t SSH2Channel::write(ExceptionSink *xsink, const void *buf, qore_size_t buflen, int stream_id, int timeout_ms) {
     assert(buflen);
 
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (check_open(xsink) || checkFlushErrorUnlocked(xsink))
         return -1;
 
-    BlockingHelper bh(parent);
+    if (!wbuf_size) {
+        BlockingHelper bh(parent);
+        return writeUnlocked(static_cast<const char*>(buf), buflen, stream_id, timeout_ms, xsink) ? -1 : buflen;
+    }
+
+    // data for different streams cannot be sent in the same packet
+    if (!wbuf.empty() && wbuf_stream != stream_id && flushUnlocked(timeout_ms, xsink))
+        return -1;
+
+    const char* p = static_cast<const char*>(buf);
+    size_t left = buflen;
+    while (left) {
+        // data that would fill the buffer by itself is sent directly without being copied
+        if (wbuf.empty() && left >= wbuf_size) {
+            BlockingHelper bh(parent);
+            if (writeUnlocked(p, left, stream_id, timeout_ms, xsink))
+                return -1;
+            break;
+        }
+
+        if (wbuf.empty()) {
+            wbuf_stream = stream_id;
+            wbuf_start = q_clock_getmillis();
+        }
 
-    qore_size_t b_sent = 0;
+        size_t n = left < wbuf_size - wbuf.size() ? left : wbuf_size - wbuf.size();
+        wbuf.append(p, n);
+        p += n;
+        left -= n;
+        if (wbuf.size() >= wbuf_size && flushUnlocked(timeout_ms, xsink))
+            return -1;
+    }
+
+    ++wbuf_writes;
+    if (!wbuf.empty() && wbuf_delay_ms)
+        parent->scheduleFlushUnlocked(this);
+    return buflen;
+}
+
+int SSH2Channel::writeUnlocked(const char* buf, size_t buflen, int stream_id, int timeout_ms,
+        ExceptionSink* xsink) {
+    size_t b_sent = 0;
     while (true) {
         qore_offset_t rc;
         while (true) {
-            rc = libssh2_channel_write_ex(channel, stream_id, (char *)buf + b_sent, buflen - b_sent);
-            //printd(5, "SSH2Channel::write(len=%lu) buf=%p buflen=%lu stream_id=%d timeout_ms=%d rc=%ld b_sent=%lu\n", buflen - b_sent, buf, buflen, stream_id, timeout_ms, rc, b_sent);
+            rc = libssh2_channel_write_ex(channel, stream_id, buf + b_sent, buflen - b_sent);
+            //printd(5, "SSH2Channel::writeUnlocked(len=%lu) buf=%p buflen=%lu stream_id=%d timeout_ms=%d rc=%ld b_sent=%lu\n", buflen - b_sent, buf, buflen, stream_id, timeout_ms, rc, b_sent);
 
             if (rc && rc != LIBSSH2_ERROR_EAGAIN)
                 break;
 
             rc = parent->waitSocketUnlocked(timeout_ms);
+            if (rc == QSSH2_WAIT_CANCELLED) {
+                parent->doCancelUnlocked(xsink, "SSH2Channel::write", false);
+                return -1;
+            }
             if (!rc) {
                 xsink->raiseException(SSH2CHANNEL_TIMEOUT, "write timeout after %dms writing %lu byte%s of %lu", timeout_ms, b_sent, b_sent == 1 ? "" : "s", buflen);
                 return -1;
@@ -443,20 +700,148 @@ qore_size_t SSH2Channel::write(ExceptionSink *xsink, const void *buf, qore_size_
             }
         }
 
-        if (rc < 0)
-        parent->doSessionErrUnlocked(xsink);
+        if (rc < 0) {
+            parent->doSessionErrUnlocked(xsink);
+            return -1;
+        }
 
         b_sent += rc;
+        if (parent->throttleUnlocked(false, rc, "SSH2Channel::write", xsink))
+            return -1;
         if (b_sent >= buflen)
             break;
     }
 
-    return b_sent;
+    return 0;
+}
+
+int SSH2Channel::flushUnlocked(int timeout_ms, ExceptionSink* xsink) {
+    if (wbuf.empty())
+        return 0;
+
+    BlockingHelper bh(parent);
+    // completing a packet partially sent by the flusher removes its data from the buffer
+    if (checkFlushErrorUnlocked(xsink))
+        return -1;
+    if (wbuf.empty())
+        return 0;
+    // if the packet is still pending, the write below completes it first, as libssh2 resumes the packet prepared for
+    // the channel, and its data is still at the start of the buffer
+    if (parent->pending_write == this) {
+        parent->pending_channel = nullptr;
+        parent->pending_write = nullptr;
+    }
+    int rc = writeUnlocked(wbuf.data(), wbuf.size(), wbuf_stream, timeout_ms, xsink);
+    ++wbuf_flushes;
+    // the buffer is also cleared after an error, as the amount of data sent is not known; its memory is kept for
+    // the next writes
+    wbuf.clear();
+    return rc;
+}
+
+int SSH2Channel::bufferSentUnlocked(ssize_t rc) {
+    if (rc < 0) {
+        parent->doSessionErrUnlocked(&wbuf_err, "SSH2Channel::write(): failed to send buffered data");
+        // the amount of data sent is not known, so the buffer is cleared as in flushUnlocked()
+        wbuf.clear();
+        return -1;
+    }
+
+    wbuf.erase(0, rc);
+    if (wbuf.empty())
+        ++wbuf_flushes;
+    // the flusher cannot wait for the bandwidth limits with the lock held, so the next send is delayed instead
+    int64 us = parent->throttleDelay(false, rc);
+    if (!us)
+        return 0;
+    wbuf_retry = q_clock_getmillis() + (us + 999) / 1000;
+    return 1;
+}
+
+int SSH2Channel::trySendBufferUnlocked() {
+    // a packet partially sent by the flusher or by another operation must be completed first
+    int rc = parent->trySendPendingUnlocked();
+    if (rc > 0) {
+        wbuf_retry = q_clock_getmillis() + QSSH2_FLUSH_RETRY_MS;
+        return 1;
+    }
+
+    while (!wbuf.empty()) {
+        ssize_t wrc = libssh2_channel_write_ex(channel, wbuf_stream, wbuf.data(), wbuf.size());
+        if (!wrc || wrc == LIBSSH2_ERROR_EAGAIN) {
+            // a partially-sent packet is completed by the next operation on the session or by the next try, so the
+            // lock is not held while waiting for the network
+            if (libssh2_session_block_directions(parent->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
+                parent->pending_channel = channel;
+                parent->pending_write = this;
+            }
+            wbuf_retry = q_clock_getmillis() + QSSH2_FLUSH_RETRY_MS;
+            return 1;
+        }
+        if ((rc = bufferSentUnlocked(wrc)))
+            return rc;
+    }
+    return 0;
+}
+
+int SSH2Channel::resumeWriteUnlocked() {
+    // libssh2 completes the packet already prepared
+    ssize_t rc = libssh2_channel_write_ex(channel, wbuf_stream, wbuf.data(), wbuf.size());
+    if (rc == LIBSSH2_ERROR_EAGAIN)
+        return LIBSSH2_ERROR_EAGAIN;
+    return bufferSentUnlocked(rc) < 0 ? -1 : 0;
+}
+
+int SSH2Channel::flush(int timeout_ms, ExceptionSink* xsink) {
+    AutoLocker al(parent->m);
+    return checkOpenFlush(timeout_ms, xsink);
+}
+
+int SSH2Channel::setWriteBuffer(int64 size, int delay_ms, int timeout_ms, ExceptionSink* xsink) {
+    static const char* SSH2CHANNEL_SETWRITEBUFFER_ERROR = "SSH2CHANNEL-SETWRITEBUFFER-ERROR";
+
+    if (size < 0 || size > QSSH2_MAX_WRITE_BUFFER) {
+        xsink->raiseException(SSH2CHANNEL_SETWRITEBUFFER_ERROR, "invalid write buffer size " QLLD "; expecting a "
+            "value from 0 to %d", size, QSSH2_MAX_WRITE_BUFFER);
+        return -1;
+    }
+    if (delay_ms < 0) {
+        xsink->raiseException(SSH2CHANNEL_SETWRITEBUFFER_ERROR, "invalid delay %dms; expecting a non-negative value",
+            delay_ms);
+        return -1;
+    }
+
+    AutoLocker al(parent->m);
+    // any data already buffered is sent with the previous settings
+    if (checkOpenFlush(timeout_ms, xsink))
+        return -1;
+
+    wbuf_size = size;
+    wbuf_delay_ms = size ? delay_ms : 0;
+    if (size) {
+        wbuf.reserve(size);
+    } else {
+        std::string().swap(wbuf);
+    }
+
+    return 0;
+}
+
+QoreHashNode* SSH2Channel::getWriteBufferInfo(ExceptionSink* xsink) {
+    AutoLocker al(parent->m);
+
+    QoreHashNode* h = new QoreHashNode(hashdeclSsh2WriteBufferInfo, xsink);
+    h->setKeyValue("size", (int64)wbuf_size, xsink);
+    h->setKeyValue("delay", (int64)wbuf_delay_ms, xsink);
+    h->setKeyValue("buffered", (int64)wbuf.size(), xsink);
+    h->setKeyValue("writes", wbuf_writes, xsink);
+    h->setKeyValue("flushes", wbuf_flushes, xsink);
+    return h;
 }
 
 int SSH2Channel::close(ExceptionSink *xsink, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -479,7 +864,7 @@ int SSH2Channel::close(ExceptionSink *xsink, int timeout_ms) {
 
 int SSH2Channel::waitClosed(ExceptionSink *xsink, int timeout_ms) {
     AutoLocker al(parent->m);
-    if (check_open(xsink))
+    if (checkOpenFlush(timeout_ms, xsink))
         return -1;
 
     BlockingHelper bh(parent);
@@ -510,7 +895,7 @@ int SSH2Channel::getExitStatus(ExceptionSink *xsink) {
 
 int SSH2Channel::requestX11Forwarding(ExceptionSink *xsink, int screen_number, bool single_connection, const char *auth_proto, const char *auth_cookie, int timeout_ms) {
    AutoLocker al(parent->m);
-   if (check_open(xsink))
+   if (checkOpenFlush(timeout_ms, xsink))
       return -1;
 
    BlockingHelper bh(parent);
@@ -533,7 +918,7 @@ int SSH2Channel::requestX11Forwarding(ExceptionSink *xsink, int screen_number, b
 
 int SSH2Channel::extendedDataNormal(ExceptionSink *xsink, int timeout_ms) {
    AutoLocker al(parent->m);
-   if (check_open(xsink))
+   if (checkOpenFlush(timeout_ms, xsink))
       return -1;
 
    int rc;
@@ -553,7 +938,7 @@ int SSH2Channel::extendedDataNormal(ExceptionSink *xsink, int timeout_ms) {
 
 int SSH2Channel::extendedDataMerge(ExceptionSink *xsink, int timeout_ms) {
    AutoLocker al(parent->m);
-   if (check_open(xsink))
+   if (checkOpenFlush(timeout_ms, xsink))
       return -1;
 
    int rc;
@@ -573,7 +958,7 @@ int SSH2Channel::extendedDataMerge(ExceptionSink *xsink, int timeout_ms) {
 
 int SSH2Channel::extendedDataIgnore(ExceptionSink *xsink, int timeout_ms) {
    AutoLocker al(parent->m);
-   if (check_open(xsink))
+   if (checkOpenFlush(timeout_ms, xsink))
       return -1;
 
    int rc;
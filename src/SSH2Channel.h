@@ -28,9 +28,20 @@
 #define _QORE_SSH2CHANNEL_H
 
 #include "ssh2.h"
+#include "SSH2ReadBuffer.h"
 
 #include <qore/Qore.h>
 
+#include <map>
+#include <string>
+
+// the maximum amount of data buffered while searching for a delimiter
+#define QSSH2_MAX_DELIMITED (16 * 1024 * 1024)
+// the maximum size of the write buffer of a channel
+#define QSSH2_MAX_WRITE_BUFFER (1024 * 1024)
+// the interval after which the flusher tries again to send buffered data that could not be sent without blocking
+#define QSSH2_FLUSH_RETRY_MS 5
+
 DLLLOCAL extern qore_classid_t CID_SSH2CHANNEL;
 DLLLOCAL extern QoreClass* QC_SSH2CHANNEL;
 
@@ -45,11 +56,36 @@ protected:
     LIBSSH2_CHANNEL* channel;
     SSH2Client* parent;
     const QoreEncoding* enc;
+    // data read ahead by readUntil() and readLine() by stream ID; buffered data is returned by all read methods
+    // before any more data is read from the channel
+    std::map<int, SSH2ReadBuffer> rbufs;
+    // the receive window maintained for the channel in bytes; 0 = the window is maintained by libssh2 alone
+    uint32_t window = 0;
+    // the size that the receive window is grown to when the window limits a transfer
+    uint32_t max_window = 0;
 
-    void closeUnlocked() {
-        libssh2_channel_free(channel);
-        channel = nullptr;
-    }
+    // data written and not yet sent to the server; small writes are collected here and sent together when the
+    // buffer is full, when the delay has passed, or before any other operation on the channel
+    std::string wbuf;
+    // the stream ID of the data in the write buffer
+    int wbuf_stream = 0;
+    // the size of the write buffer; 0 = writes are not buffered
+    size_t wbuf_size = 0;
+    // the maximum time data is kept in the write buffer; 0 = no limit
+    int wbuf_delay_ms = 0;
+    // the time the oldest data in the write buffer was written
+    int64 wbuf_start = 0;
+    // the time before which the flusher does not try again to send the buffer after a send would have blocked or
+    // after a send was delayed by the bandwidth limits
+    int64 wbuf_retry = 0;
+    // an error sending the buffer in the background, raised by the next operation on the channel
+    ExceptionSink wbuf_err;
+    // the number of buffered writes and the number of times the buffer has been sent
+    int64 wbuf_writes = 0;
+    int64 wbuf_flushes = 0;
+
+    // frees the channel; the client lock must be held
+    DLLLOCAL void closeUnlocked();
 
     int check_open(ExceptionSink* xsink) {
         if (channel)
@@ -59,6 +95,79 @@ protected:
         return -1;
     }
 
+    // called after data has been read from the channel with a read of "requested" bytes; keeps the receive window
+    // open and applies the bandwidth limits; the client lock must be held; returns -1 if an exception was raised
+    DLLLOCAL int receivedUnlocked(size_t bytes, size_t requested, const char* meth, ExceptionSink* xsink);
+
+    // reads up to "size" bytes, waiting for data if none is available; returns 0 at EOF or if an exception was raised
+    DLLLOCAL qore_size_t readOrEof(void* buf, qore_size_t size, int stream_id, int timeout_ms, const char* meth,
+            ExceptionSink* xsink);
+
+    // reads exactly "size" bytes directly into the buffer; the client lock must be held; returns -1 if an exception
+    // was raised
+    DLLLOCAL int readBlockUnlocked(char* buf, qore_size_t size, int stream_id, int timeout_ms, const char* meth,
+            ExceptionSink* xsink);
+
+    // returns the read-ahead buffer for the stream if it holds any data; the client lock must be held
+    DLLLOCAL SSH2ReadBuffer* bufferedUnlocked(int stream_id) {
+        std::map<int, SSH2ReadBuffer>::iterator i = rbufs.find(stream_id);
+        return i != rbufs.end() && !i->second.empty() ? &i->second : nullptr;
+    }
+
+    // checks that the channel is open and sends any buffered data before another operation on the channel; the
+    // client lock must be held; returns -1 if an exception was raised
+    DLLLOCAL int checkOpenFlush(int timeout_ms, ExceptionSink* xsink) {
+        if (check_open(xsink) || checkFlushErrorUnlocked(xsink))
+            return -1;
+        return wbuf.empty() ? 0 : flushUnlocked(timeout_ms, xsink);
+    }
+
+    // raises an error from sending the buffer in the background; the client lock must be held; returns -1 if an
+    // exception was raised
+    DLLLOCAL int checkFlushErrorUnlocked(ExceptionSink* xsink) {
+        if (!wbuf_err)
+            return 0;
+        xsink->assimilate(wbuf_err);
+        return -1;
+    }
+
+    // sends the write buffer; the client lock must be held; returns -1 if an exception was raised
+    DLLLOCAL int flushUnlocked(int timeout_ms, ExceptionSink* xsink);
+
+    // processes the result of a send of the write buffer made by the flusher; returns 1 if the next send must wait
+    // for the bandwidth limits, 0 if it can follow immediately, or -1 if the send failed
+    DLLLOCAL int bufferSentUnlocked(ssize_t rc);
+
+    // returns the number of milliseconds until the flusher must send the write buffer, 0 if it is due, or -1 if there
+    // is nothing to send; the client lock must be held
+    DLLLOCAL int64 flushDueUnlocked(int64 now) const {
+        if (wbuf.empty() || !channel || !wbuf_delay_ms)
+            return -1;
+        int64 due = wbuf_start + wbuf_delay_ms;
+        if (wbuf_retry > due)
+            due = wbuf_retry;
+        return due > now ? due - now : 0;
+    }
+
+    // sends as much of the write buffer as possible without blocking; called by the flusher with the client lock
+    // held and the session in non-blocking mode; returns 1 if data remains to be sent, 0 if the buffer was sent, or
+    // -1 if the send failed, in which case the error is raised by the next operation on the channel
+    DLLLOCAL int trySendBufferUnlocked();
+
+    // repeats a partially-sent write of the buffer made by the flusher; the client lock must be held and the session
+    // must be in non-blocking mode; returns LIBSSH2_ERROR_EAGAIN if the packet is still pending, 0 if it was sent,
+    // or -1 if the send failed
+    DLLLOCAL int resumeWriteUnlocked();
+
+    // writes all data to the channel; the client lock must be held and the session must be in non-blocking mode;
+    // returns -1 if an exception was raised
+    DLLLOCAL int writeUnlocked(const char* buf, size_t buflen, int stream_id, int timeout_ms, ExceptionSink* xsink);
+
+    // returns the data up to the delimiter or up to EOF if the delimiter is not found; returns nullptr at EOF if no
+    // data remains or if an exception was raised
+    DLLLOCAL QoreStringNode* readDelimited(const char* delim, size_t dlen, bool include_delim, bool line, int stream_id,
+            int timeout_ms, const char* meth, const char* err, ExceptionSink* xsink);
+
 public:
     // channel is already registered with parent when it's created
     DLLLOCAL SSH2Channel(LIBSSH2_CHANNEL *n_channel, SSH2Client *n_parent) : channel(n_channel), parent(n_parent), enc(QCS_DEFAULT) {
@@ -71,6 +180,8 @@ public:
 
         // channel must be closed before object is destroyed
         assert(!channel);
+        // an error from a background flush that was never reported is discarded
+        wbuf_err.clear();
     }
 
     DLLLOCAL void destructor();
@@ -83,6 +194,21 @@ public:
         return enc;
     }
 
+    // sets the receive window maintained for the channel; 0 = the window is maintained by libssh2 alone
+    DLLLOCAL void setWindow(uint32_t n_window, uint32_t n_max_window) {
+        window = n_window;
+        max_window = n_max_window > n_window ? n_max_window : n_window;
+    }
+
+    // adjusts the receive window of a channel after a read; "drained" is true if the read returned all data
+    // available; the window is grown up to "max_window" if it limits the transfer; the client lock must be held;
+    // returns LIBSSH2_ERROR_EAGAIN if the adjustment could not be sent completely, in which case
+    // libssh2_channel_receive_window_adjust2() must be called again before anything else is sent on the session
+    DLLLOCAL static int adjustWindow(LIBSSH2_CHANNEL* channel, uint32_t& window, uint32_t max_window, bool drained);
+
+    // returns the current receive window size of the channel; returns -1 if an exception was raised
+    DLLLOCAL int64 getWindowSize(ExceptionSink* xsink);
+
     DLLLOCAL int setenv(const char* name, const char* value, int timeout_ms, ExceptionSink* xsink);
     DLLLOCAL int requestPty(ExceptionSink* xsink, const QoreString& term, const QoreString& modes, int width = LIBSSH2_TERM_WIDTH,
                 int height = LIBSSH2_TERM_HEIGHT, int width_px = LIBSSH2_TERM_WIDTH_PX,
@@ -99,8 +225,32 @@ public:
     DLLLOCAL BinaryNode *readBinary(ExceptionSink* xsink, int stream_id, int timeout_ms = DEFAULT_TIMEOUT_MS);
     // read a block of a particular size, timeout_ms mandatory
     DLLLOCAL BinaryNode *readBinary(qore_size_t size, int stream_id, int timeout_ms, ExceptionSink* xsink);
+    // reads a block of a particular size into an existing binary object, reusing its memory; the object is resized to
+    // the block size; returns -1 if an exception was raised
+    DLLLOCAL int readBinaryInto(BinaryNode* bin, qore_size_t size, int stream_id, int timeout_ms, ExceptionSink* xsink);
     DLLLOCAL qore_size_t read(ExceptionSink* xsink, void *buf, qore_size_t size, int stream_id = 0, int timeout_ms = -1);
+    // reads up to and optionally including the delimiter; returns nullptr at EOF or if an exception was raised
+    DLLLOCAL QoreStringNode* readUntil(const char* delim, size_t dlen, bool include_delim, int stream_id, int timeout_ms,
+            ExceptionSink* xsink) {
+        return readDelimited(delim, dlen, include_delim, false, stream_id, timeout_ms, "SSH2Channel::readUntil",
+            "SSH2CHANNEL-READUNTIL-ERROR", xsink);
+    }
+    // reads a line without the end of line characters; returns nullptr at EOF or if an exception was raised
+    DLLLOCAL QoreStringNode* readLine(int stream_id, int timeout_ms, ExceptionSink* xsink) {
+        return readDelimited("\n", 1, false, true, stream_id, timeout_ms, "SSH2Channel::readLine",
+            "SSH2CHANNEL-READLINE-ERROR", xsink);
+    }
+    // reads the stream until EOF and writes the data to the output stream without the client lock held; returns the
+    // number of bytes written or -1 if an exception was raised
+    DLLLOCAL int64 readToStream(OutputStream* os, int stream_id, int timeout_ms, ExceptionSink* xsink);
     DLLLOCAL qore_size_t write(ExceptionSink* xsink, const void *buf, qore_size_t buflen, int stream_id = 0, int timeout_ms = -1);
+    // sets the size of the write buffer and the maximum time data is kept in the buffer; a size of 0 disables
+    // buffering; any data already buffered is sent first; returns -1 if an exception was raised
+    DLLLOCAL int setWriteBuffer(int64 size, int delay_ms, int timeout_ms, ExceptionSink* xsink);
+    // sends any buffered data; returns -1 if an exception was raised
+    DLLLOCAL int flush(int timeout_ms, ExceptionSink* xsink);
+    // returns a hash<Ssh2WriteBufferInfo>
+    DLLLOCAL QoreHashNode* getWriteBufferInfo(ExceptionSink* xsink);
     DLLLOCAL int close(ExceptionSink* xsink, int timeout_ms = -1);
     DLLLOCAL int waitClosed(ExceptionSink* xsink, int timeout_ms = -1);
     DLLLOCAL int getExitStatus(ExceptionSink* xsink);
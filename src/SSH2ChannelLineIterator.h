@@ -0,0 +1,114 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2ChannelLineIterator.h
+
+    iterates the lines read from a channel stream
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2CHANNELLINEITERATOR_H
+
+#define _QORE_SSH2CHANNELLINEITERATOR_H
+
+#include "SSH2Channel.h"
+
+#include <qore/Qore.h>
+
+DLLLOCAL extern qore_classid_t CID_SSH2CHANNELLINEITERATOR;
+DLLLOCAL extern QoreClass* QC_SSH2CHANNELLINEITERATOR;
+
+DLLLOCAL QoreClass* initSSH2ChannelLineIteratorClass(QoreNamespace& ns);
+
+// iterates the lines of a channel stream as they are received; only the current line is held as a Qore value
+class SSH2ChannelLineIterator : public QoreIteratorBase {
+public:
+    DLLLOCAL SSH2ChannelLineIterator(SSH2Channel* chan, int stream_id, int timeout_ms) : chan(chan),
+            stream_id(stream_id), timeout_ms(timeout_ms) {
+        chan->ref();
+    }
+
+    DLLLOCAL bool next(ExceptionSink* xsink) {
+        clearLine();
+        if (done)
+            return false;
+        line = chan->readLine(stream_id, timeout_ms, xsink);
+        if (!line) {
+            done = true;
+            return false;
+        }
+        return true;
+    }
+
+    DLLLOCAL QoreStringNode* getValue(ExceptionSink* xsink) const {
+        if (!line) {
+            xsink->raiseException("INVALID-ITERATOR", "the %s is not pointing at a valid element; make sure "
+                "%s::next() returns True before calling this method", getName(), getName());
+            return nullptr;
+        }
+        return line->stringRefSelf();
+    }
+
+    DLLLOCAL bool valid() const {
+        return line != nullptr;
+    }
+
+    DLLLOCAL int getStreamId() const {
+        return stream_id;
+    }
+
+    DLLLOCAL virtual void deref(ExceptionSink* xsink) {
+        if (ROdereference()) {
+            clearLine();
+            chan->deref(xsink);
+            delete this;
+        }
+    }
+
+    DLLLOCAL virtual const char* getName() const {
+        return "SSH2ChannelLineIterator";
+    }
+
+    DLLLOCAL virtual const QoreTypeInfo* getElementType() const {
+        return stringTypeInfo;
+    }
+
+protected:
+    DLLLOCAL virtual ~SSH2ChannelLineIterator() {
+        assert(!line);
+    }
+
+private:
+    SSH2Channel* chan;
+    int stream_id;
+    int timeout_ms;
+    // the current line
+    QoreStringNode* line = nullptr;
+    // true once the end of the stream has been reached or an error occurred
+    bool done = false;
+
+    DLLLOCAL void clearLine() {
+        if (line) {
+            line->deref();
+            line = nullptr;
+        }
+    }
+};
+
+#endif // _QORE_SSH2CHANNELLINEITERATOR_H
@@ -24,7 +24,9 @@
 
 #include "SSH2Client.h"
 #include "SSH2Channel.h"
+#include "SSH2Relay.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <map>
@@ -39,11 +41,23 @@
 
 #include <assert.h>
 #include <unistd.h>
+#ifndef _Q_WINDOWS
+#include <poll.h>
+#endif
 
 static const char *SSH2CLIENT_TIMEOUT = "SSH2CLIENT-TIMEOUT";
 static const char *SSH2CLIENT_NOT_CONNECTED = "SSH2CLIENT-NOT-CONNECTED";
 const char *SSH2_ERROR = "SSH2-ERROR";
 const char *SSH2_CONNECTED = "SSH2-CONNECTED";
+const char *SSH2_CANCELLED = "SSH2-CANCELLED";
+
+SSH2RateLimiter ssh2_global_rate_in;
+SSH2RateLimiter ssh2_global_rate_out;
+
+#ifdef _Q_WINDOWS
+// the interval for checking for cancellation while waiting on the socket
+#define QSSH2_CANCEL_POLL_MS 100
+#endif
 
 std::string mode2str(const int mode) {
     std::string ret=std::string("----------");
@@ -112,7 +126,8 @@ static void map_ssh2_sbuf_to_hash(QoreHashNode *h, struct stat *sbuf, ExceptionS
  *
  * this just prefills the values for connection with hostname and port
  */
-SSH2Client::SSH2Client(const char *hostname, const uint32_t port) : sshhost(hostname), sshport(port), sshauthenticatedwith(0), ssh_session(0) {
+SSH2Client::SSH2Client(const char *hostname, const uint32_t port) : sshhost(hostname), sshport(port), sshauthenticatedwith(0),
+        rate_recv(new SSH2RateLimiter), rate_send(new SSH2RateLimiter), ssh_session(0) {
     setKeysIntern();
 }
 
@@ -122,6 +137,8 @@ SSH2Client::SSH2Client(QoreURL &url, const uint32_t port) :
     sshpass(url.getPassword() ? url.getPassword()->getBuffer() : ""),
     sshport(port ? port : (uint32_t)url.getPort()),
     sshauthenticatedwith(0),
+    rate_recv(new SSH2RateLimiter),
+    rate_send(new SSH2RateLimiter),
     ssh_session(0) {
     if (!sshport)
         sshport = DEFAULT_SSH_PORT;
@@ -129,6 +146,20 @@ SSH2Client::SSH2Client(QoreURL &url, const uint32_t port) :
     setKeysIntern();
 }
 
+SSH2Client::SSH2Client(const SSH2Client& old) : sshport(0), sshauthenticatedwith(0), rate_recv(old.rate_recv),
+        rate_send(old.rate_send), ssh_session(0) {
+    AutoLocker al(old.m);
+    sshhost = old.sshhost;
+    sshuser = old.sshuser;
+    sshpass = old.sshpass;
+    sshkeys_pub = old.sshkeys_pub;
+    sshkeys_priv = old.sshkeys_priv;
+    sshport = old.sshport;
+    chan_window = old.chan_window;
+    chan_max_window = old.chan_max_window;
+    chan_packet = old.chan_packet;
+}
+
 /*
  * close session/connection
  * free resources
@@ -139,6 +170,11 @@ SSH2Client::~SSH2Client() {
 
     // disconnect
     disconnectUnlocked(true);
+
+    if (cancel_pipe[0] != -1) {
+        ::close(cancel_pipe[0]);
+        ::close(cancel_pipe[1]);
+    }
 }
 
 void SSH2Client::setKeysIntern() {
@@ -186,6 +222,11 @@ void SSH2Client::setKeysIntern() {
  * sets errno
  */
 int SSH2Client::disconnectUnlocked(bool force, int timeout_ms, AbstractDisconnectionHelper* adh, ExceptionSink *xsink) {
+    // stop all port forwarding relays; their channels are freed with the session
+    for (relay_set_t::iterator i = relay_set.begin(), e = relay_set.end(); i != e; ++i) {
+        (*i)->sessionClosedUnlocked();
+    }
+
     // first close all open channels
     for (channel_set_t::iterator i = channel_set.begin(), e = channel_set.end(); i != e; ++i) {
         (*i)->closeUnlocked();
@@ -216,6 +257,8 @@ int SSH2Client::disconnectUnlocked(bool force, int timeout_ms, AbstractDisconnec
         }
 
         ssh_session = 0;
+        pending_channel = nullptr;
+        pending_write = nullptr;
     }
 
     if (sshauthenticatedwith)
@@ -244,10 +287,46 @@ QoreObject* SSH2Client::registerChannelUnlocked(LIBSSH2_CHANNEL *channel) {
 
 SSH2Channel* SSH2Client::registerChannelUnlockedRaw(LIBSSH2_CHANNEL *channel) {
     SSH2Channel* chan = new SSH2Channel(channel, this);
+    chan->setWindow(chan_window, chan_max_window);
     channel_set.insert(chan);
     return chan;
 }
 
+int SSH2Client::setChannelWindow(int64 window, int64 max_window, int64 packet, ExceptionSink* xsink) {
+    static const char* SSH2CLIENT_SETCHANNELWINDOW_ERROR = "SSH2CLIENT-SETCHANNELWINDOW-ERROR";
+
+    if (window < 0 || window > QSSH2_MAX_WINDOW || (window && window < QSSH2_BUFSIZE)) {
+        xsink->raiseException(SSH2CLIENT_SETCHANNELWINDOW_ERROR, "invalid window size " QLLD "; expecting 0 or a "
+            "value from %d to %d", window, QSSH2_BUFSIZE, QSSH2_MAX_WINDOW);
+        return -1;
+    }
+    if (max_window && (!window || max_window < window || max_window > QSSH2_MAX_WINDOW)) {
+        xsink->raiseException(SSH2CLIENT_SETCHANNELWINDOW_ERROR, "invalid maximum window size " QLLD "; expecting 0 "
+            "or a value from the window size (" QLLD ") to %d", max_window, window, QSSH2_MAX_WINDOW);
+        return -1;
+    }
+    if (packet < 0 || packet > QSSH2_MAX_PACKET) {
+        xsink->raiseException(SSH2CLIENT_SETCHANNELWINDOW_ERROR, "invalid packet size " QLLD "; expecting a value "
+            "from 0 to %d", packet, QSSH2_MAX_PACKET);
+        return -1;
+    }
+
+    AutoLocker al(m);
+    chan_window = window;
+    chan_max_window = max_window ? max_window : window;
+    chan_packet = packet;
+    return 0;
+}
+
+QoreHashNode* SSH2Client::getChannelWindow(ExceptionSink* xsink) const {
+    AutoLocker al(m);
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSsh2ChannelWindowInfo, xsink), xsink);
+    h->setKeyValue("window_size", (int64)chan_window, xsink);
+    h->setKeyValue("max_window_size", (int64)chan_max_window, xsink);
+    h->setKeyValue("packet_size", (int64)chan_packet, xsink);
+    return h.release();
+}
+
 const char *SSH2Client::getHost() {
    return sshhost.c_str();
 }
@@ -676,7 +755,7 @@ QoreObject *SSH2Client::openSessionChannel(ExceptionSink *xsink, int timeout_ms)
 
     LIBSSH2_CHANNEL *channel;
     while (true) {
-        channel = libssh2_channel_open_session(ssh_session);
+        channel = openSessionUnlocked();
         //printd(5, "SSH2Client::openSessionChannel(timeout_ms = %d) channel=%p rc=%d\n", timeout_ms, channel, libssh2_session_last_errno(ssh_session));
         if (!channel) {
             if (libssh2_session_last_error(ssh_session, 0, 0, 0) == LIBSSH2_ERROR_EAGAIN) {
@@ -766,7 +845,7 @@ void SSH2Client::scpGet(ExceptionSink *xsink, const char *path, OutputStream *os
     std::unique_ptr<SSH2Channel> c(registerChannelUnlockedRaw(scpGetRaw(xsink, path, timeout_ms, 0)));
     if (!c->sendEof(xsink, timeout_ms)) {
         qore_offset_t rc;
-        char buffer[4096];
+        char buffer[QSSH2_BUFSIZE];
         while (!c->eof(xsink)) {
             rc = c->read(xsink, buffer, sizeof(buffer), 0, timeout_ms);
             if (rc > 0) {
@@ -853,9 +932,36 @@ void SSH2Client::setWarningQueue(ExceptionSink* xsink, int64 warning_ms, int64 w
     socket.setWarningQueue(xsink, warning_ms, warning_bs, wq, arg, min_ms);
 }
 
-QoreHashNode* SSH2Client::getUsageInfo() const {
-   AutoLocker al(m);
-   return socket.getUsageInfo();
+QoreHashNode* SSH2Client::getUsageInfo(ExceptionSink* xsink) const {
+   QoreHashNode* rv;
+   {
+      AutoLocker al(m);
+      rv = socket.getUsageInfo();
+   }
+
+   // bandwidth limit state
+   ReferenceHolder<QoreHashNode> holder(rv, xsink);
+   const std::pair<const char*, SSH2RateLimiter*> limits[] = {
+      {"rate_limit_recv", rate_recv.get()},
+      {"rate_limit_send", rate_send.get()},
+      {"global_rate_limit_recv", &ssh2_global_rate_in},
+      {"global_rate_limit_send", &ssh2_global_rate_out},
+   };
+   for (auto& i : limits) {
+      // there is no information for a limiter without a limit
+      QoreHashNode* h = i.second->getInfo(xsink);
+      if (*xsink) {
+         if (h)
+            h->deref(xsink);
+         return nullptr;
+      }
+      if (h) {
+         rv->setKeyValue(i.first, h, xsink);
+         if (*xsink)
+            return nullptr;
+      }
+   }
+   return holder.release();
 }
 
 void SSH2Client::clearStats() {
@@ -863,3 +969,307 @@ void SSH2Client::clearStats() {
    socket.clearStats();
 }
 #endif
+
+bool SSH2Client::cancel() {
+    AutoLocker al(cancel_lock);
+    if (!cancel_depth)
+        return false;
+
+    if (!cancel_pending) {
+        cancel_pending = true;
+#ifndef _Q_WINDOWS
+        if (cancel_pipe[1] != -1) {
+            char c = 0;
+            if (::write(cancel_pipe[1], &c, 1) < 0)
+                printd(5, "SSH2Client::cancel() %p: write to cancel pipe failed: %s\n", this, strerror(errno));
+        }
+#endif
+    }
+    return true;
+}
+
+void SSH2Client::enterCancelRegion() {
+    AutoLocker al(cancel_lock);
+    if (cancel_depth++)
+        return;
+
+    cancel_pending = false;
+#ifndef _Q_WINDOWS
+    // the pipe is created for the first cancellable operation and kept for the life of the object
+    if (cancel_pipe[0] == -1) {
+        if (pipe(cancel_pipe)) {
+            printd(5, "SSH2Client::enterCancelRegion() %p: pipe() failed: %s\n", this, strerror(errno));
+            cancel_pipe[0] = cancel_pipe[1] = -1;
+            return;
+        }
+        for (int i = 0; i < 2; ++i) {
+            fcntl(cancel_pipe[i], F_SETFL, fcntl(cancel_pipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(cancel_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
+}
+
+void SSH2Client::exitCancelRegion() {
+    AutoLocker al(cancel_lock);
+    assert(cancel_depth);
+    if (!--cancel_depth && cancel_pending)
+        takeCancelUnlocked();
+}
+
+bool SSH2Client::takeCancelUnlocked() const {
+    if (!cancel_pending)
+        return false;
+
+    cancel_pending = false;
+#ifndef _Q_WINDOWS
+    if (cancel_pipe[0] != -1) {
+        char buf[16];
+        while (::read(cancel_pipe[0], buf, sizeof buf) > 0) {
+        }
+    }
+#endif
+    return true;
+}
+
+int SSH2Client::waitSocketUnlocked(int dir, int timeout_ms) const {
+    {
+        AutoLocker al(cancel_lock);
+        if (takeCancelUnlocked())
+            return QSSH2_WAIT_CANCELLED;
+    }
+
+#ifdef _Q_WINDOWS
+    // without a pollable wakeup handle, the wait is split into short intervals to check for cancellation
+    int64 start = q_clock_getmillis();
+    while (true) {
+        int wait_ms = QSSH2_CANCEL_POLL_MS;
+        if (timeout_ms >= 0) {
+            int64 left = timeout_ms - (q_clock_getmillis() - start);
+            if (left <= 0)
+                return 0;
+            if (left < wait_ms)
+                wait_ms = (int)left;
+        }
+        int rc = socket.asyncIoWait(wait_ms, dir & LIBSSH2_SESSION_BLOCK_INBOUND, dir & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+        if (rc)
+            return rc;
+        AutoLocker al(cancel_lock);
+        if (takeCancelUnlocked())
+            return QSSH2_WAIT_CANCELLED;
+    }
+#else
+    if (cancel_pipe[0] == -1)
+        return socket.asyncIoWait(timeout_ms, dir & LIBSSH2_SESSION_BLOCK_INBOUND, dir & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+
+    struct pollfd fds[2];
+    fds[0].fd = socket.getSocket();
+    fds[0].events = 0;
+    if (dir & LIBSSH2_SESSION_BLOCK_INBOUND)
+        fds[0].events |= POLLIN;
+    if (dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+        fds[0].events |= POLLOUT;
+    // if libssh2 did not block in any direction, wait for data from the server
+    if (!fds[0].events)
+        fds[0].events = POLLIN;
+    fds[1].fd = cancel_pipe[0];
+    fds[1].events = POLLIN;
+
+    int64 start = q_clock_getmillis();
+    while (true) {
+        int wait_ms = timeout_ms;
+        if (timeout_ms > 0) {
+            int64 left = timeout_ms - (q_clock_getmillis() - start);
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+        fds[0].revents = fds[1].revents = 0;
+        int rc = poll(fds, 2, wait_ms);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return rc;
+        if (fds[1].revents) {
+            AutoLocker al(cancel_lock);
+            if (takeCancelUnlocked())
+                return QSSH2_WAIT_CANCELLED;
+            // a stale wakeup; drain it and wait again unless the socket is also ready
+            char buf[16];
+            while (::read(cancel_pipe[0], buf, sizeof buf) > 0) {
+            }
+        }
+        if (fds[0].revents)
+            return 1;
+    }
+#endif
+}
+
+int SSH2Client::throttleWaitUnlocked(int64 us, const char* meth, ExceptionSink* xsink, bool release) {
+    // the lock cannot be released while a packet is partially sent, as libssh2 would reject any data sent by another
+    // thread in the meantime
+    if (release && ssh_session
+        && (libssh2_session_block_directions(ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND))
+        release = false;
+
+    bool cancelled;
+    if (release) {
+        LIBSSH2_SESSION* session = ssh_session;
+        // other threads expect the session in blocking mode when they acquire the lock
+        setBlockingUnlocked(true);
+        {
+            AutoUnlocker unlock(m);
+            cancelled = sleepUnlocked(us);
+        }
+        if (ssh_session != session) {
+            xsink->raiseException(SSH2CLIENT_NOT_CONNECTED, "%s(): the connection was closed while waiting for the "
+                "bandwidth limit", meth);
+            return -1;
+        }
+        setBlockingUnlocked(false);
+        // another thread can have left a window adjustment or buffered write partially sent
+        if (sendPendingUnlocked(DEFAULT_TIMEOUT_MS, meth, xsink))
+            return -1;
+    } else {
+        cancelled = sleepUnlocked(us);
+    }
+
+    if (cancelled) {
+        doCancelUnlocked(xsink, meth, false);
+        return -1;
+    }
+    return 0;
+}
+
+int SSH2Client::trySendPendingUnlocked() {
+    if (!pending_channel || !ssh_session)
+        return 0;
+    int rc = pending_write
+        ? pending_write->resumeWriteUnlocked()
+        // libssh2 sends the packet already prepared, so the arguments are not used
+        : libssh2_channel_receive_window_adjust2(pending_channel, 0, 0, nullptr);
+    if (rc == LIBSSH2_ERROR_EAGAIN)
+        return 1;
+    pending_channel = nullptr;
+    // the flusher sends the rest of the buffer
+    if (pending_write) {
+        pending_write = nullptr;
+        flush_cond.signal();
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+int SSH2Client::sendPendingUnlocked(int timeout_ms, const char* meth, ExceptionSink* xsink) {
+    while (true) {
+        int rc = trySendPendingUnlocked();
+        if (rc <= 0) {
+            if (rc && xsink)
+                doSessionErrUnlocked(xsink, "%s(): failed to complete a partially-sent packet", meth);
+            return rc;
+        }
+
+        rc = waitSocketUnlocked(timeout_ms);
+        if (rc > 0)
+            continue;
+        if (!xsink)
+            return -1;
+        if (rc == QSSH2_WAIT_CANCELLED)
+            doCancelUnlocked(xsink, meth, false);
+        else if (!rc)
+            xsink->raiseException(SSH2CLIENT_TIMEOUT, "%s(): timeout after %dms completing a partially-sent "
+                "packet", meth, timeout_ms);
+        else
+            xsink->raiseErrnoException(SSH2_ERROR, errno, "%s(): error waiting for network while completing a "
+                "partially-sent packet", meth);
+        return -1;
+    }
+}
+
+void SSH2Client::scheduleFlushUnlocked(SSH2Channel* chan) {
+    bool added = flush_set.insert(chan).second;
+    if (flusher_running) {
+        // the new channel could be due before the time the flusher is waiting for
+        if (added)
+            flush_cond.signal();
+        return;
+    }
+
+    ExceptionSink xsink;
+    if (q_start_thread(&xsink, flushThread, this) < 0) {
+        // the data is sent by the next write, flush or other operation on the channel
+        flush_set.erase(chan);
+        xsink.clear();
+        return;
+    }
+    // the thread cannot run before the lock is released, so the reference is taken after it has been started; it
+    // keeps the client alive until the thread has exited
+    flusher_running = true;
+    ref();
+}
+
+void SSH2Client::flushThread(ExceptionSink* xsink, void* arg) {
+    SSH2Client* client = static_cast<SSH2Client*>(arg);
+    client->runFlusher();
+    client->deref(xsink);
+}
+
+void SSH2Client::runFlusher() {
+    AutoLocker al(m);
+    while (true) {
+        int64 now = q_clock_getmillis();
+        int64 wait_ms = -1;
+        for (std::set<SSH2Channel*>::iterator i = flush_set.begin(), e = flush_set.end(); i != e;) {
+            SSH2Channel* chan = *i;
+            int64 left = chan->flushDueUnlocked(now);
+            // data is only sent as far as possible without blocking; if any remains, the channel sets the time of
+            // the next try, and the lock is released until then
+            if (!left) {
+                // other threads expect the session in blocking mode when they acquire the lock
+                setBlockingUnlocked(false);
+                chan->trySendBufferUnlocked();
+                setBlockingUnlocked(true);
+                left = chan->flushDueUnlocked(now);
+            }
+            if (left < 0) {
+                flush_set.erase(i++);
+                continue;
+            }
+            if (wait_ms < 0 || left < wait_ms)
+                wait_ms = left;
+            ++i;
+        }
+        if (flush_set.empty())
+            break;
+        flush_cond.wait(&m, (int)wait_ms);
+    }
+    flusher_running = false;
+}
+
+bool SSH2Client::sleepUnlocked(int64 us) const {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while (true) {
+        {
+            AutoLocker al(cancel_lock);
+            if (takeCancelUnlocked())
+                return true;
+        }
+
+        int64 left = std::chrono::duration_cast<std::chrono::microseconds>(end - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            return false;
+
+#ifndef _Q_WINDOWS
+        if (cancel_pipe[0] != -1) {
+            struct pollfd fd;
+            fd.fd = cancel_pipe[0];
+            fd.events = POLLIN;
+            fd.revents = 0;
+            // a wakeup or EINTR is checked at the top of the loop
+            poll(&fd, 1, (int)((left + 999) / 1000));
+            continue;
+        }
+#else
+        if (left > QSSH2_CANCEL_POLL_MS * 1000)
+            left = QSSH2_CANCEL_POLL_MS * 1000;
+#endif
+        qore_usleep(left);
+    }
+}
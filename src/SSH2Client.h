@@ -29,6 +29,7 @@
 #define _QORE_SSH2CLIENT_H
 
 #include "ssh2-module.h"
+#include "SSH2RateLimiter.h"
 
 #include <qore/QoreSocket.h>
 #ifdef _QORE_HAS_QUEUE_OBJECT
@@ -42,12 +43,18 @@
 #include <stdint.h>
 #endif
 
+#include <memory>
 #include <set>
 #include <string>
 
 // for maximum SSH2 performance, a 32K buffer is needed
 #define QSSH2_BUFSIZE 32768
 
+// the maximum receive window size for channels
+#define QSSH2_MAX_WINDOW (1024 * 1024 * 1024)
+// the maximum packet size for channels; libssh2 rejects incoming packets larger than this plus protocol overhead
+#define QSSH2_MAX_PACKET 32768
+
 DLLLOCAL QoreClass *initSSH2ClientClass(QoreNamespace& ns);
 DLLLOCAL extern qore_classid_t CID_SSH2CLIENT;
 
@@ -62,9 +69,17 @@ DLLLOCAL std::string mode2str(const int mode);
 
 DLLLOCAL extern const char *SSH2_ERROR;
 DLLLOCAL extern const char *SSH2_CONNECTED;
+DLLLOCAL extern const char *SSH2_CANCELLED;
+
+// returned by SSH2Client::waitSocketUnlocked() when the wait was interrupted by SSH2Client::cancel()
+#define QSSH2_WAIT_CANCELLED -2
 
 class SSH2Channel;
 class BlockingHelper;
+class SSH2ExecTask;
+class SSH2Relay;
+class SSH2RemoteForward;
+struct SSH2ExecOptions;
 
 class AbstractDisconnectionHelper {
 public:
@@ -78,9 +93,13 @@ public:
 class SSH2Client : public AbstractPrivateData {
     friend class SSH2Channel;
     friend class BlockingHelper;
+    friend class SSH2ExecTask;
+    friend class SSH2Relay;
+    friend class SSH2RemoteForward;
 
 private:
     typedef std::set<SSH2Channel*> channel_set_t;
+    typedef std::set<SSH2Relay*> relay_set_t;
 
     // connection host
     std::string sshhost,
@@ -99,10 +118,110 @@ private:
     // set of connected channels
     channel_set_t channel_set;
 
+    // port forwarding relays running on the session
+    relay_set_t relay_set;
+
+    // protects the cancellation state; must be acquired without holding the object lock
+    mutable QoreThreadLock cancel_lock;
+    // pipe to wake up a socket wait in progress when the current operation is cancelled
+    mutable int cancel_pipe[2] = {-1, -1};
+    // the nesting depth of cancellable regions; operations can only be cancelled while this is > 0
+    unsigned cancel_depth = 0;
+    // true if the current operation has been cancelled and the cancellation has not yet been processed
+    mutable bool cancel_pending = false;
+
+    // per-object bandwidth limits; shared with connections created from this object for bulk transfers
+    std::shared_ptr<SSH2RateLimiter> rate_recv, rate_send;
+
+    // the receive window for new channels in bytes; 0 = the libssh2 default
+    uint32_t chan_window = 0;
+    // the size that the receive window of a channel is grown to when the window limits a transfer
+    uint32_t chan_max_window = 0;
+    // the maximum packet size for new session channels in bytes; 0 = the libssh2 default
+    uint32_t chan_packet = 0;
+
+    // the channel with a partially-sent packet; libssh2 cannot send anything else on the session until the packet has
+    // been completed
+    LIBSSH2_CHANNEL* pending_channel = nullptr;
+    // the channel object whose buffered data is being sent in the packet for "pending_channel"; nullptr if the packet
+    // is a receive window adjustment
+    SSH2Channel* pending_write = nullptr;
+
+    // channels with buffered data that is sent by the flusher thread once the delay for the channel has passed
+    std::set<SSH2Channel*> flush_set;
+    // wakes up the flusher thread; used with the object lock
+    QoreCondition flush_cond;
+    bool flusher_running = false;
+
+    // returns true and clears the cancellation flag if the current operation has been cancelled; the cancel lock
+    // must be held
+    DLLLOCAL bool takeCancelUnlocked() const;
+
 protected:
     // socket object for the connection
     QoreSocket socket;
 
+    // marks the start and end of a cancellable region; called by BlockingHelper and for requests that span multiple
+    // network operations
+    DLLLOCAL void enterCancelRegion();
+    DLLLOCAL void exitCancelRegion();
+
+    // returns true and clears the cancellation flag if the current operation has been cancelled
+    DLLLOCAL bool takeCancel() {
+        AutoLocker al(cancel_lock);
+        return takeCancelUnlocked();
+    }
+
+    // sleeps for the given number of microseconds; returns true if the current operation was cancelled
+    DLLLOCAL bool sleepUnlocked(int64 us) const;
+
+    // charges a transfer of the given number of bytes against the object and global limits; returns the number of
+    // microseconds the caller must wait before continuing
+    DLLLOCAL int64 throttleDelay(bool recv, size_t bytes) {
+        int64 us = (recv ? rate_recv : rate_send)->charge(bytes);
+        int64 gus = (recv ? ssh2_global_rate_in : ssh2_global_rate_out).charge(bytes);
+        return us > gus ? us : gus;
+    }
+
+    // delays the caller after a transfer of the given number of bytes according to the bandwidth limits; the object
+    // lock is released while waiting unless "release" is false; returns -1 if the operation was cancelled or the
+    // connection was closed while waiting
+    DLLLOCAL int throttleUnlocked(bool recv, size_t bytes, const char* meth, ExceptionSink* xsink,
+            bool release = true) {
+        int64 us = throttleDelay(recv, bytes);
+        return us ? throttleWaitUnlocked(us, meth, xsink, release) : 0;
+    }
+
+    // waits for the given number of microseconds for throttleUnlocked(); returns -1 if an exception was raised
+    DLLLOCAL int throttleWaitUnlocked(int64 us, const char* meth, ExceptionSink* xsink, bool release);
+
+    // tries once to complete a partially-sent window adjustment or buffered write without waiting; the lock must be
+    // held and the session must be in non-blocking mode; returns 1 if the packet is still pending, 0 if there is none
+    // or it was sent, or -1 if it failed
+    DLLLOCAL int trySendPendingUnlocked();
+
+    // completes a partially-sent window adjustment or buffered write before anything else is sent on the session;
+    // the lock must be held and the session must be in non-blocking mode; errors are only raised if "xsink" is not
+    // null; returns -1 if the packet could not be completed
+    DLLLOCAL int sendPendingUnlocked(int timeout_ms, const char* meth, ExceptionSink* xsink);
+
+    // must be called before a channel is freed; the lock must be held
+    DLLLOCAL void channelFreedUnlocked(LIBSSH2_CHANNEL* channel) {
+        if (pending_channel == channel) {
+            pending_channel = nullptr;
+            pending_write = nullptr;
+        }
+    }
+
+    // schedules the write buffer of the channel to be sent by the flusher thread once its delay has passed; starts
+    // the flusher thread if it is not running; the lock must be held
+    DLLLOCAL void scheduleFlushUnlocked(SSH2Channel* chan);
+
+    DLLLOCAL static void flushThread(ExceptionSink* xsink, void* arg);
+
+    // sends the write buffers of the scheduled channels as their delays pass; exits when no channel is scheduled
+    DLLLOCAL void runFlusher();
+
     /*
         * close session/connection
         * free ressources
@@ -168,8 +287,28 @@ protected:
             libssh2_session_set_blocking(ssh_session, (int)block);
     }
 
-    DLLLOCAL int waitSocketUnlocked(ExceptionSink* xsink, const char *toerr, const char *err, const char* m, int timeout_ms = DEFAULT_TIMEOUT_MS, bool in_disconnect = false, AbstractDisconnectionHelper* adh = 0) {
-        int rc = waitSocketUnlocked(timeout_ms);
+    // raises an SSH2-CANCELLED exception; the connection is closed if requested or if a partially-sent packet
+    // remains, as libssh2 cannot send any other data in this case
+    DLLLOCAL void doCancelUnlocked(ExceptionSink* xsink, const char* m, bool disconnect, bool in_disconnect = false, AbstractDisconnectionHelper* adh = 0) {
+        if (xsink)
+            xsink->raiseException(SSH2_CANCELLED, "%s() was cancelled", m);
+        if (!in_disconnect && ssh_session && (disconnect || (libssh2_session_block_directions(ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND)))
+            disconnectUnlocked(true, DEFAULT_TIMEOUT_MS, adh, xsink);
+    }
+
+    // if "cancel_disconnect" is false, the connection is only closed for a cancelled operation if a partially-sent
+    // packet remains; operations with libssh2 request state that cannot be resumed must close the connection
+    DLLLOCAL int waitSocketUnlocked(ExceptionSink* xsink, const char *toerr, const char *err, const char* m, int timeout_ms = DEFAULT_TIMEOUT_MS, bool in_disconnect = false, AbstractDisconnectionHelper* adh = 0, bool cancel_disconnect = true) {
+        return waitResultUnlocked(waitSocketUnlocked(timeout_ms), xsink, toerr, err, m, timeout_ms, in_disconnect, adh, cancel_disconnect);
+    }
+
+    // processes the result of a socket wait made without an exception sink (for example in a helper thread) as
+    // waitSocketUnlocked() would; errno must be set to the value returned by the wait
+    DLLLOCAL int waitResultUnlocked(int rc, ExceptionSink* xsink, const char *toerr, const char *err, const char* m, int timeout_ms = DEFAULT_TIMEOUT_MS, bool in_disconnect = false, AbstractDisconnectionHelper* adh = 0, bool cancel_disconnect = true) {
+        if (rc == QSSH2_WAIT_CANCELLED) {
+            doCancelUnlocked(xsink, m, cancel_disconnect, in_disconnect, adh);
+            return -1;
+        }
         if (!rc) {
             if (xsink)
                 xsink->raiseException(toerr, "network timeout after %dms in %s(); closing connection", timeout_ms, m);
@@ -191,8 +330,15 @@ protected:
         return waitSocketUnlocked(libssh2_session_block_directions(ssh_session), timeout_ms);
     }
 
-    DLLLOCAL int waitSocketUnlocked(int dir, int timeout_ms) const {
-        return socket.asyncIoWait(timeout_ms, dir & LIBSSH2_SESSION_BLOCK_INBOUND, dir & LIBSSH2_SESSION_BLOCK_OUTBOUND);
+    // returns > 0 if the socket is ready, 0 on timeout, QSSH2_WAIT_CANCELLED if the operation was cancelled, and -1
+    // on error
+    DLLLOCAL int waitSocketUnlocked(int dir, int timeout_ms) const;
+
+    // opens a session channel with the configured window and packet sizes; the lock must be held
+    DLLLOCAL LIBSSH2_CHANNEL* openSessionUnlocked() {
+        return libssh2_channel_open_ex(ssh_session, "session", sizeof("session") - 1,
+            chan_window ? chan_window : LIBSSH2_CHANNEL_WINDOW_DEFAULT,
+            chan_packet ? chan_packet : LIBSSH2_CHANNEL_PACKET_DEFAULT, nullptr, 0);
     }
 
     DLLLOCAL QoreObject *registerChannelUnlocked(LIBSSH2_CHANNEL *channel);
@@ -210,6 +356,8 @@ protected:
 public:
     DLLLOCAL SSH2Client(const char*, const uint32_t);
     DLLLOCAL SSH2Client(QoreURL &url, const uint32_t = 0);
+    // creates an unconnected client with the same connection parameters as the given client
+    DLLLOCAL SSH2Client(const SSH2Client& old);
     DLLLOCAL int setUser(const char *);
     DLLLOCAL int setPassword(const char *);
     DLLLOCAL int setKeys(const char *, const char *, ExceptionSink* xsink);
@@ -276,10 +424,52 @@ public:
     DLLLOCAL QoreObject *scpPut(ExceptionSink *xsink, const char *path, size_t size, int mode = 0644, long mtime = 0, long atime = 0, int timeout_ms = -1);
     DLLLOCAL void scpPut(ExceptionSink *xsink, const char *path, InputStream *is, size_t size, int mode = 0644, long mtime = 0, long atime = 0, int timeout_ms = -1);
 
+    // executes a command on a new channel and returns a hash<Ssh2ExecResult> when it has completed
+    DLLLOCAL QoreHashNode* run(const char* cmd, const SSH2ExecOptions& opts, int timeout_ms, ExceptionSink* xsink);
+
+    // executes the given commands with up to "concurrency" channels open at the same time and returns a list of
+    // hash<Ssh2ExecResult> in the order of the commands
+    DLLLOCAL QoreListNode* execMany(const QoreListNode* cmds, unsigned concurrency, const SSH2ExecOptions& opts,
+            int timeout_ms, ExceptionSink* xsink);
+
+    // runs a command on each of the given hosts with a pool of worker threads, each host with its own connection,
+    // and passes each hash<Ssh2HostResult> to the callback in the calling thread as soon as the host has completed;
+    // returns a hash<Ssh2FanOutInfo>
+    DLLLOCAL static QoreHashNode* fanOut(const QoreListNode* hosts, const char* cmd,
+            const ResolvedCallReferenceNode* callback, const QoreHashNode* opts, int timeout_ms, ExceptionSink* xsink);
+
+    // starts relaying connections accepted on a local socket to the given host and port through direct-tcpip
+    // channels in a background thread; returns an SSH2PortForward object
+    DLLLOCAL QoreObject* forwardLocalPort(const char* bind, const char* host, int64 port, const QoreHashNode* opts,
+            ExceptionSink* xsink);
+
+    // requests the server to listen on a remote port and starts relaying the connections it accepts to the given
+    // local host and port in a background thread; returns an SSH2PortForward object
+    DLLLOCAL QoreObject* forwardRemotePort(const char* bind, const char* host, int64 port, const QoreHashNode* opts,
+            int timeout_ms, ExceptionSink* xsink);
+
     DLLLOCAL void clearWarningQueue(ExceptionSink* xsink);
     DLLLOCAL void setWarningQueue(ExceptionSink* xsink, int64 warning_ms, int64 warning_bs, Queue* wq, QoreValue arg, int64 min_ms = 1000);
-    DLLLOCAL QoreHashNode* getUsageInfo() const;
+    // returns nullptr if an exception was raised
+    DLLLOCAL QoreHashNode* getUsageInfo(ExceptionSink* xsink) const;
     DLLLOCAL void clearStats();
+
+    // cancels the network operation in progress in another thread, if any; returns true if an operation was
+    // cancelled; must not be called with the object lock held
+    DLLLOCAL bool cancel();
+
+    // sets the receive window and packet sizes for channels opened after this call; 0 = the libssh2 default;
+    // returns -1 if an exception was raised
+    DLLLOCAL int setChannelWindow(int64 window, int64 max_window, int64 packet, ExceptionSink* xsink);
+
+    // returns a hash<Ssh2ChannelWindowInfo>
+    DLLLOCAL QoreHashNode* getChannelWindow(ExceptionSink* xsink) const;
+
+    // sets the bandwidth limits for this object in bytes per second; 0 = no limit
+    DLLLOCAL void setRateLimit(int64 recv, int64 send, int64 burst) {
+        rate_recv->set(recv, burst);
+        rate_send->set(send, burst);
+    }
 };
 
 class BlockingHelper {
@@ -289,8 +479,14 @@ protected:
 public:
     DLLLOCAL BlockingHelper(SSH2Client* n_client) : client(n_client) {
         client->setBlockingUnlocked(false);
+        // a window adjustment or buffered write left partially sent by an earlier operation or by the flusher must be
+        // completed before this operation can send anything; if it cannot be completed, the operation fails with
+        // the error from libssh2
+        client->sendPendingUnlocked(DEFAULT_TIMEOUT_MS, nullptr, nullptr);
+        client->enterCancelRegion();
     }
     DLLLOCAL ~BlockingHelper() {
+        client->exitCancelRegion();
         client->setBlockingUnlocked(true);
     }
 };
@@ -0,0 +1,433 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2Exec.cpp
+
+    non-blocking remote command execution
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SSH2Exec.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+static const char* SSH2CLIENT_RUN_ERROR = "SSH2CLIENT-RUN-ERROR";
+static const char* SSH2CLIENT_EXECMANY_ERROR = "SSH2CLIENT-EXECMANY-ERROR";
+
+int get_exec_options(const QoreHashNode* opts, SSH2ExecOptions& eo, const char* err, ExceptionSink* xsink) {
+    if (!opts)
+        return 0;
+
+    QoreValue v = opts->getKeyValue("max_output");
+    if (!v.isNothing()) {
+        int64 n = v.getAsBigInt();
+        if (n < 0) {
+            xsink->raiseException(err, "the 'max_output' option must not be negative; got " QLLD, n);
+            return -1;
+        }
+        eo.max_output = n;
+    }
+
+    v = opts->getKeyValue("encoding");
+    if (!v.isNothing()) {
+        if (v.getType() != NT_STRING) {
+            xsink->raiseException(err, "the 'encoding' option must be a string; got type '%s' instead",
+                v.getTypeName());
+            return -1;
+        }
+        eo.enc = QEM.findCreate(v.get<const QoreStringNode>()->c_str());
+    }
+
+    v = opts->getKeyValue("stdin");
+    if (!v.isNothing()) {
+        if (v.getType() == NT_STRING) {
+            // string input is sent in the encoding of the output
+            TempEncodingHelper str(v.get<const QoreStringNode>(), eo.enc, xsink);
+            if (*xsink)
+                return -1;
+            eo.input.assign(str->c_str(), str->size());
+        } else if (v.getType() == NT_BINARY) {
+            const BinaryNode* b = v.get<const BinaryNode>();
+            eo.input.assign(static_cast<const char*>(b->getPtr()), b->size());
+        } else {
+            xsink->raiseException(err, "the 'stdin' option must be a string or binary value; got type '%s' instead",
+                v.getTypeName());
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+SSH2ExecTask::~SSH2ExecTask() {
+    // the channel was freed with the session if the connection was closed
+    if (channel && client->ssh_session)
+        libssh2_channel_free(channel);
+}
+
+int SSH2ExecTask::step(ExceptionSink* xsink) {
+    exec_state_t old_state = state;
+    int64 old_bytes = out.bytes + err.bytes + (int64)input_sent;
+    bool old_eof = eof_sent;
+    int rc = stepIntern(xsink);
+    progress = state != old_state || out.bytes + err.bytes + (int64)input_sent != old_bytes || eof_sent != old_eof;
+    return rc;
+}
+
+int SSH2ExecTask::stepIntern(ExceptionSink* xsink) {
+    LIBSSH2_SESSION* session = client->ssh_session;
+    while (true) {
+        switch (state) {
+            case ES_OPEN:
+                channel = client->openSessionUnlocked();
+                if (!channel) {
+                    if (libssh2_session_last_errno(session) == LIBSSH2_ERROR_EAGAIN)
+                        return 0;
+                    client->doSessionErrUnlocked(xsink, "%s(): failed to open a channel for command '%s'", meth,
+                        cmd.c_str());
+                    return -1;
+                }
+                state = ES_EXEC;
+                break;
+
+            case ES_EXEC: {
+                int rc = libssh2_channel_exec(channel, cmd.c_str());
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return 0;
+                if (rc) {
+                    client->doSessionErrUnlocked(xsink, "%s(): failed to execute command '%s'", meth, cmd.c_str());
+                    return -1;
+                }
+                state = ES_IO;
+                break;
+            }
+
+            case ES_IO: {
+                // a read that left a window adjustment partially sent must be repeated before input can be sent
+                if (pending_read >= 0) {
+                    int stream_id = pending_read;
+                    pending_read = -1;
+                    if (readStream(stream_id, stream_id ? err : out, xsink))
+                        return -1;
+                    if (pending_read >= 0)
+                        return 0;
+                }
+                // input is sent and both streams are read in each step, so the command cannot stall on a full
+                // window for one stream while the other is being waited for
+                int rc = sendInput(xsink);
+                if (rc < 0)
+                    return -1;
+                // a partially-sent packet must be completed by repeating the same write, so the streams are not read
+                // here, as reading can send a window adjustment
+                if (!rc && blockedOut())
+                    return 0;
+                if (readStream(0, out, xsink))
+                    return -1;
+                if (pending_read >= 0)
+                    return 0;
+                if (readStream(SSH_EXTENDED_DATA_STDERR, err, xsink))
+                    return -1;
+                if (pending_read >= 0)
+                    return 0;
+                // the channel only reports EOF once all data received has been read
+                if (!libssh2_channel_eof(channel))
+                    return 0;
+                state = ES_CLOSE;
+                break;
+            }
+
+            case ES_CLOSE: {
+                int rc = libssh2_channel_close(channel);
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return 0;
+                if (rc < 0) {
+                    client->doSessionErrUnlocked(xsink, "%s(): failed to close the channel for command '%s'", meth,
+                        cmd.c_str());
+                    return -1;
+                }
+                state = ES_WAIT_CLOSED;
+                break;
+            }
+
+            case ES_WAIT_CLOSED: {
+                int rc = libssh2_channel_wait_closed(channel);
+                if (rc == LIBSSH2_ERROR_EAGAIN)
+                    return 0;
+                if (rc < 0) {
+                    client->doSessionErrUnlocked(xsink, "%s(): failed to close the channel for command '%s'", meth,
+                        cmd.c_str());
+                    return -1;
+                }
+                exit_status = libssh2_channel_get_exit_status(channel);
+                char* sig = nullptr;
+                size_t sig_len = 0;
+                if (!libssh2_channel_get_exit_signal(channel, &sig, &sig_len, nullptr, nullptr, nullptr, nullptr)
+                    && sig) {
+                    exit_signal.assign(sig, sig_len);
+                    libssh2_free(session, sig);
+                }
+                state = ES_FREE;
+                break;
+            }
+
+            case ES_FREE:
+                if (libssh2_channel_free(channel) == LIBSSH2_ERROR_EAGAIN)
+                    return 0;
+                channel = nullptr;
+                us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()
+                    - start).count();
+                state = ES_DONE;
+                return 1;
+
+            case ES_DONE:
+                return 1;
+        }
+    }
+}
+
+bool SSH2ExecTask::blockedOut() const {
+    return libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND;
+}
+
+int SSH2ExecTask::sendInput(ExceptionSink* xsink) {
+    if (eof_sent)
+        return 1;
+
+    while (input_sent < opts.input.size()) {
+        ssize_t rc = libssh2_channel_write(channel, opts.input.data() + input_sent, opts.input.size() - input_sent);
+        if (!rc || rc == LIBSSH2_ERROR_EAGAIN)
+            return 0;
+        if (rc < 0) {
+            client->doSessionErrUnlocked(xsink, "%s(): failed to send input to command '%s'", meth, cmd.c_str());
+            return -1;
+        }
+        input_sent += rc;
+        // the lock is kept, as other commands can have a channel open in progress in the session
+        if (client->throttleUnlocked(false, rc, meth, xsink, false))
+            return -1;
+    }
+
+    int rc = libssh2_channel_send_eof(channel);
+    if (rc == LIBSSH2_ERROR_EAGAIN)
+        return 0;
+    if (rc < 0) {
+        client->doSessionErrUnlocked(xsink, "%s(): failed to send EOF to command '%s'", meth, cmd.c_str());
+        return -1;
+    }
+    eof_sent = true;
+    return 1;
+}
+
+int SSH2ExecTask::readStream(int stream_id, ExecStream& s, ExceptionSink* xsink) {
+    char buf[QSSH2_BUFSIZE];
+    while (true) {
+        ssize_t rc = libssh2_channel_read_ex(channel, stream_id, buf, sizeof(buf));
+        if (!rc)
+            return 0;
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            if (blockedOut())
+                pending_read = stream_id;
+            return 0;
+        }
+        if (rc < 0) {
+            client->doSessionErrUnlocked(xsink, "%s(): failed to read the output of command '%s'", meth, cmd.c_str());
+            return -1;
+        }
+        s.bytes += rc;
+        if (client->throttleUnlocked(true, rc, meth, xsink, false))
+            return -1;
+
+        if (s.os) {
+            s.os->write(buf, rc, xsink);
+            if (*xsink)
+                return -1;
+            continue;
+        }
+
+        // output beyond the limit is read so the command can complete, but it is not kept
+        size_t len = rc;
+        size_t room = opts.max_output - s.data.size();
+        if (len > room) {
+            len = room;
+            s.truncated = true;
+        }
+        if (len)
+            s.data.append(buf, len);
+    }
+}
+
+QoreHashNode* SSH2ExecTask::getResult(ExceptionSink* xsink) const {
+    assert(state == ES_DONE);
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSsh2ExecResult, xsink), xsink);
+    h->setKeyValue("command", new QoreStringNode(cmd), xsink);
+    h->setKeyValue("exit_status", (int64)exit_status, xsink);
+    if (!exit_signal.empty())
+        h->setKeyValue("exit_signal", new QoreStringNode(exit_signal), xsink);
+    if (!out.os)
+        h->setKeyValue("stdout_data", new QoreStringNode(out.data.data(), out.data.size(), opts.enc), xsink);
+    if (!err.os)
+        h->setKeyValue("stderr_data", new QoreStringNode(err.data.data(), err.data.size(), opts.enc), xsink);
+    h->setKeyValue("stdout_bytes", out.bytes, xsink);
+    h->setKeyValue("stderr_bytes", err.bytes, xsink);
+    h->setKeyValue("stdout_truncated", out.truncated, xsink);
+    h->setKeyValue("stderr_truncated", err.truncated, xsink);
+    h->setKeyValue("us", us, xsink);
+    return h.release();
+}
+
+QoreHashNode* SSH2Client::run(const char* cmd, const SSH2ExecOptions& opts, int timeout_ms, ExceptionSink* xsink) {
+    AutoLocker al(m);
+
+    if (!sshConnectedUnlocked()) {
+        xsink->raiseException("SSH2CLIENT-NOT-CONNECTED", "cannot call SSH2Client::run() while client is not connected");
+        return nullptr;
+    }
+
+    BlockingHelper bh(this);
+
+    // the lock is held until the command has completed, so the command runs with a single lock acquisition
+    SSH2ExecTask task(this, cmd, opts, "SSH2Client::run");
+    while (true) {
+        int rc = task.step(xsink);
+        if (rc < 0)
+            return nullptr;
+        if (rc)
+            break;
+        if (waitSocketUnlocked(xsink, "SSH2CLIENT-TIMEOUT", SSH2CLIENT_RUN_ERROR, "SSH2Client::run", timeout_ms))
+            return nullptr;
+    }
+
+    return task.getResult(xsink);
+}
+
+QoreListNode* SSH2Client::execMany(const QoreListNode* cmds, unsigned concurrency, const SSH2ExecOptions& opts,
+        int timeout_ms, ExceptionSink* xsink) {
+    AutoLocker al(m);
+
+    if (!sshConnectedUnlocked()) {
+        xsink->raiseException("SSH2CLIENT-NOT-CONNECTED", "cannot call SSH2Client::execMany() while client is not "
+            "connected");
+        return nullptr;
+    }
+
+    BlockingHelper bh(this);
+
+    // each command has its own channel, and all channels are driven by this thread with a single lock acquisition;
+    // tasks are declared after the lock helper, so any open channels are freed with the lock held
+    size_t n = cmds->size();
+    std::vector<std::unique_ptr<SSH2ExecTask>> tasks(n);
+    std::vector<SSH2ExecTask*> active;
+    active.reserve(concurrency);
+    size_t next = 0;
+
+    // a task that left a packet partially sent; the packet must be completed by repeating the same call before
+    // anything else can be sent on the session, so only this task is stepped until its send has completed
+    SSH2ExecTask* blocked = nullptr;
+
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    while (next < n || !active.empty()) {
+        if (blocked) {
+            int rc = blocked->step(xsink);
+            if (rc < 0)
+                return nullptr;
+            bool progress = blocked->progressed();
+            if (rc)
+                active.erase(std::find(active.begin(), active.end(), blocked));
+            if (rc || !(libssh2_session_block_directions(ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND))
+                blocked = nullptr;
+            if (progress) {
+                last = std::chrono::steady_clock::now();
+                continue;
+            }
+            if (!blocked)
+                continue;
+        }
+
+        // libssh2 keeps the state of a channel open request in the session, so only one channel can be opened at a
+        // time; the next command is started once the previous channel has been opened
+        if (!blocked && next < n && active.size() < concurrency
+            && std::none_of(active.begin(), active.end(), [](const SSH2ExecTask* t) { return t->opening(); })) {
+            tasks[next].reset(new SSH2ExecTask(this, cmds->retrieveEntry(next).get<const QoreStringNode>()->c_str(),
+                opts, "SSH2Client::execMany"));
+            active.push_back(tasks[next].get());
+            ++next;
+        }
+
+        bool progress = false;
+        for (size_t i = 0; !blocked && i < active.size();) {
+            int rc = active[i]->step(xsink);
+            if (rc < 0)
+                return nullptr;
+            if (active[i]->progressed())
+                progress = true;
+            if (rc) {
+                active.erase(active.begin() + i);
+                continue;
+            }
+            // the other tasks are not stepped until the partially-sent packet has been completed
+            if (libssh2_session_block_directions(ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+                blocked = active[i];
+            ++i;
+        }
+
+        if (progress) {
+            last = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        if (active.empty())
+            continue;
+
+        // with more than one channel, the I/O for one channel can read the data for another channel from the socket,
+        // in which case the socket does not become readable again for that data; the wait is therefore split into
+        // short intervals after which all channels are tried again
+        int wait_ms = active.size() > 1 ? QSSH2_EXEC_POLL_MS : timeout_ms;
+        if (timeout_ms >= 0) {
+            int64 left = timeout_ms - std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - last).count();
+            if (left <= 0) {
+                waitResultUnlocked(0, xsink, "SSH2CLIENT-TIMEOUT", SSH2CLIENT_EXECMANY_ERROR, "SSH2Client::execMany",
+                    timeout_ms);
+                return nullptr;
+            }
+            if (wait_ms < 0 || left < wait_ms)
+                wait_ms = (int)left;
+        }
+
+        int rc = waitSocketUnlocked(wait_ms);
+        // a timeout is only an error once no channel has made progress for the entire timeout period
+        if (!rc)
+            continue;
+        if (rc < 0) {
+            waitResultUnlocked(rc, xsink, "SSH2CLIENT-TIMEOUT", SSH2CLIENT_EXECMANY_ERROR, "SSH2Client::execMany",
+                timeout_ms);
+            return nullptr;
+        }
+    }
+
+    ReferenceHolder<QoreListNode> rv(new QoreListNode(hashdeclSsh2ExecResult->getTypeInfo()), xsink);
+    for (auto& i : tasks) {
+        rv->push(i->getResult(xsink), xsink);
+        if (*xsink)
+            return nullptr;
+    }
+    return rv.release();
+}
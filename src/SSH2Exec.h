@@ -0,0 +1,156 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2Exec.h
+
+    non-blocking remote command execution
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2EXEC_H
+
+#define _QORE_SSH2EXEC_H
+
+#include "SSH2Client.h"
+
+#include <chrono>
+#include <string>
+
+// default maximum number of bytes of output captured for each stream of a command
+#define QSSH2_EXEC_MAX_OUTPUT (16 * 1024 * 1024)
+// maximum number of commands executed at the same time by SSH2Client::execMany()
+#define QSSH2_EXEC_MAX_CONCURRENCY 256
+// the interval for retrying all channels while waiting for the socket with more than one command running
+#define QSSH2_EXEC_POLL_MS 20
+
+// options for executing a command; the output streams are not referenced and must stay valid while the command runs
+struct SSH2ExecOptions {
+    // if set, output is written to the stream instead of being captured
+    OutputStream* out = nullptr;
+    OutputStream* err = nullptr;
+    // data sent to the command's standard input before EOF is sent
+    std::string input;
+    // the maximum number of bytes captured for each stream; any further output is read and discarded
+    size_t max_output = QSSH2_EXEC_MAX_OUTPUT;
+    // the encoding of captured output
+    const QoreEncoding* enc = QCS_DEFAULT;
+};
+
+// parses a hash of exec options; returns -1 if an exception was raised
+DLLLOCAL int get_exec_options(const QoreHashNode* opts, SSH2ExecOptions& eo, const char* err, ExceptionSink* xsink);
+
+// runs a single command on its own channel without ever blocking, so any number of commands can be driven on one
+// session by a single thread; all methods must be called with the client lock held and the session in non-blocking
+// mode
+class SSH2ExecTask {
+public:
+    DLLLOCAL SSH2ExecTask(SSH2Client* client, std::string cmd, const SSH2ExecOptions& opts, const char* meth) :
+            client(client), cmd(std::move(cmd)), opts(opts), meth(meth), start(std::chrono::steady_clock::now()) {
+    }
+
+    // frees the channel if the command did not complete; must be called with the client lock held
+    DLLLOCAL ~SSH2ExecTask();
+
+    // advances the command as far as possible without blocking; returns 1 when the command is complete, 0 if the
+    // session must wait for the socket, or -1 if an exception was raised
+    DLLLOCAL int step(ExceptionSink* xsink);
+
+    DLLLOCAL bool done() const {
+        return state == ES_DONE;
+    }
+
+    // returns true while the channel for the command is being opened
+    DLLLOCAL bool opening() const {
+        return state == ES_OPEN;
+    }
+
+    // returns true if the last call to step() changed the state of the command or transferred any data
+    DLLLOCAL bool progressed() const {
+        return progress;
+    }
+
+    DLLLOCAL const std::string& getCommand() const {
+        return cmd;
+    }
+
+    // returns a hash<Ssh2ExecResult> for a completed command
+    DLLLOCAL QoreHashNode* getResult(ExceptionSink* xsink) const;
+
+private:
+    enum exec_state_t {
+        ES_OPEN,
+        ES_EXEC,
+        ES_IO,
+        ES_CLOSE,
+        ES_WAIT_CLOSED,
+        ES_FREE,
+        ES_DONE,
+    };
+
+    // the output of one stream
+    struct ExecStream {
+        OutputStream* os;
+        std::string data;
+        int64 bytes = 0;
+        bool truncated = false;
+
+        DLLLOCAL ExecStream(OutputStream* os) : os(os) {
+        }
+    };
+
+    SSH2Client* client;
+    std::string cmd;
+    const SSH2ExecOptions& opts;
+    // the method name for exceptions
+    const char* meth;
+    LIBSSH2_CHANNEL* channel = nullptr;
+    exec_state_t state = ES_OPEN;
+
+    ExecStream out = ExecStream(opts.out);
+    ExecStream err = ExecStream(opts.err);
+    // bytes of input sent
+    size_t input_sent = 0;
+    bool eof_sent = false;
+    // the stream whose last read left a window adjustment partially sent, or -1
+    int pending_read = -1;
+
+    int exit_status = 0;
+    std::string exit_signal;
+
+    std::chrono::steady_clock::time_point start;
+    int64 us = 0;
+    // set by step()
+    bool progress = false;
+
+    // advances the command as far as possible without blocking; see step()
+    DLLLOCAL int stepIntern(ExceptionSink* xsink);
+
+    // returns true if a packet was partially sent and the call that sent it must be repeated before anything else
+    // can be sent on the session
+    DLLLOCAL bool blockedOut() const;
+
+    // reads all data available on the stream; returns -1 if an exception was raised
+    DLLLOCAL int readStream(int stream_id, ExecStream& s, ExceptionSink* xsink);
+
+    // sends any remaining input followed by EOF; returns 1 when EOF has been sent, 0 if the session must wait for
+    // the socket, or -1 if an exception was raised
+    DLLLOCAL int sendInput(ExceptionSink* xsink);
+};
+
+#endif // _QORE_SSH2EXEC_H
@@ -0,0 +1,377 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2FanOut.cpp
+
+    parallel command execution on many hosts
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SSH2Exec.h"
+#include "QC_SSH2Base.h"
+#include "SSH2WorkerPool.h"
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// default number of hosts processed in parallel
+#define SSH2_FANOUT_DEFAULT_WORKERS 16
+// maximum number of hosts processed in parallel
+#define SSH2_FANOUT_MAX_WORKERS 256
+// the maximum number of results waiting to be passed to the callback before the workers stop starting new hosts
+#define SSH2_FANOUT_MAX_QUEUE 64
+
+static const char* SSH2CLIENT_FANOUT_ERROR = "SSH2CLIENT-FANOUT-ERROR";
+
+// a host to run the command on
+struct SSH2FanOutHost {
+    // an unconnected client owned by the fan-out
+    SSH2Client* client;
+    std::string host;
+    int64 port;
+};
+
+// a completed host waiting to be passed to the callback
+struct SSH2FanOutResult {
+    // the index of the host in the host list
+    size_t index;
+    // the hash<Ssh2ExecResult> for the command; null if the command could not be run
+    QoreHashNode* result = nullptr;
+    // the exception raised if the command could not be run
+    std::string err;
+    std::string desc;
+    // the elapsed time for the host including connecting and disconnecting
+    int64 us = 0;
+
+    DLLLOCAL SSH2FanOutResult(size_t i) : index(i) {
+    }
+};
+
+class SSH2FanOut {
+public:
+    DLLLOCAL SSH2FanOut(const char* cmd, const SSH2ExecOptions& opts, int to) : cmd(cmd), opts(opts),
+            timeout_ms(to) {
+    }
+
+    // creates an unconnected client for each element of the list; returns -1 if an exception was raised
+    DLLLOCAL int addHosts(const QoreListNode* l, ExceptionSink* xsink);
+
+    // runs the command on all hosts with the given number of worker threads; returns a hash<Ssh2FanOutInfo>
+    DLLLOCAL QoreHashNode* run(unsigned workers, const ResolvedCallReferenceNode* callback, ExceptionSink* xsink);
+
+    // releases the clients created for the hosts
+    DLLLOCAL void release(ExceptionSink* xsink) {
+        for (auto& i : hosts)
+            static_cast<AbstractPrivateData*>(i.client)->deref(xsink);
+        hosts.clear();
+    }
+
+private:
+    std::string cmd;
+    const SSH2ExecOptions& opts;
+    int timeout_ms;
+
+    std::vector<SSH2FanOutHost> hosts;
+
+    SSH2WorkerPool* pool = nullptr;
+
+    // protects all members below
+    QoreThreadLock l;
+    // signalled when results are queued, when the queue of results is drained, and when all workers have exited
+    QoreCondition cond;
+    // completed hosts waiting to be passed to the callback
+    std::deque<SSH2FanOutResult> out;
+    // the number of background workers still running
+    unsigned live = 0;
+    // set when no more hosts are to be started
+    bool stopped = false;
+
+    // claims the next host; waits while the queue of results is full; returns false when all hosts have been claimed
+    // or the fan-out has been stopped
+    DLLLOCAL bool claim(size_t& i);
+
+    // queues the result of a host for the callback
+    DLLLOCAL void push(SSH2FanOutResult&& r);
+
+    // stops the fan-out; no more hosts are started, but commands already running are allowed to complete
+    DLLLOCAL void stop();
+
+    // connects to a single host, runs the command, and disconnects
+    DLLLOCAL void process(size_t i);
+
+    // returns a hash<Ssh2HostResult> for the result; the result hash is taken from "r"
+    DLLLOCAL QoreHashNode* getHostResult(SSH2FanOutResult& r, ExceptionSink* xsink);
+
+    // releases any results not passed to the callback
+    DLLLOCAL void clearResults(ExceptionSink* xsink);
+
+    DLLLOCAL static void workerThread(ExceptionSink* xsink, void* arg);
+};
+
+int SSH2FanOut::addHosts(const QoreListNode* l, ExceptionSink* xsink) {
+    hosts.reserve(l->size());
+
+    ConstListIterator li(l);
+    while (li.next()) {
+        QoreValue v = li.getValue();
+        SSH2Client* c;
+        switch (v.getType()) {
+            case NT_STRING: {
+                const QoreStringNode* url = v.get<const QoreStringNode>();
+                QoreURL qurl(url);
+                if (!qurl.getHost()) {
+                    xsink->raiseException(SSH2CLIENT_FANOUT_ERROR, "no hostname found in URL '%s' for host %lu",
+                        url->c_str(), (unsigned long)li.index());
+                    return -1;
+                }
+                if (qurl.getProtocol() && strcasecmp("ssh", qurl.getProtocol()->c_str())
+                    && strcasecmp("ssh2", qurl.getProtocol()->c_str())) {
+                    xsink->raiseException(SSH2CLIENT_FANOUT_ERROR, "URL '%s' for host %lu specifies invalid protocol "
+                        "'%s' (expecting 'ssh' or 'ssh2')", url->c_str(), (unsigned long)li.index(),
+                        qurl.getProtocol()->c_str());
+                    return -1;
+                }
+                c = new SSH2Client(qurl);
+                break;
+            }
+
+            case NT_OBJECT: {
+                // SFTPClient objects are accepted as well; only the connection parameters are copied
+                SSH2Client* o = static_cast<SSH2Client*>(v.get<QoreObject>()->getReferencedPrivateData(CID_SSH2BASE,
+                    xsink));
+                if (!o) {
+                    if (!*xsink) {
+                        xsink->raiseException(SSH2CLIENT_FANOUT_ERROR, "host %lu is an object of class '%s'; "
+                            "expecting an SSH2Client or SFTPClient object", (unsigned long)li.index(),
+                            v.get<QoreObject>()->getClassName());
+                    }
+                    return -1;
+                }
+                c = new SSH2Client(*o);
+                static_cast<AbstractPrivateData*>(o)->deref(xsink);
+                break;
+            }
+
+            default:
+                xsink->raiseException(SSH2CLIENT_FANOUT_ERROR, "host %lu has type '%s'; expecting a URL string or an "
+                    "SSH2Client or SFTPClient object", (unsigned long)li.index(), v.getTypeName());
+                return -1;
+        }
+
+        QoreString host;
+        c->getHostLocked(host);
+        hosts.push_back({c, host.c_str(), (int64)c->getPortLocked()});
+    }
+
+    return 0;
+}
+
+QoreHashNode* SSH2FanOut::run(unsigned workers, const ResolvedCallReferenceNode* callback, ExceptionSink* xsink) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SSH2WorkerPool wp(hosts.size());
+    pool = &wp;
+
+    if (workers > hosts.size())
+        workers = hosts.size();
+
+    // the callback is called in this thread; each worker connects to one host at a time and claims the next host as
+    // soon as its command has completed, so a slow host only holds up its own worker
+    for (unsigned i = 0; i < workers; ++i) {
+        {
+            AutoLocker al(l);
+            ++live;
+        }
+        if (wp.startThread(workerThread, this, xsink)) {
+            AutoLocker al(l);
+            --live;
+            // continue with the workers already started
+            if (i)
+                xsink->clear();
+            break;
+        }
+    }
+
+    int64 count = 0;
+    int64 succeeded = 0;
+    bool quit = (bool)*xsink;
+    while (!quit) {
+        std::deque<SSH2FanOutResult> batch;
+        bool done;
+        {
+            AutoLocker al(l);
+            while (out.empty() && live)
+                cond.wait(&l);
+            batch.swap(out);
+            // wake up any workers waiting for space in the queue
+            if (!batch.empty())
+                cond.broadcast();
+            done = !live;
+        }
+
+        for (auto& i : batch) {
+            if (quit) {
+                if (i.result)
+                    i.result->deref(xsink);
+                continue;
+            }
+
+            ++count;
+            if (i.result)
+                ++succeeded;
+
+            ReferenceHolder<QoreListNode> args(new QoreListNode(autoTypeInfo), xsink);
+            args->push(getHostResult(i, xsink), xsink);
+            ValueHolder rv(callback->execValue(*args, xsink), xsink);
+            // the fan-out is stopped if the callback returns False or throws an exception
+            if (*xsink || (rv->getType() == NT_BOOLEAN && !rv->getAsBool())) {
+                stop();
+                quit = true;
+            }
+        }
+
+        if (done)
+            break;
+    }
+
+    wp.wait();
+    pool = nullptr;
+    clearResults(xsink);
+
+    if (*xsink)
+        return nullptr;
+
+    int64 us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    ReferenceHolder<QoreHashNode> rv(new QoreHashNode(hashdeclSsh2FanOutInfo, xsink), xsink);
+    rv->setKeyValue("hosts", (int64)hosts.size(), xsink);
+    rv->setKeyValue("count", count, xsink);
+    rv->setKeyValue("succeeded", succeeded, xsink);
+    rv->setKeyValue("failed", count - succeeded, xsink);
+    rv->setKeyValue("us", us, xsink);
+    return rv.release();
+}
+
+QoreHashNode* SSH2FanOut::getHostResult(SSH2FanOutResult& r, ExceptionSink* xsink) {
+    const SSH2FanOutHost& host = hosts[r.index];
+
+    ReferenceHolder<QoreHashNode> h(new QoreHashNode(hashdeclSsh2HostResult, xsink), xsink);
+    h->setKeyValue("index", (int64)r.index, xsink);
+    h->setKeyValue("host", new QoreStringNode(host.host), xsink);
+    h->setKeyValue("port", host.port, xsink);
+    h->setKeyValue("success", (bool)r.result, xsink);
+    if (r.result) {
+        h->setKeyValue("result", r.result, xsink);
+        r.result = nullptr;
+    } else {
+        h->setKeyValue("err", new QoreStringNode(r.err), xsink);
+        h->setKeyValue("desc", new QoreStringNode(r.desc), xsink);
+    }
+    h->setKeyValue("us", r.us, xsink);
+    return h.release();
+}
+
+bool SSH2FanOut::claim(size_t& i) {
+    AutoLocker al(l);
+    while (!stopped && out.size() >= SSH2_FANOUT_MAX_QUEUE)
+        cond.wait(&l);
+    return !stopped && pool->next(i);
+}
+
+void SSH2FanOut::push(SSH2FanOutResult&& r) {
+    AutoLocker al(l);
+    out.push_back(std::move(r));
+    cond.broadcast();
+}
+
+void SSH2FanOut::stop() {
+    AutoLocker al(l);
+    stopped = true;
+    pool->stop();
+    cond.broadcast();
+}
+
+void SSH2FanOut::clearResults(ExceptionSink* xsink) {
+    for (auto& i : out) {
+        if (i.result)
+            i.result->deref(xsink);
+    }
+    out.clear();
+}
+
+void SSH2FanOut::process(size_t i) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SSH2Client* client = hosts[i].client;
+
+    SSH2FanOutResult r(i);
+    ExceptionSink xsink;
+    if (!client->sshConnect(timeout_ms, &xsink)) {
+        r.result = client->run(cmd.c_str(), opts, timeout_ms, &xsink);
+        client->disconnect(true, timeout_ms);
+    }
+    if (xsink) {
+        getExceptionInfo(xsink, r.err, r.desc);
+        xsink.clear();
+    }
+    r.us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    push(std::move(r));
+}
+
+void SSH2FanOut::workerThread(ExceptionSink* xsink, void* arg) {
+    SSH2FanOut* fo = reinterpret_cast<SSH2FanOut*>(arg);
+    SSH2WorkerPool* pool = fo->pool;
+
+    size_t i;
+    while (fo->claim(i))
+        fo->process(i);
+
+    {
+        AutoLocker al(fo->l);
+        if (!--fo->live)
+            fo->cond.broadcast();
+    }
+
+    // "fo" must not be accessed after this call
+    pool->workerDone();
+}
+
+QoreHashNode* SSH2Client::fanOut(const QoreListNode* hosts, const char* cmd,
+        const ResolvedCallReferenceNode* callback, const QoreHashNode* opts, int timeout_ms, ExceptionSink* xsink) {
+    int64 workers = getIntOption(opts, "workers", SSH2_FANOUT_DEFAULT_WORKERS);
+    if (workers < 1 || workers > SSH2_FANOUT_MAX_WORKERS) {
+        xsink->raiseException(SSH2CLIENT_FANOUT_ERROR, "invalid \"workers\" option " QLLD "; expecting a value from 1 "
+            "to %d", workers, SSH2_FANOUT_MAX_WORKERS);
+        return nullptr;
+    }
+
+    SSH2ExecOptions eo;
+    if (get_exec_options(opts, eo, SSH2CLIENT_FANOUT_ERROR, xsink))
+        return nullptr;
+
+    SSH2FanOut fo(cmd, eo, timeout_ms);
+    QoreHashNode* rv = nullptr;
+    if (!fo.addHosts(hosts, xsink))
+        rv = fo.run((unsigned)workers, callback, xsink);
+    fo.release(xsink);
+    return rv;
+}
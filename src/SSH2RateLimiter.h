@@ -0,0 +1,124 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2RateLimiter.h
+
+    token bucket bandwidth limits for ssh2 transfers
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2RATELIMITER_H
+
+#define _QORE_SSH2RATELIMITER_H
+
+#include "ssh2-module.h"
+
+#include <atomic>
+#include <chrono>
+
+// a token bucket shared by any number of threads; transfers are charged after the fact, and a transfer that takes
+// the bucket below zero is delayed until the debt has been repaid at the configured rate
+class SSH2RateLimiter {
+public:
+    // sets the rate in bytes per second and the bucket size in bytes; a rate of 0 removes the limit; a burst of 0
+    // sets the bucket size to one second of data at the given rate
+    DLLLOCAL void set(int64 new_rate, int64 new_burst) {
+        AutoLocker al(l);
+        burst = new_burst > 0 ? new_burst : new_rate;
+        tokens = (double)burst;
+        last = std::chrono::steady_clock::now();
+        rate = new_rate > 0 ? new_rate : 0;
+    }
+
+    DLLLOCAL bool enabled() const {
+        return rate.load(std::memory_order_relaxed) > 0;
+    }
+
+    // charges the given number of bytes and returns the number of microseconds the caller must wait
+    DLLLOCAL int64 charge(size_t bytes) {
+        if (!enabled())
+            return 0;
+
+        AutoLocker al(l);
+        int64 r = rate;
+        if (!r)
+            return 0;
+        refill(r);
+        tokens -= (double)bytes;
+        if (tokens >= 0)
+            return 0;
+
+        int64 us = (int64)(-tokens * 1000000.0 / (double)r);
+        throttled_us += us;
+        ++throttled;
+        return us;
+    }
+
+    // returns a hash<Ssh2RateLimitInfo> or nullptr if there is no limit
+    DLLLOCAL QoreHashNode* getInfo(ExceptionSink* xsink) {
+        if (!enabled())
+            return nullptr;
+
+        AutoLocker al(l);
+        int64 r = rate;
+        if (!r)
+            return nullptr;
+        refill(r);
+
+        QoreHashNode* h = new QoreHashNode(hashdeclSsh2RateLimitInfo, xsink);
+        h->setKeyValue("rate", r, xsink);
+        h->setKeyValue("burst", burst, xsink);
+        h->setKeyValue("available", (int64)tokens, xsink);
+        h->setKeyValue("throttled", throttled, xsink);
+        h->setKeyValue("throttled_us", throttled_us, xsink);
+        return h;
+    }
+
+private:
+    QoreThreadLock l;
+    // bytes per second; 0 = no limit
+    std::atomic<int64> rate{0};
+    // bucket size in bytes
+    int64 burst = 0;
+    // available bytes; negative if transfers have been charged in advance of the rate
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last;
+
+    // the number of times a transfer was delayed and the total delay
+    int64 throttled = 0;
+    int64 throttled_us = 0;
+
+    // adds tokens for the time elapsed since the last call; the lock must be held
+    DLLLOCAL void refill(int64 r) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        int64 us = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+        if (us <= 0)
+            return;
+        last = now;
+        tokens += (double)us * (double)r / 1000000.0;
+        if (tokens > (double)burst)
+            tokens = (double)burst;
+    }
+};
+
+// process-wide limits for all connections
+DLLLOCAL extern SSH2RateLimiter ssh2_global_rate_in;
+DLLLOCAL extern SSH2RateLimiter ssh2_global_rate_out;
+
+#endif // _QORE_SSH2RATELIMITER_H
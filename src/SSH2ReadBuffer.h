@@ -0,0 +1,126 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2ReadBuffer.h
+
+    read-ahead buffer for delimited reads from a channel stream
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2READBUFFER_H
+
+#define _QORE_SSH2READBUFFER_H
+
+#include "ssh2-module.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <string.h>
+
+// holds data read from a channel stream but not yet returned; data is appended at the tail and consumed from the
+// head, and the unconsumed data is only moved to the front of the buffer when more space is needed; the buffer has no
+// lock of its own and is only accessed with the client lock held
+class SSH2ReadBuffer {
+public:
+    DLLLOCAL const char* data() const {
+        return buf.get() + head;
+    }
+
+    DLLLOCAL size_t size() const {
+        return tail - head;
+    }
+
+    DLLLOCAL bool empty() const {
+        return head == tail;
+    }
+
+    // removes the given number of bytes from the front of the buffer
+    DLLLOCAL void consume(size_t len) {
+        assert(len <= size());
+        head += len;
+        if (head == tail)
+            head = tail = 0;
+    }
+
+    // copies up to "len" bytes to "dest" and removes them from the buffer; returns the number of bytes copied
+    DLLLOCAL size_t take(void* dest, size_t len) {
+        if (len > size())
+            len = size();
+        if (len) {
+            memcpy(dest, data(), len);
+            consume(len);
+        }
+        return len;
+    }
+
+    // returns a pointer to at least "len" bytes of free space after the buffered data; call commit() with the number
+    // of bytes written there
+    DLLLOCAL char* space(size_t len) {
+        if (cap - tail < len) {
+            if (head) {
+                memmove(buf.get(), data(), size());
+                tail -= head;
+                head = 0;
+            }
+            if (cap - tail < len) {
+                size_t ncap = std::max(cap * 2, tail + len);
+                std::unique_ptr<char[]> nbuf(new char[ncap]);
+                if (tail)
+                    memcpy(nbuf.get(), buf.get(), tail);
+                buf = std::move(nbuf);
+                cap = ncap;
+            }
+        }
+        return buf.get() + tail;
+    }
+
+    DLLLOCAL void commit(size_t len) {
+        assert(len <= cap - tail);
+        tail += len;
+    }
+
+    // returns the offset of the first occurrence of the delimiter at or after the given offset, or -1 if not found
+    DLLLOCAL int64 find(const char* delim, size_t dlen, size_t offset) const {
+        assert(dlen);
+        const char* start = data();
+        size_t len = size();
+        while (offset + dlen <= len) {
+            // memchr() is vectorized by the C library, so the buffer is scanned for the first byte of the delimiter
+            const char* p = static_cast<const char*>(memchr(start + offset, delim[0], len - offset - dlen + 1));
+            if (!p)
+                break;
+            offset = p - start;
+            if (dlen == 1 || !memcmp(p + 1, delim + 1, dlen - 1))
+                return offset;
+            ++offset;
+        }
+        return -1;
+    }
+
+private:
+    std::unique_ptr<char[]> buf;
+    size_t cap = 0;
+    // offset of the first unconsumed byte
+    size_t head = 0;
+    // offset after the last byte buffered
+    size_t tail = 0;
+};
+
+#endif // _QORE_SSH2READBUFFER_H
@@ -0,0 +1,1149 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2Relay.cpp
+
+    native relay engine for port forwarding
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "SSH2Relay.h"
+#include "SSH2Channel.h"
+
+#include <utility>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef _Q_WINDOWS
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const char* SSH2CLIENT_FORWARDLOCALPORT_ERROR = "SSH2CLIENT-FORWARDLOCALPORT-ERROR";
+static const char* SSH2CLIENT_FORWARDREMOTEPORT_ERROR = "SSH2CLIENT-FORWARDREMOTEPORT-ERROR";
+
+int relay_parse_bind(const char* bind, std::string& host, int& port, const char* err, ExceptionSink* xsink) {
+    std::string pstr;
+    const char* p = strrchr(bind, ':');
+    if (p) {
+        host.assign(bind, p - bind);
+        pstr = p + 1;
+        // IPv6 addresses are enclosed in square brackets
+        if (host.size() >= 2 && host[0] == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+    } else {
+        host.clear();
+        pstr = bind;
+    }
+
+    if (pstr.empty() || pstr.size() > 5 || pstr.find_first_not_of("0123456789") != std::string::npos
+        || (port = atoi(pstr.c_str())) > 65535) {
+        xsink->raiseException(err, "invalid bind address \"%s\"; expecting a port number optionally preceded by a "
+            "host name or address and a colon", bind);
+        return -1;
+    }
+    return 0;
+}
+
+#ifndef _Q_WINDOWS
+// sets a descriptor to non-blocking mode and close-on-exec
+static void relay_set_fd_flags(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// returns true if a socket call failed only because it would block
+static bool relay_would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+static pollfd relay_pollfd(int fd, short events) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    return pfd;
+}
+
+// gets the numeric host and port of a socket address
+static void relay_get_addr(const struct sockaddr* addr, socklen_t len, std::string& host, int& port) {
+    char hbuf[NI_MAXHOST], sbuf[NI_MAXSERV];
+    if (getnameinfo(addr, len, hbuf, sizeof hbuf, sbuf, sizeof sbuf, NI_NUMERICHOST | NI_NUMERICSERV)) {
+        host = "0.0.0.0";
+        port = 0;
+        return;
+    }
+    host = hbuf;
+    port = atoi(sbuf);
+}
+#endif
+
+SSH2Relay::SSH2Relay(SSH2Client* client, const char* type, const char* target_host, int target_port,
+        size_t max_connections) : client(client), type(type), target_host(target_host), target_port(target_port),
+        max_connections(max_connections) {
+    client->ref();
+}
+
+SSH2Relay::~SSH2Relay() {
+    assert(!thread_running);
+    assert(conns.empty());
+#ifndef _Q_WINDOWS
+    for (int i = 0; i < 2; ++i) {
+        if (wake_pipe[i] != -1)
+            ::close(wake_pipe[i]);
+    }
+#endif
+}
+
+#ifdef _Q_WINDOWS
+int SSH2Relay::start(const char* err, ExceptionSink* xsink) {
+    xsink->raiseException(err, "port forwarding is not supported on this platform");
+    return -1;
+}
+
+void SSH2Relay::stop() {
+}
+#else
+int SSH2Relay::start(const char* err, ExceptionSink* xsink) {
+    if (pipe(wake_pipe)) {
+        xsink->raiseErrnoException(err, errno, "failed to create the wakeup pipe for the relay thread");
+        wake_pipe[0] = wake_pipe[1] = -1;
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i)
+        relay_set_fd_flags(wake_pipe[i]);
+
+    {
+        AutoLocker al(client->m);
+        if (!client->ssh_session) {
+            xsink->raiseException("SSH2CLIENT-NOT-CONNECTED", "cannot forward connections while the client is not "
+                "connected");
+            return -1;
+        }
+        client->relay_set.insert(this);
+    }
+
+    {
+        AutoLocker al(l);
+        thread_running = true;
+    }
+    if (q_start_thread(xsink, relayThread, this) < 0) {
+        {
+            AutoLocker al(client->m);
+            client->relay_set.erase(this);
+        }
+        AutoLocker al(l);
+        thread_running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void SSH2Relay::stop() {
+    stopping = true;
+    if (wake_pipe[1] != -1) {
+        char c = 0;
+        if (write(wake_pipe[1], &c, 1) < 0) {
+            // the pipe is full, so the thread will be woken up anyway
+        }
+    }
+
+    AutoLocker al(l);
+    while (thread_running)
+        cond.wait(&l);
+}
+
+void SSH2Relay::relayThread(ExceptionSink* xsink, void* arg) {
+    static_cast<SSH2Relay*>(arg)->run();
+}
+
+void SSH2Relay::run() {
+    printd(5, "SSH2Relay::run() %p: %s relay started on %s:%d\n", this, type, bind_host.c_str(), bind_port);
+
+    client->m.lock();
+    while (!stopping && !closed) {
+        client->setBlockingUnlocked(false);
+        bool hold = passUnlocked();
+        if (stopping || closed)
+            break;
+
+        int wait_ms = preparePollUnlocked(std::chrono::steady_clock::now());
+        // the lock is kept while a channel is being opened or a packet has been partially sent, as libssh2 would
+        // continue the open or reject any other data sent by another thread in the meantime
+        if (!hold) {
+            client->setBlockingUnlocked(true);
+            client->m.unlock();
+        }
+
+        int rc = poll(pfds.data(), pfds.size(), wait_ms);
+        if (rc < 0 && errno != EINTR)
+            setError("error waiting for network: %s", strerror(errno));
+
+        if (!hold)
+            client->m.lock();
+
+        if (rc > 0)
+            processPoll();
+    }
+
+    // connections are closed without blocking
+    client->setBlockingUnlocked(false);
+    shutdownUnlocked();
+    client->relay_set.erase(this);
+    client->setBlockingUnlocked(true);
+    client->m.unlock();
+
+    printd(5, "SSH2Relay::run() %p: %s relay on %s:%d stopped\n", this, type, bind_host.c_str(), bind_port);
+
+    AutoLocker al(l);
+    thread_running = false;
+    cond.broadcast();
+}
+
+bool SSH2Relay::passUnlocked() {
+    time_point_t now = std::chrono::steady_clock::now();
+    transport_read = false;
+
+    // a window adjustment left partially sent by another operation on the session must be completed first
+    if (client->trySendPendingUnlocked() > 0)
+        return true;
+
+    // a partially-sent packet can only be completed by repeating the same call
+    if (blocked) {
+        RelayConn* c = blocked;
+        blocked = nullptr;
+        int rc = stepUnlocked(*c, now);
+        if (rc == RS_BLOCKED) {
+            blocked = c;
+            return true;
+        }
+        if (rc == RS_DONE) {
+            for (conn_list_t::iterator i = conns.begin(), e = conns.end(); i != e; ++i) {
+                if (i->get() == c) {
+                    removeConn(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    acceptUnlocked();
+    if (blockedOutUnlocked())
+        return true;
+
+    for (conn_list_t::iterator i = conns.begin(); i != conns.end();) {
+        RelayConn& c = **i;
+        // libssh2 keeps the state of a channel open in the session, so only one channel is opened at a time
+        if (c.state == RC_OPENING && opening && opening != &c) {
+            ++i;
+            continue;
+        }
+        int rc = stepUnlocked(c, now);
+        if (rc == RS_BLOCKED) {
+            blocked = &c;
+            return true;
+        }
+        if (rc == RS_DONE)
+            i = removeConn(i);
+        else
+            ++i;
+        if (stopping)
+            return false;
+    }
+
+    return opening != nullptr;
+}
+
+int SSH2Relay::stepUnlocked(RelayConn& c, time_point_t now) {
+    switch (c.state) {
+        case RC_OPENING: {
+            opening = &c;
+            int rc = openUnlocked(c);
+            if (rc == RS_DONE || c.state != RC_OPENING)
+                opening = nullptr;
+            return rc;
+        }
+
+        case RC_CONNECTING: {
+            if (!c.writable)
+                return RS_OK;
+            int err = 0;
+            socklen_t len = sizeof err;
+            if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len))
+                err = errno;
+            if (err) {
+                connectFailedUnlocked(c, err);
+                return closeConnUnlocked(c);
+            }
+            c.state = RC_OPEN;
+            return stepUnlocked(c, now);
+        }
+
+        case RC_OPEN: {
+            int rc = relayUnlocked(c, now);
+            return rc == RS_DONE ? closeConnUnlocked(c) : rc;
+        }
+
+        case RC_CLOSING:
+            return closeConnUnlocked(c);
+    }
+
+    return RS_OK;
+}
+
+int SSH2Relay::relayUnlocked(RelayConn& c, time_point_t now) {
+    // a partially-sent packet can only be completed by repeating the same call
+    if (c.pending != RO_NONE) {
+        int rc = resumeUnlocked(c, now);
+        if (rc != RS_OK)
+            return rc;
+    }
+
+    for (int round = 0; round < QSSH2_RELAY_ROUNDS; ++round) {
+        bool progress = false;
+
+        // socket -> channel
+        if (!c.up_len && !c.sock_eof && c.readable && c.fd != -1 && now >= send_resume) {
+            ssize_t n = ::recv(c.fd, c.up.get(), QSSH2_BUFSIZE, 0);
+            if (n > 0) {
+                c.up_off = 0;
+                c.up_len = n;
+                progress = true;
+            } else if (!n) {
+                c.sock_eof = true;
+                progress = true;
+            } else if (relay_would_block(errno)) {
+                c.readable = false;
+            } else {
+                ++failed;
+                setError("error reading from the connection from %s:%d: %s", c.peer_host.c_str(), c.peer_port,
+                    strerror(errno));
+                return RS_DONE;
+            }
+        }
+
+        if (c.up_len) {
+            int rc = writeChannelUnlocked(c, now, progress);
+            if (rc != RS_OK)
+                return rc;
+        }
+
+        if (c.sock_eof && !c.up_len && !c.eof_sent) {
+            int rc = sendEofUnlocked(c, progress);
+            if (rc != RS_OK)
+                return rc;
+        }
+
+        // channel -> socket; the first read in a pass reads all packets available from the socket, so other
+        // channels are only read if data or EOF has been received for them
+        if (!c.down_len && !c.chan_eof && now >= recv_resume) {
+            unsigned long avail = 0;
+            if (transport_read)
+                libssh2_channel_window_read_ex(c.channel, &avail, nullptr);
+            if (!transport_read || avail || libssh2_channel_eof(c.channel)) {
+                transport_read = true;
+                int rc = readChannelUnlocked(c, now, progress);
+                if (rc != RS_OK)
+                    return rc;
+            }
+        }
+
+        if (c.down_len && c.writable && c.fd != -1) {
+            ssize_t n = ::send(c.fd, c.down.get() + c.down_off, c.down_len, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.down_off += n;
+                c.down_len -= n;
+                progress = true;
+            } else if (n < 0 && relay_would_block(errno)) {
+                c.writable = false;
+            } else {
+                ++failed;
+                setError("error writing to the connection from %s:%d: %s", c.peer_host.c_str(), c.peer_port,
+                    strerror(errno));
+                return RS_DONE;
+            }
+        }
+
+        if (c.chan_eof && !c.down_len && !c.shut_wr && c.fd != -1) {
+            ::shutdown(c.fd, SHUT_WR);
+            c.shut_wr = true;
+        }
+
+        if (c.eof_sent && c.shut_wr)
+            return RS_DONE;
+
+        if (!progress)
+            break;
+    }
+
+    return RS_OK;
+}
+
+int SSH2Relay::resumeUnlocked(RelayConn& c, time_point_t now) {
+    relay_op_t op = c.pending;
+    c.pending = RO_NONE;
+    // progress is not tracked here, as the connection is served in the rounds that follow
+    bool progress = false;
+    switch (op) {
+        case RO_WRITE:
+            return writeChannelUnlocked(c, now, progress);
+        case RO_EOF:
+            return sendEofUnlocked(c, progress);
+        case RO_READ:
+            return readChannelUnlocked(c, now, progress);
+        case RO_ADJUST:
+            return adjustWindowUnlocked(c);
+        case RO_NONE:
+            break;
+    }
+    return RS_OK;
+}
+
+int SSH2Relay::writeChannelUnlocked(RelayConn& c, time_point_t now, bool& progress) {
+    while (c.up_len) {
+        ssize_t rc = libssh2_channel_write_ex(c.channel, 0, c.up.get() + c.up_off, c.up_len);
+        if (rc == LIBSSH2_ERROR_EAGAIN) {
+            if (blockedOutUnlocked()) {
+                c.pending = RO_WRITE;
+                return RS_BLOCKED;
+            }
+            break;
+        }
+        if (rc < 0)
+            return connSessionErrorUnlocked(c, "writing to the channel");
+        c.up_off += rc;
+        c.up_len -= rc;
+        bytes_sent += rc;
+        int64 us = client->throttleDelay(false, rc);
+        if (us)
+            send_resume = now + std::chrono::microseconds(us);
+        progress = true;
+    }
+    return RS_OK;
+}
+
+int SSH2Relay::sendEofUnlocked(RelayConn& c, bool& progress) {
+    int rc = libssh2_channel_send_eof(c.channel);
+    if (!rc) {
+        c.eof_sent = true;
+        progress = true;
+        return RS_OK;
+    }
+    if (rc != LIBSSH2_ERROR_EAGAIN)
+        return connSessionErrorUnlocked(c, "sending EOF on the channel");
+    if (blockedOutUnlocked()) {
+        c.pending = RO_EOF;
+        return RS_BLOCKED;
+    }
+    return RS_OK;
+}
+
+int SSH2Relay::readChannelUnlocked(RelayConn& c, time_point_t now, bool& progress) {
+    ssize_t rc = libssh2_channel_read_ex(c.channel, 0, c.down.get(), QSSH2_BUFSIZE);
+    if (rc > 0) {
+        c.down_off = 0;
+        c.down_len = rc;
+        bytes_received += rc;
+        int64 us = client->throttleDelay(true, rc);
+        if (us)
+            recv_resume = now + std::chrono::microseconds(us);
+        progress = true;
+        if (c.window && SSH2Channel::adjustWindow(c.channel, c.window, c.max_window, rc < QSSH2_BUFSIZE)
+            == LIBSSH2_ERROR_EAGAIN && blockedOutUnlocked()) {
+            c.pending = RO_ADJUST;
+            return RS_BLOCKED;
+        }
+        return RS_OK;
+    }
+    if (rc && rc != LIBSSH2_ERROR_EAGAIN)
+        return connSessionErrorUnlocked(c, "reading from the channel");
+    // libssh2 sends a window adjustment itself before reading if the window is low
+    if (rc && blockedOutUnlocked()) {
+        c.pending = RO_READ;
+        return RS_BLOCKED;
+    }
+    if (libssh2_channel_eof(c.channel)) {
+        c.chan_eof = true;
+        progress = true;
+    }
+    return RS_OK;
+}
+
+int SSH2Relay::adjustWindowUnlocked(RelayConn& c) {
+    // libssh2 sends the packet already prepared, so the arguments are not used
+    int rc = libssh2_channel_receive_window_adjust2(c.channel, 0, 0, nullptr);
+    if (rc == LIBSSH2_ERROR_EAGAIN && blockedOutUnlocked()) {
+        c.pending = RO_ADJUST;
+        return RS_BLOCKED;
+    }
+    // other errors are reported by the next read
+    return RS_OK;
+}
+
+int SSH2Relay::closeConnUnlocked(RelayConn& c) {
+    if (c.fd != -1) {
+        ::close(c.fd);
+        c.fd = -1;
+    }
+    if (!c.channel)
+        return RS_DONE;
+
+    c.state = RC_CLOSING;
+    int rc = libssh2_channel_free(c.channel);
+    if (rc == LIBSSH2_ERROR_EAGAIN)
+        return blockedOutUnlocked() ? RS_BLOCKED : RS_OK;
+    c.channel = nullptr;
+    return RS_DONE;
+}
+
+void SSH2Relay::abortConnUnlocked(RelayConn& c) {
+    if (c.fd != -1) {
+        ::close(c.fd);
+        c.fd = -1;
+    }
+    // a connection with a pending call keeps its state until the call has been completed
+    if ((c.state == RC_OPEN || c.state == RC_CONNECTING) && &c != blocked)
+        c.state = RC_CLOSING;
+}
+
+void SSH2Relay::shutdownUnlocked() {
+    if (closed) {
+        // all channels have been freed with the session
+        while (!conns.empty())
+            removeConn(conns.begin());
+        closeListenerUnlocked(true);
+        return;
+    }
+
+    // connections are closed in passes like in normal operation, so a channel open in progress and a
+    // partially-sent packet are completed before the lock is released
+    for (conn_list_t::iterator i = conns.begin(); i != conns.end();) {
+        RelayConn& c = **i;
+        if (c.state == RC_OPENING && &c != opening) {
+            i = removeConn(i);
+            continue;
+        }
+        abortConnUnlocked(c);
+        ++i;
+    }
+
+    int64 start = q_clock_getmillis();
+    while (!conns.empty() && !closed) {
+        time_point_t now = std::chrono::steady_clock::now();
+        bool wait = false;
+        for (conn_list_t::iterator i = conns.begin(); i != conns.end();) {
+            RelayConn& c = **i;
+            if (blocked && blocked != &c) {
+                ++i;
+                continue;
+            }
+            blocked = nullptr;
+            int rc = stepUnlocked(c, now);
+            if (rc == RS_BLOCKED) {
+                blocked = &c;
+                wait = true;
+                break;
+            }
+            if (rc == RS_DONE) {
+                i = removeConn(i);
+                continue;
+            }
+            // the channel may have been opened or the pending call completed
+            abortConnUnlocked(c);
+            wait = true;
+            ++i;
+        }
+        if (wait && !conns.empty() && !waitShutdownUnlocked(start))
+            break;
+    }
+
+    while (!conns.empty())
+        removeConn(conns.begin());
+
+    // the listener is closed last, as closing it can require sending data, which is only possible once no packet
+    // remains partially sent
+    closeListenerUnlocked(closed);
+}
+
+bool SSH2Relay::waitShutdownUnlocked(int64 start) {
+    int64 left = DEFAULT_TIMEOUT_MS - (q_clock_getmillis() - start);
+    if (left > 0 && client->waitSocketUnlocked((int)left) > 0)
+        return true;
+
+    // if the server does not respond, the connection is closed if a channel open is in progress or a packet has
+    // been partially sent, as libssh2 could not continue with any other operation; otherwise any remaining channels
+    // are freed with the session
+    if (blocked || opening || blockedOutUnlocked())
+        client->disconnectUnlocked(true);
+    return false;
+}
+
+int SSH2Relay::preparePollUnlocked(time_point_t now) {
+    pfds.clear();
+    pfds.push_back(relay_pollfd(wake_pipe[0], POLLIN));
+    pfds.push_back(relay_pollfd(client->socket.getSocket(), blockedOutUnlocked() ? POLLIN | POLLOUT : POLLIN));
+    addListenFds(pfds);
+
+    // set if data can be moved without waiting
+    bool ready = false;
+    for (auto& i : conns) {
+        RelayConn& c = *i;
+        c.pidx = -1;
+        if (c.fd == -1)
+            continue;
+        if (c.state == RC_CONNECTING) {
+            c.pidx = pfds.size();
+            pfds.push_back(relay_pollfd(c.fd, POLLOUT));
+            continue;
+        }
+        if (c.state != RC_OPEN)
+            continue;
+        short events = 0;
+        if (!c.up_len && !c.sock_eof) {
+            if (!c.readable)
+                events |= POLLIN;
+            else if (now >= send_resume)
+                ready = true;
+        }
+        if (c.down_len) {
+            if (!c.writable)
+                events |= POLLOUT;
+            else
+                ready = true;
+        }
+        if (!events)
+            continue;
+        c.pidx = pfds.size();
+        pfds.push_back(relay_pollfd(c.fd, events));
+    }
+
+    if (ready)
+        return 0;
+    return conns.empty() ? QSSH2_RELAY_IDLE_MS : QSSH2_RELAY_POLL_MS;
+}
+
+void SSH2Relay::processPoll() {
+    if (pfds[0].revents) {
+        char buf[64];
+        while (read(wake_pipe[0], buf, sizeof buf) > 0) {
+        }
+    }
+
+    for (auto& i : conns) {
+        RelayConn& c = *i;
+        if (c.pidx < 0)
+            continue;
+        short revents = pfds[c.pidx].revents;
+        if (revents & (POLLIN | POLLHUP | POLLERR))
+            c.readable = true;
+        if (revents & (POLLOUT | POLLHUP | POLLERR))
+            c.writable = true;
+    }
+}
+#endif
+
+void SSH2Relay::sessionClosedUnlocked() {
+    closed = true;
+    blocked = opening = nullptr;
+    for (auto& i : conns)
+        i->channel = nullptr;
+#ifndef _Q_WINDOWS
+    if (wake_pipe[1] != -1) {
+        char c = 0;
+        if (write(wake_pipe[1], &c, 1) < 0) {
+            // the pipe is full, so the thread will be woken up anyway
+        }
+    }
+#endif
+}
+
+SSH2Relay::RelayConn* SSH2Relay::addConn(int fd, relay_state_t state, std::string peer_host, int peer_port) {
+    conns.emplace_back(new RelayConn(fd, state, std::move(peer_host), peer_port));
+    ++connections;
+    ++active;
+    return conns.back().get();
+}
+
+SSH2Relay::conn_list_t::iterator SSH2Relay::removeConn(conn_list_t::iterator i) {
+    RelayConn& c = **i;
+#ifndef _Q_WINDOWS
+    if (c.fd != -1)
+        ::close(c.fd);
+#endif
+    if (opening == &c)
+        opening = nullptr;
+    if (blocked == &c)
+        blocked = nullptr;
+    if (c.up && free_bufs.size() < QSSH2_RELAY_MAX_FREE_BUFS)
+        free_bufs.push_back(std::move(c.up));
+    if (c.down && free_bufs.size() < QSSH2_RELAY_MAX_FREE_BUFS)
+        free_bufs.push_back(std::move(c.down));
+    --active;
+    return conns.erase(i);
+}
+
+std::unique_ptr<char[]> SSH2Relay::getBuf() {
+    if (free_bufs.empty())
+        return std::unique_ptr<char[]>(new char[QSSH2_BUFSIZE]);
+    std::unique_ptr<char[]> rv = std::move(free_bufs.back());
+    free_bufs.pop_back();
+    return rv;
+}
+
+void SSH2Relay::openedUnlocked(RelayConn& c, LIBSSH2_CHANNEL* channel) {
+    c.channel = channel;
+    if (c.state == RC_OPENING)
+        c.state = RC_OPEN;
+    c.up = getBuf();
+    c.down = getBuf();
+    c.window = client->chan_window;
+    c.max_window = client->chan_max_window > c.window ? client->chan_max_window : c.window;
+}
+
+void SSH2Relay::setError(const char* fmt, ...) {
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof buf, fmt, args);
+    va_end(args);
+
+    printd(5, "SSH2Relay::setError() %p: %s\n", this, buf);
+    AutoLocker al(l);
+    last_error = buf;
+}
+
+int SSH2Relay::connSessionErrorUnlocked(RelayConn& c, const char* action) {
+    int err = libssh2_session_last_errno(client->ssh_session);
+    // the server has closed the channel
+    if (err == LIBSSH2_ERROR_CHANNEL_CLOSED || err == LIBSSH2_ERROR_CHANNEL_EOF_SENT)
+        return RS_DONE;
+
+    ++failed;
+    setError("error %s for the connection from %s:%d: libssh2 returned error %d: %s", action, c.peer_host.c_str(),
+        c.peer_port, err, client->getSessionErrUnlocked());
+    // the relay stops if the connection to the server has been lost
+    if (err == LIBSSH2_ERROR_SOCKET_SEND || err == LIBSSH2_ERROR_SOCKET_RECV || err == LIBSSH2_ERROR_SOCKET_DISCONNECT)
+        stopping = true;
+    return RS_DONE;
+}
+
+void SSH2Relay::connectFailedUnlocked(RelayConn& c, int err) {
+    ++failed;
+    setError("cannot connect to %s:%d for the connection on %s:%d: %s", target_host.c_str(), target_port,
+        c.peer_host.c_str(), c.peer_port, strerror(err));
+    c.state = RC_CLOSING;
+}
+
+QoreHashNode* SSH2Relay::getInfo(ExceptionSink* xsink) const {
+    QoreHashNode* h = new QoreHashNode(hashdeclSsh2PortForwardInfo, xsink);
+    h->setKeyValue("type", new QoreStringNode(type), xsink);
+    h->setKeyValue("bind_host", new QoreStringNode(bind_host), xsink);
+    h->setKeyValue("bind_port", (int64)bind_port, xsink);
+    h->setKeyValue("target_host", new QoreStringNode(target_host), xsink);
+    h->setKeyValue("target_port", (int64)target_port, xsink);
+    h->setKeyValue("active", active.load(), xsink);
+    h->setKeyValue("connections", connections.load(), xsink);
+    h->setKeyValue("failed", failed.load(), xsink);
+    h->setKeyValue("bytes_sent", bytes_sent.load(), xsink);
+    h->setKeyValue("bytes_received", bytes_received.load(), xsink);
+
+    AutoLocker al(l);
+    h->setKeyValue("running", thread_running, xsink);
+    if (!last_error.empty())
+        h->setKeyValue("error", new QoreStringNode(last_error), xsink);
+    return h;
+}
+
+SSH2LocalForward::~SSH2LocalForward() {
+#ifndef _Q_WINDOWS
+    if (listen_fd != -1)
+        ::close(listen_fd);
+#endif
+}
+
+#ifdef _Q_WINDOWS
+int SSH2LocalForward::listenOn(const char* bind, const char* err, ExceptionSink* xsink) {
+    xsink->raiseException(err, "port forwarding is not supported on this platform");
+    return -1;
+}
+
+void SSH2LocalForward::acceptUnlocked() {
+}
+
+void SSH2LocalForward::addListenFds(std::vector<pollfd>& fds) {
+}
+
+int SSH2LocalForward::openUnlocked(RelayConn& c) {
+    return RS_DONE;
+}
+
+void SSH2LocalForward::closeListenerUnlocked(bool freed) {
+}
+#else
+int SSH2LocalForward::listenOn(const char* bind, const char* err, ExceptionSink* xsink) {
+    std::string host;
+    int port;
+    if (relay_parse_bind(bind, host, port, err, xsink))
+        return -1;
+
+    // like "ssh -L", connections are only accepted on the loopback interface unless a host is given; "*" accepts
+    // connections on all interfaces
+    if (host.empty())
+        host = "127.0.0.1";
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo* ai;
+    int rc = getaddrinfo(host == "*" ? nullptr : host.c_str(), std::to_string(port).c_str(), &hints, &ai);
+    if (rc) {
+        xsink->raiseException(err, "cannot resolve bind address \"%s\": %s", bind, gai_strerror(rc));
+        return -1;
+    }
+
+    int eno = 0;
+    for (struct addrinfo* a = ai; a; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd == -1) {
+            eno = errno;
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+        if (!::bind(fd, a->ai_addr, a->ai_addrlen) && !listen(fd, SOMAXCONN)) {
+            listen_fd = fd;
+            break;
+        }
+        eno = errno;
+        ::close(fd);
+    }
+    freeaddrinfo(ai);
+
+    if (listen_fd == -1) {
+        xsink->raiseErrnoException(err, eno, "cannot listen on \"%s\"", bind);
+        return -1;
+    }
+    relay_set_fd_flags(listen_fd);
+
+    // get the address actually bound, so the port is known if port 0 was given
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof addr;
+    if (!getsockname(listen_fd, (struct sockaddr*)&addr, &len))
+        relay_get_addr((struct sockaddr*)&addr, len, bind_host, bind_port);
+    return 0;
+}
+
+void SSH2LocalForward::acceptUnlocked() {
+    if (listen_fd == -1)
+        return;
+    time_point_t now = std::chrono::steady_clock::now();
+    if (now < accept_resume)
+        return;
+
+    while (conns.size() < max_connections) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof addr;
+        int fd = accept(listen_fd, (struct sockaddr*)&addr, &len);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (!relay_would_block(errno)) {
+                // for example, if the process has run out of descriptors; new connections are accepted again
+                // after a delay
+                setError("error accepting a connection on %s:%d: %s", bind_host.c_str(), bind_port,
+                    strerror(errno));
+                accept_resume = now + std::chrono::milliseconds(QSSH2_RELAY_IDLE_MS);
+            }
+            break;
+        }
+        relay_set_fd_flags(fd);
+        // forwarded protocols are often interactive, so small writes are not delayed
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+        std::string peer_host;
+        int peer_port;
+        relay_get_addr((struct sockaddr*)&addr, len, peer_host, peer_port);
+        printd(5, "SSH2LocalForward::acceptUnlocked() %p: connection from %s:%d\n", this, peer_host.c_str(),
+            peer_port);
+        addConn(fd, RC_OPENING, std::move(peer_host), peer_port);
+    }
+}
+
+void SSH2LocalForward::addListenFds(std::vector<pollfd>& fds) {
+    if (listen_fd != -1 && conns.size() < max_connections && std::chrono::steady_clock::now() >= accept_resume)
+        fds.push_back(relay_pollfd(listen_fd, POLLIN));
+}
+
+int SSH2LocalForward::openUnlocked(RelayConn& c) {
+    LIBSSH2_CHANNEL* channel = libssh2_channel_direct_tcpip_ex(sessionUnlocked(), target_host.c_str(), target_port,
+        c.peer_host.c_str(), c.peer_port);
+    if (channel) {
+        openedUnlocked(c, channel);
+        return RS_OK;
+    }
+    if (libssh2_session_last_errno(sessionUnlocked()) == LIBSSH2_ERROR_EAGAIN)
+        return blockedOutUnlocked() ? RS_BLOCKED : RS_OK;
+    return connSessionErrorUnlocked(c, "opening a channel");
+}
+
+void SSH2LocalForward::closeListenerUnlocked(bool freed) {
+    if (listen_fd != -1) {
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+}
+#endif
+
+#ifdef _Q_WINDOWS
+int SSH2RemoteForward::resolveTarget(const char* err, ExceptionSink* xsink) {
+    xsink->raiseException(err, "port forwarding is not supported on this platform");
+    return -1;
+}
+
+int SSH2RemoteForward::listenOn(const char* bind, int timeout_ms, const char* err, ExceptionSink* xsink) {
+    xsink->raiseException(err, "port forwarding is not supported on this platform");
+    return -1;
+}
+
+void SSH2RemoteForward::acceptUnlocked() {
+}
+
+void SSH2RemoteForward::addListenFds(std::vector<pollfd>& fds) {
+}
+
+int SSH2RemoteForward::openUnlocked(RelayConn& c) {
+    return RS_DONE;
+}
+
+void SSH2RemoteForward::closeListenerUnlocked(bool freed) {
+}
+#else
+int SSH2RemoteForward::resolveTarget(const char* err, ExceptionSink* xsink) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* ai;
+    int rc = getaddrinfo(target_host.c_str(), std::to_string(target_port).c_str(), &hints, &ai);
+    if (rc) {
+        xsink->raiseException(err, "cannot resolve local host \"%s\": %s", target_host.c_str(), gai_strerror(rc));
+        return -1;
+    }
+    target_addr.assign((const char*)ai->ai_addr, (const char*)ai->ai_addr + ai->ai_addrlen);
+    target_family = ai->ai_family;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+int SSH2RemoteForward::listenOn(const char* bind, int timeout_ms, const char* err, ExceptionSink* xsink) {
+    std::string host;
+    int port;
+    if (relay_parse_bind(bind, host, port, err, xsink))
+        return -1;
+
+    // like "ssh -R", the server only accepts connections on the loopback interface unless a host is given; "*"
+    // accepts connections on all interfaces
+    if (host.empty())
+        host = "localhost";
+
+    AutoLocker al(client->m);
+    if (!client->sshConnectedUnlocked()) {
+        xsink->raiseException("SSH2CLIENT-NOT-CONNECTED", "cannot call SSH2Client::forwardRemotePort() while client "
+            "is not connected");
+        return -1;
+    }
+
+    BlockingHelper bh(client);
+
+    int bound_port = 0;
+    while (true) {
+        listener = libssh2_channel_forward_listen_ex(client->ssh_session, host == "*" ? nullptr : host.c_str(), port,
+            &bound_port, QSSH2_RELAY_LISTEN_QUEUE);
+        if (listener) {
+            listen_session = client->ssh_session;
+            break;
+        }
+        if (libssh2_session_last_errno(client->ssh_session) != LIBSSH2_ERROR_EAGAIN) {
+            client->doSessionErrUnlocked(xsink, "cannot listen on remote address \"%s\"", bind);
+            return -1;
+        }
+        // the request cannot be resumed after a timeout or cancellation, so the connection is closed in this case
+        if (client->waitSocketUnlocked(xsink, "SSH2CLIENT-TIMEOUT", err, "SSH2Client::forwardRemotePort",
+            timeout_ms))
+            return -1;
+    }
+
+    bind_host = host;
+    // the server reports the port assigned if port 0 was requested
+    bind_port = port ? port : bound_port;
+    return 0;
+}
+
+void SSH2RemoteForward::acceptUnlocked() {
+    if (!listener)
+        return;
+
+    while (conns.size() < max_connections) {
+        LIBSSH2_CHANNEL* channel = libssh2_channel_forward_accept(listener);
+        if (!channel) {
+            int err = libssh2_session_last_errno(sessionUnlocked());
+            if (err != LIBSSH2_ERROR_EAGAIN) {
+                setError("error accepting a connection on %s:%d: libssh2 returned error %d: %s", bind_host.c_str(),
+                    bind_port, err, client->getSessionErrUnlocked());
+                // the relay stops if the connection to the server has been lost
+                if (err == LIBSSH2_ERROR_SOCKET_SEND || err == LIBSSH2_ERROR_SOCKET_RECV
+                    || err == LIBSSH2_ERROR_SOCKET_DISCONNECT)
+                    stopping = true;
+            }
+            break;
+        }
+
+        printd(5, "SSH2RemoteForward::acceptUnlocked() %p: connection on %s:%d\n", this, bind_host.c_str(),
+            bind_port);
+        int fd = socket(target_family, SOCK_STREAM, 0);
+        int eno = errno;
+        // the originator of a forwarded connection is not known, so connections are identified by the remote
+        // address
+        RelayConn* c = addConn(fd, RC_CONNECTING, bind_host, bind_port);
+        openedUnlocked(*c, channel);
+        if (fd == -1) {
+            connectFailedUnlocked(*c, eno);
+            continue;
+        }
+        relay_set_fd_flags(fd);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+        // the connection is completed by the relay thread when the socket becomes writable
+        if (!connect(fd, (const struct sockaddr*)target_addr.data(), target_addr.size()))
+            continue;
+        if (errno == EINPROGRESS)
+            c->writable = false;
+        else
+            connectFailedUnlocked(*c, errno);
+    }
+}
+
+void SSH2RemoteForward::addListenFds(std::vector<pollfd>& fds) {
+    // new connections arrive on the socket of the session, which is always polled
+}
+
+int SSH2RemoteForward::openUnlocked(RelayConn& c) {
+    // channels are opened by the server
+    return RS_DONE;
+}
+
+void SSH2RemoteForward::closeListenerUnlocked(bool freed) {
+    if (!listener)
+        return;
+    if (!freed) {
+        // the server is requested to stop listening; any connections not yet accepted are freed with the listener
+        int64 start = q_clock_getmillis();
+        while (libssh2_channel_forward_cancel(listener) == LIBSSH2_ERROR_EAGAIN) {
+            if (!waitShutdownUnlocked(start))
+                break;
+        }
+    }
+    listener = nullptr;
+}
+#endif
+
+void SSH2RemoteForward::cancelListener() {
+    AutoLocker al(client->m);
+    // the relay is only registered with the client once it has been started, so the listener has to be checked
+    // against the session here; if the session has been closed, the listener has been freed with it
+    if (!listener || client->ssh_session != listen_session) {
+        listener = nullptr;
+        return;
+    }
+
+    BlockingHelper bh(client);
+    closeListenerUnlocked(false);
+}
+
+QoreObject* SSH2Client::forwardLocalPort(const char* bind, const char* host, int64 port, const QoreHashNode* opts,
+        ExceptionSink* xsink) {
+    if (port < 1 || port > 65535) {
+        xsink->raiseException(SSH2CLIENT_FORWARDLOCALPORT_ERROR, "invalid remote port " QLLD "; expecting a value "
+            "from 1 to 65535", port);
+        return nullptr;
+    }
+
+    int64 max = getIntOption(opts, "max_connections", QSSH2_RELAY_DEFAULT_CONNECTIONS);
+    if (max < 1 || max > QSSH2_RELAY_MAX_CONNECTIONS) {
+        xsink->raiseException(SSH2CLIENT_FORWARDLOCALPORT_ERROR, "invalid \"max_connections\" option " QLLD
+            "; expecting a value from 1 to %d", max, QSSH2_RELAY_MAX_CONNECTIONS);
+        return nullptr;
+    }
+
+    SSH2LocalForward* r = new SSH2LocalForward(this, host, (int)port, (size_t)max);
+    if (r->listenOn(bind, SSH2CLIENT_FORWARDLOCALPORT_ERROR, xsink)
+        || r->start(SSH2CLIENT_FORWARDLOCALPORT_ERROR, xsink)) {
+        r->deref(xsink);
+        return nullptr;
+    }
+    return new QoreObject(QC_SSH2PORTFORWARD, getProgram(), r);
+}
+
+QoreObject* SSH2Client::forwardRemotePort(const char* bind, const char* host, int64 port, const QoreHashNode* opts,
+        int timeout_ms, ExceptionSink* xsink) {
+    if (port < 1 || port > 65535) {
+        xsink->raiseException(SSH2CLIENT_FORWARDREMOTEPORT_ERROR, "invalid local port " QLLD "; expecting a value "
+            "from 1 to 65535", port);
+        return nullptr;
+    }
+
+    int64 max = getIntOption(opts, "max_connections", QSSH2_RELAY_DEFAULT_CONNECTIONS);
+    if (max < 1 || max > QSSH2_RELAY_MAX_CONNECTIONS) {
+        xsink->raiseException(SSH2CLIENT_FORWARDREMOTEPORT_ERROR, "invalid \"max_connections\" option " QLLD
+            "; expecting a value from 1 to %d", max, QSSH2_RELAY_MAX_CONNECTIONS);
+        return nullptr;
+    }
+
+    SSH2RemoteForward* r = new SSH2RemoteForward(this, host, (int)port, (size_t)max);
+    if (r->resolveTarget(SSH2CLIENT_FORWARDREMOTEPORT_ERROR, xsink)
+        || r->listenOn(bind, timeout_ms, SSH2CLIENT_FORWARDREMOTEPORT_ERROR, xsink)) {
+        r->deref(xsink);
+        return nullptr;
+    }
+    if (r->start(SSH2CLIENT_FORWARDREMOTEPORT_ERROR, xsink)) {
+        // otherwise the server would keep accepting connections on the remote port for the rest of the session
+        r->cancelListener();
+        r->deref(xsink);
+        return nullptr;
+    }
+    return new QoreObject(QC_SSH2PORTFORWARD, getProgram(), r);
+}
@@ -0,0 +1,391 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2Relay.h
+
+    native relay engine for port forwarding
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2RELAY_H
+
+#define _QORE_SSH2RELAY_H
+
+#include "SSH2Client.h"
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _Q_WINDOWS
+#include <poll.h>
+#endif
+
+DLLLOCAL extern qore_classid_t CID_SSH2PORTFORWARD;
+DLLLOCAL extern QoreClass* QC_SSH2PORTFORWARD;
+
+DLLLOCAL QoreClass* initSSH2PortForwardClass(QoreNamespace& ns);
+
+// the maximum interval between passes over all connections while any connection is open; I/O on any channel can
+// read data for other channels from the socket, so the readiness of the socket cannot be relied on alone
+#define QSSH2_RELAY_POLL_MS 20
+// the interval between passes while no connection is open
+#define QSSH2_RELAY_IDLE_MS 250
+// default maximum number of connections relayed at the same time
+#define QSSH2_RELAY_DEFAULT_CONNECTIONS 256
+// maximum number of connections relayed at the same time
+#define QSSH2_RELAY_MAX_CONNECTIONS 4096
+// the maximum number of times data is moved for one connection in a pass before the next connection is served
+#define QSSH2_RELAY_ROUNDS 8
+// the maximum number of free buffers kept for reuse
+#define QSSH2_RELAY_MAX_FREE_BUFS 64
+// the number of connections the server can open on a remote listener before they are accepted by the relay thread
+#define QSSH2_RELAY_LISTEN_QUEUE 16
+
+// relays TCP connections through channels of a connected client with a single background thread; the thread makes
+// all libssh2 calls with the client lock held and the session in non-blocking mode, and only releases the lock
+// between passes when no channel open is in progress and no packet has been partially sent, so the client can be
+// used by other threads while connections are being relayed
+//
+// subclasses provide the source of new connections
+class SSH2Relay : public AbstractPrivateData {
+public:
+    // registers the relay with the client and starts the relay thread; returns -1 if an exception was raised
+    DLLLOCAL int start(const char* err, ExceptionSink* xsink);
+
+    // stops the relay thread, closes all connections, and waits for the thread to exit; must not be called with the
+    // client lock held
+    DLLLOCAL void stop();
+
+    DLLLOCAL bool running() const {
+        AutoLocker al(l);
+        return thread_running;
+    }
+
+    // returns the port connections are accepted on
+    DLLLOCAL int getPort() const {
+        return bind_port;
+    }
+
+    // returns a hash<Ssh2PortForwardInfo>
+    DLLLOCAL QoreHashNode* getInfo(ExceptionSink* xsink) const;
+
+    // called by the client with the lock held when the session is closed; all channels are freed with the session
+    DLLLOCAL void sessionClosedUnlocked();
+
+    DLLLOCAL virtual void deref(ExceptionSink* xsink) {
+        if (ROdereference()) {
+            static_cast<AbstractPrivateData*>(client)->deref(xsink);
+            delete this;
+        }
+    }
+
+protected:
+    enum relay_state_t {
+        // the channel for the connection is being opened
+        RC_OPENING,
+        // the channel is open and the socket is being connected
+        RC_CONNECTING,
+        // data is being relayed
+        RC_OPEN,
+        // the socket has been closed and the channel is being freed
+        RC_CLOSING,
+    };
+
+    // the result of a step on a connection
+    enum relay_step_t {
+        // the connection is finished and can be removed
+        RS_DONE = -1,
+        RS_OK = 0,
+        // a packet has been partially sent; the same call must be repeated before anything else is sent
+        RS_BLOCKED = 1,
+    };
+
+    // the libssh2 call that partially sent a packet on an open connection
+    enum relay_op_t {
+        RO_NONE,
+        // libssh2_channel_write_ex()
+        RO_WRITE,
+        // libssh2_channel_send_eof()
+        RO_EOF,
+        // libssh2_channel_read_ex(), which can send a window adjustment
+        RO_READ,
+        // libssh2_channel_receive_window_adjust2()
+        RO_ADJUST,
+    };
+
+    // a relayed connection
+    struct RelayConn {
+        // the local socket
+        int fd;
+        LIBSSH2_CHANNEL* channel = nullptr;
+        relay_state_t state;
+        // the call to repeat before any other step on the connection; other calls would fail with
+        // LIBSSH2_ERROR_BAD_USE until the packet has been sent
+        relay_op_t pending = RO_NONE;
+        // the address of the peer of the local socket
+        std::string peer_host;
+        int peer_port;
+
+        // data read from the socket and not yet written to the channel
+        std::unique_ptr<char[]> up;
+        size_t up_off = 0, up_len = 0;
+        // data read from the channel and not yet written to the socket
+        std::unique_ptr<char[]> down;
+        size_t down_off = 0, down_len = 0;
+
+        // the receive window maintained for the channel; 0 = the window is maintained by libssh2 alone
+        uint32_t window = 0;
+        uint32_t max_window = 0;
+
+        // the index of the socket in the poll list or -1 if the socket is not polled
+        int pidx = -1;
+        // set when the socket may be read from or written to without blocking
+        bool readable = true;
+        bool writable = true;
+
+        // the peer of the socket has closed its side of the connection
+        bool sock_eof = false;
+        // EOF has been sent on the channel
+        bool eof_sent = false;
+        // the server has sent EOF on the channel
+        bool chan_eof = false;
+        // the socket has been shut down for writing
+        bool shut_wr = false;
+
+        DLLLOCAL RelayConn(int fd, relay_state_t state, std::string peer_host, int peer_port) : fd(fd), state(state),
+                peer_host(std::move(peer_host)), peer_port(peer_port) {
+        }
+    };
+
+    typedef std::list<std::unique_ptr<RelayConn>> conn_list_t;
+    typedef std::chrono::steady_clock::time_point time_point_t;
+
+    // the client is referenced for the life of the object
+    SSH2Client* client;
+    // "local" or "remote"
+    const char* type;
+    std::string bind_host;
+    int bind_port = 0;
+    std::string target_host;
+    int target_port;
+    size_t max_connections;
+
+    conn_list_t conns;
+
+    // set when the relay thread must stop
+    std::atomic<bool> stopping{false};
+
+    DLLLOCAL SSH2Relay(SSH2Client* client, const char* type, const char* target_host, int target_port,
+            size_t max_connections);
+
+    DLLLOCAL virtual ~SSH2Relay();
+
+    DLLLOCAL LIBSSH2_SESSION* sessionUnlocked() const {
+        return client->ssh_session;
+    }
+
+    // returns true if a packet has been partially sent
+    DLLLOCAL bool blockedOutUnlocked() const {
+        return libssh2_session_block_directions(client->ssh_session) & LIBSSH2_SESSION_BLOCK_OUTBOUND;
+    }
+
+    // adds a new connection with the given state
+    DLLLOCAL RelayConn* addConn(int fd, relay_state_t state, std::string peer_host, int peer_port);
+
+    // sets up a connection for relaying once its channel is open
+    DLLLOCAL void openedUnlocked(RelayConn& c, LIBSSH2_CHANNEL* channel);
+
+    // records the last error
+    DLLLOCAL void setError(const char* fmt, ...);
+
+    // records a libssh2 error on a connection; returns RS_DONE
+    DLLLOCAL int connSessionErrorUnlocked(RelayConn& c, const char* action);
+
+    // records an error connecting a socket to the target and starts closing the connection
+    DLLLOCAL void connectFailedUnlocked(RelayConn& c, int err);
+
+    // accepts any new connections without blocking; called with the client lock held in each pass
+    DLLLOCAL virtual void acceptUnlocked() = 0;
+
+    // adds the descriptors to poll for new connections
+    DLLLOCAL virtual void addListenFds(std::vector<pollfd>& fds) = 0;
+
+    // advances a connection in the RC_OPENING state; only one connection is opened at a time
+    DLLLOCAL virtual int openUnlocked(RelayConn& c) = 0;
+
+    // closes the listener when the relay stops; called with the client lock held; "freed" is true if the session
+    // and all of its resources have already been freed
+    DLLLOCAL virtual void closeListenerUnlocked(bool freed) = 0;
+
+    // waits for the socket while the relay is stopping; returns false if the server did not respond before the
+    // timeout, in which case the session is closed if required
+    DLLLOCAL bool waitShutdownUnlocked(int64 start);
+
+private:
+    // protects the thread state and the last error
+    mutable QoreThreadLock l;
+    QoreCondition cond;
+    bool thread_running = false;
+    // set when the session has been closed
+    bool closed = false;
+    // pipe to wake up the relay thread when it is stopped
+    int wake_pipe[2] = {-1, -1};
+
+    // the connection whose last call partially sent a packet; it must be advanced before any other connection
+    RelayConn* blocked = nullptr;
+    // the connection whose channel is being opened
+    RelayConn* opening = nullptr;
+    // set when the socket has been read in the current pass
+    bool transport_read = false;
+
+    // buffers for reuse by new connections
+    std::vector<std::unique_ptr<char[]>> free_bufs;
+
+    // connections are not read from until these times when a bandwidth limit has been reached
+    time_point_t send_resume, recv_resume;
+
+    std::vector<pollfd> pfds;
+
+    std::atomic<int64> connections{0};
+    std::atomic<int64> active{0};
+    std::atomic<int64> failed{0};
+    std::atomic<int64> bytes_sent{0};
+    std::atomic<int64> bytes_received{0};
+    std::string last_error;
+
+    DLLLOCAL static void relayThread(ExceptionSink* xsink, void* arg);
+
+    DLLLOCAL void run();
+
+    // advances all connections; returns true if the client lock must be held until the next pass
+    DLLLOCAL bool passUnlocked();
+
+    // advances one connection
+    DLLLOCAL int stepUnlocked(RelayConn& c, time_point_t now);
+
+    // moves data in both directions for an open connection
+    DLLLOCAL int relayUnlocked(RelayConn& c, time_point_t now);
+
+    // repeats the call that partially sent a packet on an open connection
+    DLLLOCAL int resumeUnlocked(RelayConn& c, time_point_t now);
+
+    // writes the data read from the socket to the channel
+    DLLLOCAL int writeChannelUnlocked(RelayConn& c, time_point_t now, bool& progress);
+
+    // sends EOF on the channel
+    DLLLOCAL int sendEofUnlocked(RelayConn& c, bool& progress);
+
+    // reads data from the channel into the buffer for the socket
+    DLLLOCAL int readChannelUnlocked(RelayConn& c, time_point_t now, bool& progress);
+
+    // keeps the receive window of the channel open after a read
+    DLLLOCAL int adjustWindowUnlocked(RelayConn& c);
+
+    // starts closing a connection; returns RS_DONE if the connection can be removed
+    DLLLOCAL int closeConnUnlocked(RelayConn& c);
+
+    // removes a connection and keeps its buffers for reuse
+    DLLLOCAL conn_list_t::iterator removeConn(conn_list_t::iterator i);
+
+    // closes the listener and all connections when the thread exits
+    DLLLOCAL void shutdownUnlocked();
+
+    // closes the socket of a connection and starts freeing its channel when the relay stops
+    DLLLOCAL void abortConnUnlocked(RelayConn& c);
+
+    // builds the poll list and returns the poll timeout
+    DLLLOCAL int preparePollUnlocked(time_point_t now);
+
+    // processes the poll results
+    DLLLOCAL void processPoll();
+
+    DLLLOCAL std::unique_ptr<char[]> getBuf();
+};
+
+// parses a bind address given as a port number optionally preceded by a host name or address and a colon; IPv6
+// addresses may be enclosed in square brackets; returns -1 if an exception was raised
+DLLLOCAL int relay_parse_bind(const char* bind, std::string& host, int& port, const char* err, ExceptionSink* xsink);
+
+// relays connections accepted on a local socket to a host and port reachable from the server through direct-tcpip
+// channels
+class SSH2LocalForward : public SSH2Relay {
+public:
+    DLLLOCAL SSH2LocalForward(SSH2Client* client, const char* target_host, int target_port, size_t max_connections) :
+            SSH2Relay(client, "local", target_host, target_port, max_connections) {
+    }
+
+    // creates the listening socket; "bind" is a port number optionally preceded by a host name or address and a
+    // colon; returns -1 if an exception was raised
+    DLLLOCAL int listenOn(const char* bind, const char* err, ExceptionSink* xsink);
+
+protected:
+    DLLLOCAL virtual ~SSH2LocalForward();
+
+    DLLLOCAL virtual void acceptUnlocked();
+    DLLLOCAL virtual void addListenFds(std::vector<pollfd>& fds);
+    DLLLOCAL virtual int openUnlocked(RelayConn& c);
+    DLLLOCAL virtual void closeListenerUnlocked(bool freed);
+
+private:
+    int listen_fd = -1;
+    // new connections are not accepted until this time after an accept error
+    time_point_t accept_resume;
+};
+
+// relays connections accepted by the server on a remote port through forwarded-tcpip channels to a host and port
+// reachable from the local host
+class SSH2RemoteForward : public SSH2Relay {
+public:
+    DLLLOCAL SSH2RemoteForward(SSH2Client* client, const char* target_host, int target_port, size_t max_connections) :
+            SSH2Relay(client, "remote", target_host, target_port, max_connections) {
+    }
+
+    // resolves the target address once, so connections can be made without blocking; returns -1 if an exception was
+    // raised
+    DLLLOCAL int resolveTarget(const char* err, ExceptionSink* xsink);
+
+    // requests the server to listen on the remote address; "bind" has the same format as for
+    // SSH2LocalForward::listenOn(); returns -1 if an exception was raised
+    DLLLOCAL int listenOn(const char* bind, int timeout_ms, const char* err, ExceptionSink* xsink);
+
+    // requests the server to stop listening if the relay could not be started
+    DLLLOCAL void cancelListener();
+
+protected:
+    DLLLOCAL virtual void acceptUnlocked();
+    DLLLOCAL virtual void addListenFds(std::vector<pollfd>& fds);
+    DLLLOCAL virtual int openUnlocked(RelayConn& c);
+    DLLLOCAL virtual void closeListenerUnlocked(bool freed);
+
+private:
+    // the listener is freed with the session if the session is closed first
+    LIBSSH2_LISTENER* listener = nullptr;
+    // the session the listener was created in
+    LIBSSH2_SESSION* listen_session = nullptr;
+    // the resolved target address
+    std::vector<char> target_addr;
+    int target_family = 0;
+};
+
+#endif // _QORE_SSH2RELAY_H
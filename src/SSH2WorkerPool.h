@@ -0,0 +1,100 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SSH2WorkerPool.h
+
+    shared work queue for native ssh2 worker threads
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SSH2WORKERPOOL_H
+
+#define _QORE_SSH2WORKERPOOL_H
+
+#include "ssh2-module.h"
+
+#include <atomic>
+
+// a set of jobs processed by a group of threads; idle workers always claim the next unprocessed job, so a few large
+// jobs never leave the other workers waiting on a static partition of the job list
+class SSH2WorkerPool {
+public:
+    DLLLOCAL SSH2WorkerPool(size_t n_jobs) : jobs(n_jobs) {
+    }
+
+    // claims the next job; returns false when all jobs have been claimed
+    DLLLOCAL bool next(size_t& i) {
+        i = pos.fetch_add(1);
+        return i < jobs;
+    }
+
+    // no more jobs will be handed out after this call
+    DLLLOCAL void stop() {
+        pos = jobs;
+    }
+
+    // starts a background worker thread; the thread function must call workerDone() as its last action
+    DLLLOCAL int startThread(q_thread_t f, void* arg, ExceptionSink* xsink) {
+        {
+            AutoLocker al(l);
+            ++running;
+        }
+        if (q_start_thread(xsink, f, arg) < 0) {
+            workerDone();
+            return -1;
+        }
+        return 0;
+    }
+
+    // called by background worker threads when they exit
+    DLLLOCAL void workerDone() {
+        AutoLocker al(l);
+        if (!--running)
+            cond.broadcast();
+    }
+
+    // waits for all background worker threads to exit
+    DLLLOCAL void wait() {
+        AutoLocker al(l);
+        while (running)
+            cond.wait(&l);
+    }
+
+    // waits up to the given time for all background worker threads to exit; returns true if they have all exited
+    DLLLOCAL bool wait(int timeout_ms) {
+        AutoLocker al(l);
+        if (running)
+            cond.wait(&l, timeout_ms);
+        return !running;
+    }
+
+    DLLLOCAL size_t size() const {
+        return jobs;
+    }
+
+private:
+    size_t jobs;
+    std::atomic<size_t> pos{0};
+
+    QoreThreadLock l;
+    QoreCondition cond;
+    unsigned running = 0;
+};
+
+#endif // _QORE_SSH2WORKERPOOL_H
@@ -0,0 +1,261 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SftpAttrCache.h
+
+    TTL-bounded cache of remote file attributes and resolved paths
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SFTPATTRCACHE_H
+
+#define _QORE_SFTPATTRCACHE_H
+
+#include "ssh2-module.h"
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// default maximum number of entries in the cache
+#define SFTP_CACHE_DEFAULT_MAX 1000
+// maximum number of known directories; the set is cleared when full
+#define SFTP_KNOWN_DIRS_MAX 10000
+
+// caches stat results and realpath resolutions by absolute path; entries expire after the TTL and the oldest entries
+// are evicted when the cache is full; the cache has no lock of its own and is only accessed with the client lock held
+//
+// directories created or found by makePath() are remembered independently of the TTL until they are invalidated or
+// the cache is cleared
+class SftpAttrCache {
+public:
+    // sets the TTL in milliseconds and the maximum number of entries; a TTL of 0 disables the cache
+    DLLLOCAL void set(int64 new_ttl_ms, size_t new_max) {
+        clear();
+        ttl_ms = new_ttl_ms > 0 ? new_ttl_ms : 0;
+        max_entries = new_max;
+    }
+
+    DLLLOCAL bool enabled() const {
+        return ttl_ms > 0;
+    }
+
+    // returns true and sets "attrs" if a current entry exists for the path
+    DLLLOCAL bool getAttrs(const std::string& path, LIBSSH2_SFTP_ATTRIBUTES& attrs) {
+        entry_map_t::iterator i;
+        if (!find(attr_map, key(path), i))
+            return false;
+        attrs = i->second.attrs;
+        return true;
+    }
+
+    DLLLOCAL void putAttrs(const std::string& path, const LIBSSH2_SFTP_ATTRIBUTES& attrs) {
+        if (!enabled())
+            return;
+        add(attr_map, false, key(path)).attrs = attrs;
+    }
+
+    // returns true and sets "resolved" if a current entry exists for the path
+    DLLLOCAL bool getRealpath(const std::string& path, std::string& resolved) {
+        entry_map_t::iterator i;
+        if (!find(realpath_map, key(path), i))
+            return false;
+        resolved = i->second.resolved;
+        return true;
+    }
+
+    DLLLOCAL void putRealpath(const std::string& path, const std::string& resolved) {
+        if (!enabled())
+            return;
+        add(realpath_map, true, key(path)).resolved = resolved;
+    }
+
+    // returns true if the directory is known to exist
+    DLLLOCAL bool isKnownDir(const std::string& path) const {
+        return known_dirs.find(key(path)) != known_dirs.end();
+    }
+
+    DLLLOCAL void addKnownDir(const std::string& path) {
+        if (known_dirs.size() >= SFTP_KNOWN_DIRS_MAX)
+            known_dirs.clear();
+        known_dirs.insert(key(path));
+    }
+
+    // removes the attributes of the given path and of all paths below it; since the path could be the target of a
+    // symbolic link or a component of any resolved path, all realpath entries are removed as well
+    DLLLOCAL void invalidate(const std::string& p) {
+        if (attr_map.empty() && realpath_map.empty() && known_dirs.empty())
+            return;
+
+        std::string path = key(p);
+        entry_map_t::iterator i = attr_map.lower_bound(path);
+        while (i != attr_map.end() && !i->first.compare(0, path.size(), path)) {
+            if (below(i->first, path)) {
+                order.erase(i->second.pos);
+                i = attr_map.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        std::set<std::string>::iterator di = known_dirs.lower_bound(path);
+        while (di != known_dirs.end() && !di->compare(0, path.size(), path)) {
+            if (below(*di, path))
+                di = known_dirs.erase(di);
+            else
+                ++di;
+        }
+
+        for (auto& j : realpath_map)
+            order.erase(j.second.pos);
+        realpath_map.clear();
+    }
+
+    // removes all entries; the counters are not reset
+    DLLLOCAL void clear() {
+        attr_map.clear();
+        realpath_map.clear();
+        order.clear();
+        known_dirs.clear();
+    }
+
+    // returns a hash<SftpCacheInfo>
+    DLLLOCAL QoreHashNode* getInfo(ExceptionSink* xsink) const {
+        QoreHashNode* h = new QoreHashNode(hashdeclSftpCacheInfo, xsink);
+        h->setKeyValue("ttl", ttl_ms, xsink);
+        h->setKeyValue("max_entries", (int64)max_entries, xsink);
+        h->setKeyValue("entries", (int64)order.size(), xsink);
+        h->setKeyValue("hits", hits, xsink);
+        h->setKeyValue("misses", misses, xsink);
+        h->setKeyValue("evictions", evictions, xsink);
+        h->setKeyValue("known_dirs", (int64)known_dirs.size(), xsink);
+        return h;
+    }
+
+private:
+    typedef std::chrono::steady_clock::time_point time_point_t;
+    // the kind of entry and the path in insertion order; the front is the oldest entry
+    typedef std::list<std::pair<bool, std::string>> order_list_t;
+
+    struct CacheEntry {
+        time_point_t expires;
+        order_list_t::iterator pos;
+        LIBSSH2_SFTP_ATTRIBUTES attrs;
+        std::string resolved;
+    };
+
+    // ordered so that all paths below a directory can be found with a single range scan
+    typedef std::map<std::string, CacheEntry> entry_map_t;
+
+    entry_map_t attr_map;
+    entry_map_t realpath_map;
+    order_list_t order;
+    // directories known to exist
+    std::set<std::string> known_dirs;
+
+    int64 ttl_ms = 0;
+    size_t max_entries = SFTP_CACHE_DEFAULT_MAX;
+
+    int64 hits = 0;
+    int64 misses = 0;
+    // entries removed because the cache was full
+    int64 evictions = 0;
+
+    // returns the path with "." components and duplicate or trailing slashes removed, so the same path always has the
+    // same key; ".." components are kept, as "dir/.." only refers to the parent of "dir" on the server if "dir" is
+    // not a symbolic link
+    DLLLOCAL static std::string key(const std::string& path) {
+        if (path.empty())
+            return path;
+
+        bool abs = path[0] == '/';
+        std::vector<std::pair<size_t, size_t>> comps;
+        size_t i = 0, len = path.size();
+        while (i < len) {
+            while (i < len && path[i] == '/')
+                ++i;
+            size_t start = i;
+            while (i < len && path[i] != '/')
+                ++i;
+            size_t clen = i - start;
+            if (!clen || (clen == 1 && path[start] == '.'))
+                continue;
+            comps.push_back(std::make_pair(start, clen));
+        }
+
+        if (comps.empty())
+            return abs ? "/" : ".";
+
+        std::string rv;
+        rv.reserve(path.size());
+        for (auto& c : comps) {
+            if (abs || !rv.empty())
+                rv.push_back('/');
+            rv.append(path, c.first, c.second);
+        }
+        return rv;
+    }
+
+    // returns true if "p" is the same as or below "path"; "p" must start with "path"
+    DLLLOCAL static bool below(const std::string& p, const std::string& path) {
+        return p.size() == path.size() || p[path.size()] == '/' || path == "/";
+    }
+
+    DLLLOCAL bool find(entry_map_t& emap, const std::string& path, entry_map_t::iterator& i) {
+        if (!enabled())
+            return false;
+        i = emap.find(path);
+        if (i == emap.end()) {
+            ++misses;
+            return false;
+        }
+        if (std::chrono::steady_clock::now() >= i->second.expires) {
+            order.erase(i->second.pos);
+            emap.erase(i);
+            ++misses;
+            return false;
+        }
+        ++hits;
+        return true;
+    }
+
+    DLLLOCAL CacheEntry& add(entry_map_t& emap, bool realpath, const std::string& path) {
+        entry_map_t::iterator i = emap.find(path);
+        if (i != emap.end()) {
+            order.erase(i->second.pos);
+        } else {
+            while (!order.empty() && order.size() >= max_entries) {
+                std::pair<bool, std::string>& oldest = order.front();
+                (oldest.first ? realpath_map : attr_map).erase(oldest.second);
+                order.pop_front();
+                ++evictions;
+            }
+            i = emap.insert(entry_map_t::value_type(path, CacheEntry())).first;
+        }
+        i->second.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl_ms);
+        i->second.pos = order.insert(order.end(), std::make_pair(realpath, path));
+        return i->second;
+    }
+};
+
+#endif // _QORE_SFTPATTRCACHE_H
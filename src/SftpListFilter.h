@@ -0,0 +1,354 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+/*
+    SftpListFilter.h
+
+    directory entry filters applied while reading remote directories
+
+    Qore Programming Language
+
+    Copyright (C) 2010 - 2026 Qore Technologies, s.r.o.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _QORE_SFTPLISTFILTER_H
+
+#define _QORE_SFTPLISTFILTER_H
+
+#include "ssh2-module.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#include <memory>
+#include <regex>
+#include <string>
+
+// file type bits for the "types" filter
+#define SFTP_FT_REGULAR      (1 << 0)
+#define SFTP_FT_DIRECTORY    (1 << 1)
+#define SFTP_FT_LINK         (1 << 2)
+#define SFTP_FT_BLOCK        (1 << 3)
+#define SFTP_FT_CHAR         (1 << 4)
+#define SFTP_FT_FIFO         (1 << 5)
+#define SFTP_FT_SOCKET       (1 << 6)
+#define SFTP_FT_UNKNOWN      (1 << 7)
+
+// a filter for directory entries; entries are checked with the raw attributes returned by libssh2_sftp_readdir(), so
+// no Qore values are created for entries that do not match
+class SftpListFilter {
+public:
+    // sets up the filter from a filter hash; returns -1 if an exception was raised
+    DLLLOCAL int init(const QoreHashNode* filter, const char* err, ExceptionSink* xsink) {
+        if (!filter)
+            return 0;
+
+        ConstHashIterator hi(filter);
+        while (hi.next()) {
+            const char* key = hi.getKey();
+            QoreValue v = hi.get();
+            if (v.isNothing())
+                continue;
+
+            if (!strcmp(key, "glob")) {
+                if (v.getType() != NT_STRING) {
+                    xsink->raiseException(err, "filter key \"glob\" must be a string; got type \"%s\" instead",
+                        v.getTypeName());
+                    return -1;
+                }
+                glob = v.get<const QoreStringNode>()->c_str();
+                has_glob = true;
+            } else if (!strcmp(key, "regex")) {
+                if (v.getType() != NT_STRING) {
+                    xsink->raiseException(err, "filter key \"regex\" must be a string; got type \"%s\" instead",
+                        v.getTypeName());
+                    return -1;
+                }
+                regex_str = v.get<const QoreStringNode>()->c_str();
+                has_regex = true;
+            } else if (!strcmp(key, "icase")) {
+                icase = v.getAsBool();
+            } else if (!strcmp(key, "types")) {
+                if (initTypes(v, err, xsink))
+                    return -1;
+            } else if (!strcmp(key, "min_size")) {
+                min_size = v.getAsBigInt();
+                has_min_size = true;
+            } else if (!strcmp(key, "max_size")) {
+                max_size = v.getAsBigInt();
+                has_max_size = true;
+            } else if (!strcmp(key, "min_mtime")) {
+                min_mtime = getEpoch(v);
+                has_min_mtime = true;
+            } else if (!strcmp(key, "max_mtime")) {
+                max_mtime = getEpoch(v);
+                has_max_mtime = true;
+            } else {
+                xsink->raiseException(err, "unknown filter key \"%s\"; supported keys: glob, regex, icase, types, "
+                    "min_size, max_size, min_mtime, max_mtime", key);
+                return -1;
+            }
+        }
+
+        if (has_regex) {
+            try {
+                std::regex::flag_type flags = std::regex::ECMAScript | std::regex::optimize;
+                if (icase)
+                    flags |= std::regex::icase;
+                regex.reset(new std::regex(regex_str, flags));
+            } catch (std::regex_error& e) {
+                xsink->raiseException(err, "invalid filter regex \"%s\": %s", regex_str.c_str(), e.what());
+                return -1;
+            }
+        }
+
+        active = has_glob || has_regex || types || has_min_size || has_max_size || has_min_mtime || has_max_mtime;
+        return 0;
+    }
+
+    // sets up the filter from the given option key, which must be a hash if present; returns -1 if an exception was
+    // raised
+    DLLLOCAL int initOption(const QoreHashNode* opts, const char* key, const char* err, ExceptionSink* xsink) {
+        QoreValue v = opts ? opts->getKeyValue(key) : QoreValue();
+        if (!v.isNothing() && v.getType() != NT_HASH) {
+            xsink->raiseException(err, "the \"%s\" option must be a hash; got type \"%s\" instead", key,
+                v.getTypeName());
+            return -1;
+        }
+        return init(v.get<const QoreHashNode>(), err, xsink);
+    }
+
+    // returns true if the filter will accept all entries
+    DLLLOCAL bool empty() const {
+        return !active;
+    }
+
+    // returns true if the entry matches all filter criteria
+    DLLLOCAL bool match(const char* name, const LIBSSH2_SFTP_ATTRIBUTES& attrs) const {
+        if (!active)
+            return true;
+
+        if (has_glob && !globMatch(glob.c_str(), name))
+            return false;
+
+        if (regex && !std::regex_search(name, *regex))
+            return false;
+
+        if (types) {
+            if (!(attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) || !(types & getType(attrs.permissions)))
+                return false;
+        }
+
+        if (has_min_size || has_max_size) {
+            if (!(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE))
+                return false;
+            if (has_min_size && (int64)attrs.filesize < min_size)
+                return false;
+            if (has_max_size && (int64)attrs.filesize > max_size)
+                return false;
+        }
+
+        if (has_min_mtime || has_max_mtime) {
+            if (!(attrs.flags & LIBSSH2_SFTP_ATTR_ACMODTIME))
+                return false;
+            if (has_min_mtime && (int64)attrs.mtime < min_mtime)
+                return false;
+            if (has_max_mtime && (int64)attrs.mtime > max_mtime)
+                return false;
+        }
+
+        return true;
+    }
+
+    // returns the SFTP_FT_* value for the given mode; uses the protocol constants so the result does not depend on
+    // the local platform
+    DLLLOCAL static unsigned getType(unsigned long mode) {
+        switch (mode & LIBSSH2_SFTP_S_IFMT) {
+            case LIBSSH2_SFTP_S_IFREG: return SFTP_FT_REGULAR;
+            case LIBSSH2_SFTP_S_IFDIR: return SFTP_FT_DIRECTORY;
+            case LIBSSH2_SFTP_S_IFLNK: return SFTP_FT_LINK;
+            case LIBSSH2_SFTP_S_IFBLK: return SFTP_FT_BLOCK;
+            case LIBSSH2_SFTP_S_IFCHR: return SFTP_FT_CHAR;
+            case LIBSSH2_SFTP_S_IFIFO: return SFTP_FT_FIFO;
+            case LIBSSH2_SFTP_S_IFSOCK: return SFTP_FT_SOCKET;
+        }
+        return SFTP_FT_UNKNOWN;
+    }
+
+private:
+    std::string glob;
+    std::string regex_str;
+    std::unique_ptr<std::regex> regex;
+
+    // bitmask of SFTP_FT_* values; 0 = all types
+    unsigned types = 0;
+
+    int64 min_size = 0, max_size = 0;
+    // in seconds since the epoch
+    int64 min_mtime = 0, max_mtime = 0;
+
+    bool has_glob = false,
+        has_regex = false,
+        icase = false,
+        has_min_size = false,
+        has_max_size = false,
+        has_min_mtime = false,
+        has_max_mtime = false,
+        active = false;
+
+    DLLLOCAL int initTypes(QoreValue v, const char* err, ExceptionSink* xsink) {
+        if (v.getType() == NT_STRING)
+            return addType(v.get<const QoreStringNode>()->c_str(), err, xsink);
+
+        if (v.getType() != NT_LIST) {
+            xsink->raiseException(err, "filter key \"types\" must be a string or a list of strings; got type \"%s\" "
+                "instead", v.getTypeName());
+            return -1;
+        }
+
+        ConstListIterator li(v.get<const QoreListNode>());
+        while (li.next()) {
+            QoreValue t = li.getValue();
+            if (t.getType() != NT_STRING) {
+                xsink->raiseException(err, "filter key \"types\" must be a string or a list of strings; got list "
+                    "element type \"%s\" instead", t.getTypeName());
+                return -1;
+            }
+            if (addType(t.get<const QoreStringNode>()->c_str(), err, xsink))
+                return -1;
+        }
+        return 0;
+    }
+
+    DLLLOCAL int addType(const char* type, const char* err, ExceptionSink* xsink) {
+        if (!strcmp(type, "REGULAR"))
+            types |= SFTP_FT_REGULAR;
+        else if (!strcmp(type, "DIRECTORY"))
+            types |= SFTP_FT_DIRECTORY;
+        else if (!strcmp(type, "SYMBOLIC-LINK"))
+            types |= SFTP_FT_LINK;
+        else if (!strcmp(type, "BLOCK-DEVICE"))
+            types |= SFTP_FT_BLOCK;
+        else if (!strcmp(type, "CHARACTER-DEVICE"))
+            types |= SFTP_FT_CHAR;
+        else if (!strcmp(type, "FIFO"))
+            types |= SFTP_FT_FIFO;
+        else if (!strcmp(type, "SOCKET"))
+            types |= SFTP_FT_SOCKET;
+        else if (!strcmp(type, "UNKNOWN"))
+            types |= SFTP_FT_UNKNOWN;
+        else {
+            xsink->raiseException(err, "unknown file type \"%s\" in filter key \"types\"; expecting one of: "
+                "REGULAR, DIRECTORY, SYMBOLIC-LINK, BLOCK-DEVICE, CHARACTER-DEVICE, FIFO, SOCKET, UNKNOWN", type);
+            return -1;
+        }
+        return 0;
+    }
+
+    // returns the time in seconds since the epoch for a date or integer value
+    DLLLOCAL static int64 getEpoch(QoreValue v) {
+        if (v.getType() == NT_DATE)
+            return v.get<const DateTimeNode>()->getEpochSecondsUTC();
+        return v.getAsBigInt();
+    }
+
+    DLLLOCAL bool charEq(char p, char c) const {
+        return icase ? tolower((unsigned char)p) == tolower((unsigned char)c) : p == c;
+    }
+
+    // matches a bracket expression starting after the '[' in "p"; sets "p" to the character after the closing ']';
+    // returns -1 if the expression is not terminated, in which case the '[' is matched literally
+    DLLLOCAL int bracketMatch(const char*& p, char c) const {
+        const char* s = p;
+        bool negate = false;
+        if (*s == '!' || *s == '^') {
+            negate = true;
+            ++s;
+        }
+        bool matched = false;
+        bool first = true;
+        while (*s && (*s != ']' || first)) {
+            first = false;
+            char lo = *s++;
+            if (*s == '-' && s[1] && s[1] != ']') {
+                char hi = s[1];
+                s += 2;
+                unsigned char uc = (unsigned char)c;
+                if (uc >= (unsigned char)lo && uc <= (unsigned char)hi)
+                    matched = true;
+                else if (icase) {
+                    unsigned char lc = tolower(uc), tc = toupper(uc);
+                    if ((lc >= (unsigned char)lo && lc <= (unsigned char)hi)
+                        || (tc >= (unsigned char)lo && tc <= (unsigned char)hi))
+                        matched = true;
+                }
+            } else if (charEq(lo, c)) {
+                matched = true;
+            }
+        }
+        if (!*s)
+            return -1;
+        p = s + 1;
+        return matched != negate ? 1 : 0;
+    }
+
+    // shell-style glob matching with "*", "?" and "[...]"; backtracks only to the last "*"
+    DLLLOCAL bool globMatch(const char* p, const char* n) const {
+        const char* star_p = nullptr;
+        const char* star_n = nullptr;
+        while (*n) {
+            if (*p == '*') {
+                while (*p == '*')
+                    ++p;
+                if (!*p)
+                    return true;
+                star_p = p;
+                star_n = n;
+                continue;
+            }
+
+            bool ok;
+            const char* next_p = p + 1;
+            if (*p == '?') {
+                ok = true;
+            } else if (*p == '[') {
+                int rc = bracketMatch(next_p, *n);
+                ok = rc < 0 ? *n == '[' : (bool)rc;
+                if (rc < 0)
+                    next_p = p + 1;
+            } else if (*p == '\\' && p[1]) {
+                ok = charEq(p[1], *n);
+                next_p = p + 2;
+            } else {
+                ok = *p && charEq(*p, *n);
+            }
+
+            if (ok) {
+                p = next_p;
+                ++n;
+                continue;
+            }
+            if (!star_p)
+                return false;
+            p = star_p;
+            n = ++star_n;
+        }
+        while (*p == '*')
+            ++p;
+        return !*p;
+    }
+};
+
+#endif // _QORE_SFTPLISTFILTER_H
@@ -1,8 +1,20 @@
 #include "QC_SSH2Base.cpp"
 #include "QC_SSH2Client.cpp"
 #include "QC_SSH2Channel.cpp"
+#include "QC_SSH2ChannelLineIterator.cpp"
+#include "QC_SSH2PortForward.cpp"
 #include "QC_SFTPClient.cpp"
+#include "QC_SFTPDirIterator.cpp"
+#include "QC_SFTPDirSnapshot.cpp"
 #include "SSH2Client.cpp"
 #include "SFTPClient.cpp"
+#include "SFTPBatch.cpp"
+#include "SFTPBulkTransfer.cpp"
+#include "SFTPWalk.cpp"
+#include "SFTPDirIterator.cpp"
+#include "SFTPDirSnapshot.cpp"
 #include "SSH2Channel.cpp"
+#include "SSH2Exec.cpp"
+#include "SSH2FanOut.cpp"
+#include "SSH2Relay.cpp"
 #include "ssh2-module.cpp"
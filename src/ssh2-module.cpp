@@ -29,7 +29,11 @@
 #include "QC_SSH2Base.h"
 #include "SSH2Client.h"
 #include "SFTPClient.h"
+#include "SFTPDirIterator.h"
+#include "SFTPDirSnapshot.h"
 #include "SSH2Channel.h"
+#include "SSH2ChannelLineIterator.h"
+#include "SSH2Relay.h"
 
 #include <string.h>
 
@@ -70,6 +74,23 @@ DLLLOCAL const TypedHashDecl* hashdeclSftpDirInfo;
 DLLLOCAL const TypedHashDecl* hashdeclSftpConnectionInfo;
 DLLLOCAL const TypedHashDecl* hashdeclSsh2ConnectionInfo;
 DLLLOCAL const TypedHashDecl* hashdeclSsh2StatInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSftpTransferResult;
+DLLLOCAL const TypedHashDecl* hashdeclSftpBulkTransferInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSftpStreamTransferInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2RateLimitInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSftpWalkError;
+DLLLOCAL const TypedHashDecl* hashdeclSftpWalkInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSftpCacheInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSftpBatchResult;
+DLLLOCAL const TypedHashDecl* hashdeclSftpDirColumns;
+DLLLOCAL const TypedHashDecl* hashdeclSftpSnapshotEntry;
+DLLLOCAL const TypedHashDecl* hashdeclSftpSnapshotDiff;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2ExecResult;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2HostResult;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2FanOutInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2ChannelWindowInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2PortForwardInfo;
+DLLLOCAL const TypedHashDecl* hashdeclSsh2WriteBufferInfo;
 
 static QoreStringNode *ssh2_module_init() {
     qore_libssh2_version = libssh2_version(LIBSSH2_VERSION_NUM);
@@ -183,11 +204,32 @@ static QoreStringNode *ssh2_module_init() {
     hashdeclSftpConnectionInfo = init_hashdecl_SftpConnectionInfo(ssh2ns);
     hashdeclSsh2ConnectionInfo = init_hashdecl_Ssh2ConnectionInfo(ssh2ns);
     hashdeclSsh2StatInfo = init_hashdecl_Ssh2StatInfo(ssh2ns);
+    hashdeclSftpTransferResult = init_hashdecl_SftpTransferResult(ssh2ns);
+    hashdeclSftpBulkTransferInfo = init_hashdecl_SftpBulkTransferInfo(ssh2ns);
+    hashdeclSftpStreamTransferInfo = init_hashdecl_SftpStreamTransferInfo(ssh2ns);
+    hashdeclSsh2RateLimitInfo = init_hashdecl_Ssh2RateLimitInfo(ssh2ns);
+    hashdeclSftpWalkError = init_hashdecl_SftpWalkError(ssh2ns);
+    hashdeclSftpWalkInfo = init_hashdecl_SftpWalkInfo(ssh2ns);
+    hashdeclSftpCacheInfo = init_hashdecl_SftpCacheInfo(ssh2ns);
+    hashdeclSftpBatchResult = init_hashdecl_SftpBatchResult(ssh2ns);
+    hashdeclSftpDirColumns = init_hashdecl_SftpDirColumns(ssh2ns);
+    hashdeclSftpSnapshotEntry = init_hashdecl_SftpSnapshotEntry(ssh2ns);
+    hashdeclSftpSnapshotDiff = init_hashdecl_SftpSnapshotDiff(ssh2ns);
+    hashdeclSsh2ExecResult = init_hashdecl_Ssh2ExecResult(ssh2ns);
+    hashdeclSsh2HostResult = init_hashdecl_Ssh2HostResult(ssh2ns);
+    hashdeclSsh2FanOutInfo = init_hashdecl_Ssh2FanOutInfo(ssh2ns);
+    hashdeclSsh2ChannelWindowInfo = init_hashdecl_Ssh2ChannelWindowInfo(ssh2ns);
+    hashdeclSsh2PortForwardInfo = init_hashdecl_Ssh2PortForwardInfo(ssh2ns);
+    hashdeclSsh2WriteBufferInfo = init_hashdecl_Ssh2WriteBufferInfo(ssh2ns);
 
     // all classes belonging to here
     ssh2ns.addSystemClass(initSSH2BaseClass(ssh2ns));
+    ssh2ns.addSystemClass(initSSH2ChannelLineIteratorClass(ssh2ns));
     ssh2ns.addSystemClass(initSSH2ChannelClass(ssh2ns));
+    ssh2ns.addSystemClass(initSSH2PortForwardClass(ssh2ns));
     ssh2ns.addSystemClass(initSSH2ClientClass(ssh2ns));
+    ssh2ns.addSystemClass(initSFTPDirIteratorClass(ssh2ns));
+    ssh2ns.addSystemClass(initSFTPDirSnapshotClass(ssh2ns));
     ssh2ns.addSystemClass(initSFTPClientClass(ssh2ns));
 
     // constants
@@ -55,11 +55,45 @@ DLLLOCAL TypedHashDecl* init_hashdecl_SftpDirInfo(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_SftpConnectionInfo(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2ConnectionInfo(QoreNamespace& ns);
 DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2StatInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpTransferResult(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpBulkTransferInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpStreamTransferInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2RateLimitInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpWalkError(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpWalkInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpCacheInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpBatchResult(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpDirColumns(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpSnapshotEntry(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_SftpSnapshotDiff(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2ExecResult(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2HostResult(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2FanOutInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2ChannelWindowInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2PortForwardInfo(QoreNamespace& ns);
+DLLLOCAL TypedHashDecl* init_hashdecl_Ssh2WriteBufferInfo(QoreNamespace& ns);
 
 DLLLOCAL extern const TypedHashDecl* hashdeclSftpFileInfo;
 DLLLOCAL extern const TypedHashDecl* hashdeclSftpDirInfo;
 DLLLOCAL extern const TypedHashDecl* hashdeclSftpConnectionInfo;
 DLLLOCAL extern const TypedHashDecl* hashdeclSsh2ConnectionInfo;
 DLLLOCAL extern const TypedHashDecl* hashdeclSsh2StatInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpTransferResult;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpBulkTransferInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpStreamTransferInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2RateLimitInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpWalkError;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpWalkInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpCacheInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpBatchResult;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpDirColumns;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpSnapshotEntry;
+DLLLOCAL extern const TypedHashDecl* hashdeclSftpSnapshotDiff;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2ExecResult;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2HostResult;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2FanOutInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2ChannelWindowInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2PortForwardInfo;
+DLLLOCAL extern const TypedHashDecl* hashdeclSsh2WriteBufferInfo;
 
 #endif
@@ -51,6 +51,8 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include <string>
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
@@ -80,6 +82,40 @@ static inline int getMsTimeoutWithDefault(const AbstractQoreNode *a, int def) {
    return a->getAsInt();
 }
 
+// returns a timeout in milliseconds from an option hash or the default if the option is not set
+static inline int getMsTimeoutOption(const QoreHashNode* opts, const char* key, int def) {
+   QoreValue v = opts ? opts->getKeyValue(key) : QoreValue();
+   if (v.isNothing())
+      return def;
+
+   if (v.getType() == NT_DATE)
+      return (int)v.get<const DateTimeNode>()->getRelativeMilliseconds();
+
+   return (int)v.getAsBigInt();
+}
+
+// returns an integer from an option hash or the default if the option is not set
+static inline int64 getIntOption(const QoreHashNode* opts, const char* key, int64 def) {
+   QoreValue v = opts ? opts->getKeyValue(key) : QoreValue();
+   return v.isNothing() ? def : v.getAsBigInt();
+}
+
+// returns a boolean from an option hash or the default if the option is not set
+static inline bool getBoolOption(const QoreHashNode* opts, const char* key, bool def) {
+   QoreValue v = opts ? opts->getKeyValue(key) : QoreValue();
+   return v.isNothing() ? def : v.getAsBool();
+}
+
+// copies the error code and description of the first exception in the sink
+static inline void getExceptionInfo(ExceptionSink& xsink, std::string& err, std::string& desc) {
+   QoreValue v = xsink.getExceptionErr();
+   if (v.getType() == NT_STRING)
+      err = v.get<const QoreStringNode>()->c_str();
+   v = xsink.getExceptionDesc();
+   if (v.getType() == NT_STRING)
+      desc = v.get<const QoreStringNode>()->c_str();
+}
+
 // thread-local storage type for faked keyboard-interactive authentication
 typedef QoreThreadLocalStorage<const char> TLKeyboardPassword;
 